@@ -3,4 +3,6 @@ CONFIG += ordered
 
 SUBDIRS += \
     SimpleArch/libs \
-    SimpleArch
+    SimpleArch \
+    SimpleArch/sarch \
+    SimpleArch/tests
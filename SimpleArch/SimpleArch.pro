@@ -1,4 +1,4 @@
-QT += quick testlib
+QT += quick testlib concurrent
 QT += widgets # prerequesite to access to default system icons
 
 CONFIG += c++11
@@ -9,10 +9,6 @@ CONFIG += c++11
 
 SOURCES += \
         main.cpp \
-        source/archiver/archivebase.cpp \
-        source/archiver/archivereader.cpp \
-        source/archiver/depacker.cpp \
-        source/archiver/packer.cpp \
         source/imageprovider/imageprovider.cpp \
         source/models/archivermodel.cpp \
         source/models/filesystemdirmodel.cpp \
@@ -31,13 +27,9 @@ qnx: target.path = /tmp/$${TARGET}/bin
 else: unix:!android: target.path = /opt/$${TARGET}/bin
 !isEmpty(target.path): INSTALLS += target
 
-LIBS += $${OUT_PWD}/libs/libzlib.a
+include(archiver.pri)
 
 HEADERS += \
-    source/archiver/archivebase.h \
-    source/archiver/archivereader.h \
-    source/archiver/depacker.h \
-    source/archiver/packer.h \
     source/imageprovider/imageprovider.h \
     source/models/archivermodel.h \
     source/models/filesystemdirmodel.h \
@@ -0,0 +1,58 @@
+#Archiver core shared by the GUI and the command line targets, needs QtCore and QtConcurrent only
+include(defines.pri)
+
+INCLUDEPATH += \
+        $${PWD} \
+        $${EXTERNAL_DIR}/zstd/lib \
+        $${EXTERNAL_DIR}/lz4/lib
+
+SOURCES += \
+        $${PWD}/source/archiver/archivebase.cpp \
+        $${PWD}/source/archiver/archivereader.cpp \
+        $${PWD}/source/archiver/checksum.cpp \
+        $${PWD}/source/archiver/codec.cpp \
+        $${PWD}/source/archiver/deflatecodec.cpp \
+        $${PWD}/source/archiver/depacker.cpp \
+        $${PWD}/source/archiver/filebatch.cpp \
+        $${PWD}/source/archiver/filescanner.cpp \
+        $${PWD}/source/archiver/levelcontroller.cpp \
+        $${PWD}/source/archiver/lz4codec.cpp \
+        $${PWD}/source/archiver/metrics.cpp \
+        $${PWD}/source/archiver/packer.cpp \
+        $${PWD}/source/archiver/pipeline.cpp \
+        $${PWD}/source/archiver/progress.cpp \
+        $${PWD}/source/archiver/tracer.cpp \
+        $${PWD}/source/archiver/workstealingqueue.cpp \
+        $${PWD}/source/archiver/zstdcodec.cpp
+
+HEADERS += \
+        $${PWD}/source/archiver/archivebase.h \
+        $${PWD}/source/archiver/archivereader.h \
+        $${PWD}/source/archiver/checksum.h \
+        $${PWD}/source/archiver/codec.h \
+        $${PWD}/source/archiver/deflatecodec.h \
+        $${PWD}/source/archiver/depacker.h \
+        $${PWD}/source/archiver/filebatch.h \
+        $${PWD}/source/archiver/filescanner.h \
+        $${PWD}/source/archiver/levelcontroller.h \
+        $${PWD}/source/archiver/lz4codec.h \
+        $${PWD}/source/archiver/metrics.h \
+        $${PWD}/source/archiver/packer.h \
+        $${PWD}/source/archiver/pipeline.h \
+        $${PWD}/source/archiver/progress.h \
+        $${PWD}/source/archiver/tracer.h \
+        $${PWD}/source/archiver/workstealingqueue.h \
+        $${PWD}/source/archiver/zstdcodec.h
+
+#Libraries are built by the libs subdirs project next to this file
+ARCHIVER_LIBS_DIR = $$shadowed($${PWD})/libs
+LIBS += $${ARCHIVER_LIBS_DIR}/libzlib.a
+LIBS += $${ARCHIVER_LIBS_DIR}/libzstd.a
+LIBS += $${ARCHIVER_LIBS_DIR}/liblz4.a
+
+#Whole buffer deflate and inflate through libdeflate, the archives stay the same
+libdeflate {
+    DEFINES += USE_LIBDEFLATE
+    INCLUDEPATH += $${EXTERNAL_DIR}/libdeflate
+    LIBS += $${ARCHIVER_LIBS_DIR}/libdeflate.a
+}
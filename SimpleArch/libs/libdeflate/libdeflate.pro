@@ -0,0 +1,33 @@
+include(../../defines.pri)
+
+QT       -= core gui
+
+TARGET = deflate
+TEMPLATE = lib
+CONFIG += staticlib
+
+# The following define makes your compiler emit warnings if you use
+# any feature of Qt which has been marked as deprecated (the exact warnings
+# depend on your compiler). Please consult the documentation of the
+# deprecated API in order to know how to port your code away from it.
+DEFINES += QT_DEPRECATED_WARNINGS
+
+# You can also make your code fail to compile if you use deprecated APIs.
+# In order to do so, uncomment the following line.
+# You can also select to disable deprecated APIs only up to a certain version of Qt.
+#DEFINES += QT_DISABLE_DEPRECATED_BEFORE=0x060000    # disables all the APIs deprecated before Qt 6.0.0
+
+LIBDEFLATE_DIR = $${EXTERNAL_DIR}/libdeflate
+
+INCLUDEPATH += \
+        $${LIBDEFLATE_DIR}
+
+#Architecture specific sources pick the SIMD implementations at runtime
+SOURCES += \
+        $$files($${LIBDEFLATE_DIR}/lib/*.c, false) \
+        $$files($${LIBDEFLATE_DIR}/lib/x86/*.c, false) \
+        $$files($${LIBDEFLATE_DIR}/lib/arm/*.c, false)
+
+HEADERS += $${LIBDEFLATE_DIR}/libdeflate.h
+
+DESTDIR = $${OUTPUT_LIBS_DIR}/
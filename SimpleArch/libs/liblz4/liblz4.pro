@@ -0,0 +1,39 @@
+include(../../defines.pri)
+
+QT       -= core gui
+
+TARGET = lz4
+TEMPLATE = lib
+CONFIG += staticlib
+
+# The following define makes your compiler emit warnings if you use
+# any feature of Qt which has been marked as deprecated (the exact warnings
+# depend on your compiler). Please consult the documentation of the
+# deprecated API in order to know how to port your code away from it.
+DEFINES += QT_DEPRECATED_WARNINGS
+
+# You can also make your code fail to compile if you use deprecated APIs.
+# In order to do so, uncomment the following line.
+# You can also select to disable deprecated APIs only up to a certain version of Qt.
+#DEFINES += QT_DISABLE_DEPRECATED_BEFORE=0x060000    # disables all the APIs deprecated before Qt 6.0.0
+
+#xxhash is bundled by zstd as well, so keep the symbols apart
+DEFINES += XXH_NAMESPACE=LZ4_
+
+LIBLZ4_DIR = $${EXTERNAL_DIR}/lz4/lib
+
+INCLUDEPATH += \
+        $${LIBLZ4_DIR}
+
+SOURCES += \
+        $${LIBLZ4_DIR}/lz4.c \
+        $${LIBLZ4_DIR}/lz4hc.c \
+        $${LIBLZ4_DIR}/lz4frame.c \
+        $${LIBLZ4_DIR}/xxhash.c
+
+HEADERS += \
+        $${LIBLZ4_DIR}/lz4.h \
+        $${LIBLZ4_DIR}/lz4hc.h \
+        $${LIBLZ4_DIR}/lz4frame.h
+
+DESTDIR = $${OUTPUT_LIBS_DIR}/
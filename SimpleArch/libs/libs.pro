@@ -2,4 +2,9 @@ TEMPLATE = subdirs
 CONFIG += ordered
 
 SUBDIRS += \
-    libzlib
+    libzlib \
+    libzstd \
+    liblz4
+
+#SIMD deflate engine, enabled by running qmake with CONFIG+=libdeflate
+libdeflate: SUBDIRS += libdeflate
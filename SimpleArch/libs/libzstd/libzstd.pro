@@ -0,0 +1,37 @@
+include(../../defines.pri)
+
+QT       -= core gui
+
+TARGET = zstd
+TEMPLATE = lib
+CONFIG += staticlib
+
+# The following define makes your compiler emit warnings if you use
+# any feature of Qt which has been marked as deprecated (the exact warnings
+# depend on your compiler). Please consult the documentation of the
+# deprecated API in order to know how to port your code away from it.
+DEFINES += QT_DEPRECATED_WARNINGS
+
+# You can also make your code fail to compile if you use deprecated APIs.
+# In order to do so, uncomment the following line.
+# You can also select to disable deprecated APIs only up to a certain version of Qt.
+#DEFINES += QT_DISABLE_DEPRECATED_BEFORE=0x060000    # disables all the APIs deprecated before Qt 6.0.0
+
+#Assembly version of the decoder loop is not portable across the toolchains we build with
+DEFINES += ZSTD_DISABLE_ASM
+
+LIBZSTD_DIR = $${EXTERNAL_DIR}/zstd/lib
+
+INCLUDEPATH += \
+        $${LIBZSTD_DIR} \
+        $${LIBZSTD_DIR}/common
+
+SOURCES += \
+        $$files($${LIBZSTD_DIR}/common/*.c, false) \
+        $$files($${LIBZSTD_DIR}/compress/*.c, false) \
+        $$files($${LIBZSTD_DIR}/decompress/*.c, false) \
+        $$files($${LIBZSTD_DIR}/dictBuilder/*.c, false)
+
+HEADERS += $$files($${LIBZSTD_DIR}/*.h, false)
+
+DESTDIR = $${OUTPUT_LIBS_DIR}/
@@ -3,6 +3,7 @@
 #include "source/models/filesystemdirmodel.h"
 #include "source/models/archivermodel.h"
 #include "source/imageprovider/imageprovider.h"
+#include "source/archiver/tracer.h"
 
 void registerTypes() {
     qmlRegisterSingletonInstance("com.example.models", 1, 0, "FilesystemDirModel", FilesystemDirModel::instance());
@@ -18,6 +19,8 @@ int main(int argc, char *argv[])
 
     QApplication app(argc, argv);
     registerTypes();
+    //Every job overwrites the trace with its own one
+    Tracer::setOutput(qEnvironmentVariable("SIMPLEARCH_TRACE"));
 
     QQmlApplicationEngine engine;
     engine.addImageProvider("icons", new ImageProvider(app.style()));
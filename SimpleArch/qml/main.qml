@@ -80,6 +80,126 @@ ApplicationWindow {
                 model: ArchiverModel.compressionLevels
                 currentIndex: 6
             }
+
+            Text {
+                text: "Codec:"
+            }
+
+            ComboBox {
+                id: compressionMethod
+
+                model: ArchiverModel.compressionMethods
+                textRole: "text"
+                valueRole: "value"
+                currentIndex: 0
+            }
+
+            Text {
+                text: "Checksum:"
+            }
+
+            ComboBox {
+                id: checksumType
+
+                model: ArchiverModel.checksumTypes
+                textRole: "text"
+                valueRole: "value"
+                currentIndex: 1
+            }
+
+            Text {
+                text: "Threads:"
+            }
+
+            SpinBox {
+                from: 1
+                to: ArchiverModel.idealThreadsCount * 4
+                value: ArchiverModel.threadsCount
+                onValueModified: {
+                    ArchiverModel.threadsCount = value
+                }
+            }
+
+            CheckBox {
+                id: parallelDeflate
+
+                text: "Parallel deflate"
+                checked: true
+            }
+
+            CheckBox {
+                id: independentBlocks
+
+                text: "Random access blocks"
+                checked: true
+            }
+
+            CheckBox {
+                id: trailingIndex
+
+                text: "Single pass"
+                checked: false
+            }
+
+            CheckBox {
+                id: solidBlocks
+
+                text: "Solid small files"
+                checked: false
+            }
+
+            CheckBox {
+                id: storeIncompressible
+
+                text: "Store incompressible"
+                checked: true
+            }
+
+            CheckBox {
+                id: deduplicate
+
+                text: "Deduplicate"
+                checked: false
+            }
+
+            CheckBox {
+                id: updateArchive
+
+                text: "Update existing"
+                checked: false
+            }
+
+            CheckBox {
+                id: updateChecksum
+
+                text: "Compare checksums"
+                checked: false
+                enabled: updateArchive.checked
+            }
+
+            CheckBox {
+                id: dictionary
+
+                text: "Trained dictionary"
+                checked: false
+            }
+
+            CheckBox {
+                id: adaptiveLevel
+
+                text: "Adaptive level, MB/s"
+                checked: false
+            }
+
+            SpinBox {
+                from: 1
+                to: 10000
+                enabled: adaptiveLevel.checked
+                value: ArchiverModel.targetThroughput
+                onValueModified: {
+                    ArchiverModel.targetThroughput = value
+                }
+            }
         }
     }
 
@@ -184,7 +304,17 @@ ApplicationWindow {
         onAccepted: {
             console.log("File choosen: " + fileDialog.fileUrls)
             if (FilesystemDirModel.browsingFilesystem && !decompressButton.decompressWholeFile) {
-                ArchiverModel.compressSelected(filesystemView.currentRow, fileUrl, compressionLevel.currentIndex);
+                ArchiverModel.compressSelected(filesystemView.currentRow, fileUrl, compressionLevel.currentIndex, compressionMethod.currentValue, checksumType.currentValue,
+                                               (parallelDeflate.checked ? ArchiverStates.PO_PARALLEL_DEFLATE : ArchiverStates.PO_NONE) |
+                                               (independentBlocks.checked ? ArchiverStates.PO_INDEPENDENT_BLOCKS : ArchiverStates.PO_NONE) |
+                                               (trailingIndex.checked ? ArchiverStates.PO_TRAILING_INDEX : ArchiverStates.PO_NONE) |
+                                               (solidBlocks.checked ? ArchiverStates.PO_SOLID_BLOCKS : ArchiverStates.PO_NONE) |
+                                               (storeIncompressible.checked ? ArchiverStates.PO_STORE_INCOMPRESSIBLE : ArchiverStates.PO_NONE) |
+                                               (deduplicate.checked ? ArchiverStates.PO_DEDUPLICATE : ArchiverStates.PO_NONE) |
+                                               (updateArchive.checked ? ArchiverStates.PO_UPDATE : ArchiverStates.PO_NONE) |
+                                               (updateArchive.checked && updateChecksum.checked ? ArchiverStates.PO_UPDATE_CHECKSUM : ArchiverStates.PO_NONE) |
+                                               (dictionary.checked ? ArchiverStates.PO_DICTIONARY : ArchiverStates.PO_NONE) |
+                                               (adaptiveLevel.checked ? ArchiverStates.PO_ADAPTIVE_LEVEL : ArchiverStates.PO_NONE));
             } else {
                 ArchiverModel.decompressSelected(filesystemView.currentRow, fileUrl, decompressButton.decompressWholeFile);
             }
@@ -0,0 +1,248 @@
+#include "bench.h"
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QRandomGenerator>
+#include <QTemporaryDir>
+#include <sys/resource.h>
+#include "source/archiver/archivereader.h"
+#include "source/archiver/depacker.h"
+#include "source/archiver/packer.h"
+
+//Fixed seed, so every build compresses exactly the same data
+#define CORPUS_SEED 0x53417263u
+
+namespace {
+    //Text of the random words compresses roughly as well as the source code or logs do
+    QByteArray textData(QRandomGenerator& rng, int size) {
+        static const char* const words[] {
+            "archive", "block", "buffer", "checksum", "compress", "deflate", "entry", "file", "header", "index",
+            "inflate", "level", "method", "offset", "packer", "payload", "reader", "size", "solid", "stream",
+            "the", "of", "and", "to", "in", "is", "for", "with", "on", "as", "by", "at", "0", "1", "42", "1024"
+        };
+        static const char separators[] { ' ', ' ', ' ', ' ', ',', '.', '\n', '\t' };
+        QByteArray data;
+        data.reserve(size + 16);
+        while (data.size() < size) {
+            data.append(words[rng.bounded(static_cast<int>(sizeof (words) / sizeof (words[0])))]);
+            data.append(separators[rng.bounded(static_cast<int>(sizeof (separators)))]);
+        }
+        data.resize(size);
+        return data;
+    }
+
+    QByteArray randomData(QRandomGenerator& rng, int size) {
+        QByteArray data((size + 3) & ~3, Qt::Initialization::Uninitialized);
+        rng.fillRange(reinterpret_cast<quint32*>(data.data()), data.size() / 4);
+        data.resize(size);
+        return data;
+    }
+
+    bool writeFile(const QString& path, const QByteArray& data) {
+        QFile f(path);
+        return f.open(QIODevice::WriteOnly) && f.write(data) == data.size();
+    }
+
+    //Peak of the process is reset before every phase where the kernel allows it, otherwise it only grows
+    void resetPeakRss() {
+        QFile f("/proc/self/clear_refs");
+        if (f.open(QIODevice::WriteOnly)) {
+            f.write("5");
+        }
+    }
+
+    int64_t peakRss() {
+        QFile f("/proc/self/status");
+        if (f.open(QIODevice::ReadOnly)) {
+            for (auto line { f.readLine() }; !line.isEmpty(); line = f.readLine()) {
+                if (line.startsWith("VmHWM:")) {
+                    return line.mid(6).trimmed().split(' ').first().toLongLong();
+                }
+            }
+        }
+        rusage usage;
+        return getrusage(RUSAGE_SELF, &usage) == 0 ? usage.ru_maxrss : -1;
+    }
+}
+
+Bench::Bench(const Options& options, std::atomic_bool& cancel, QTextStream& out) :
+    m_options(options),
+    m_cancelOperation(cancel),
+    m_out(out)
+{
+
+}
+
+Bench::Corpus Bench::generateTinyFiles(const QString& root) const {
+    QRandomGenerator rng(CORPUS_SEED);
+    Corpus corpus { "tiny", root + "/tiny", 0, 0 };
+    const uint32_t count = 20000 * m_options.scale;
+    for (uint32_t i = 0; i < count && !m_cancelOperation; ++i) {
+        const QString dir { QString("%1/d%2").arg(corpus.path).arg(i / 100) };
+        if (i % 100 == 0) {
+            QDir().mkpath(dir);
+        }
+        const auto data { textData(rng, 16 + rng.bounded(4096)) };
+        writeFile(QString("%1/f%2.txt").arg(dir).arg(i), data);
+        corpus.bytes += data.size();
+        ++corpus.files;
+    }
+    return corpus;
+}
+
+Bench::Corpus Bench::generateHugeFiles(const QString& root) const {
+    QRandomGenerator rng(CORPUS_SEED + 1);
+    Corpus corpus { "huge", root + "/huge", 0, 0 };
+    QDir().mkpath(corpus.path);
+    const uint64_t size = static_cast<uint64_t>(128) * BYTES_TO_READ * m_options.scale;
+    for (int i = 0; i < 2 && !m_cancelOperation; ++i) {
+        QFile f(QString("%1/huge%2.log").arg(corpus.path).arg(i));
+        if (!f.open(QIODevice::WriteOnly)) {
+            continue;
+        }
+        for (uint64_t written = 0; written < size && !m_cancelOperation; written += BYTES_TO_READ) {
+            f.write(textData(rng, BYTES_TO_READ));
+        }
+        corpus.bytes += f.size();
+        ++corpus.files;
+    }
+    return corpus;
+}
+
+Bench::Corpus Bench::generateIncompressible(const QString& root) const {
+    QRandomGenerator rng(CORPUS_SEED + 2);
+    Corpus corpus { "incompressible", root + "/incompressible", 0, 0 };
+    QDir().mkpath(corpus.path);
+    for (int i = 0; i < 8 * m_options.scale && !m_cancelOperation; ++i) {
+        const auto data { randomData(rng, 8 * BYTES_TO_READ) };
+        writeFile(QString("%1/random%2.bin").arg(corpus.path).arg(i), data);
+        corpus.bytes += data.size();
+        ++corpus.files;
+    }
+    return corpus;
+}
+
+Bench::Corpus Bench::generateDeepTree(const QString& root) const {
+    QRandomGenerator rng(CORPUS_SEED + 3);
+    Corpus corpus { "deep", root + "/deep", 0, 0 };
+    for (int chain = 0; chain < 4 * m_options.scale && !m_cancelOperation; ++chain) {
+        QString dir { QString("%1/c%2").arg(corpus.path).arg(chain) };
+        for (int depth = 0; depth < 48; ++depth) {
+            dir += QString("/level%1").arg(depth);
+            QDir().mkpath(dir);
+            for (int i = 0; i < 8; ++i) {
+                const auto data { textData(rng, 1024 + rng.bounded(16384)) };
+                writeFile(QString("%1/f%2.txt").arg(dir).arg(i), data);
+                corpus.bytes += data.size();
+                ++corpus.files;
+            }
+        }
+    }
+    return corpus;
+}
+
+void Bench::report(const Corpus& corpus, const QString& phase, ArchiveBase::CompressionLevels level, int64_t nsecs, uint64_t archiveSize, int64_t peakRss) {
+    const double seconds = nsecs / 1e9;
+    const QJsonObject result {
+        { "corpus", corpus.name },
+        { "phase", phase },
+        { "method", static_cast<int>(m_options.method) },
+        { "level", static_cast<int>(level) },
+        { "threads", m_options.threads },
+        { "bytes", static_cast<qint64>(corpus.bytes) },
+        { "files", static_cast<qint64>(corpus.files) },
+        { "seconds", seconds },
+        { "mb_per_s", seconds > 0 ? corpus.bytes / seconds / BYTES_TO_READ : 0 },
+        { "files_per_s", seconds > 0 ? corpus.files / seconds : 0 },
+        { "peak_rss_kb", static_cast<qint64>(peakRss) },
+        { "archive_bytes", static_cast<qint64>(archiveSize) },
+        { "ratio", corpus.bytes > 0 ? static_cast<double>(archiveSize) / corpus.bytes : 0 }
+    };
+    m_out << QJsonDocument(result).toJson(QJsonDocument::Compact) << Qt::endl;
+}
+
+void Bench::run(const Corpus& corpus, const QString& workDir) {
+    const QString outDir { workDir + "/out" };
+    for (const auto level: m_options.levels) {
+        for (int repeat = 0; repeat < m_options.repeats && !m_cancelOperation; ++repeat) {
+            const QString archive { QString("%1/%2-%3.sar").arg(workDir, corpus.name).arg(static_cast<int>(level)) };
+            QFile::remove(archive);
+            QElapsedTimer timer;
+
+            Packer packer(m_cancelOperation);
+            if (m_options.threads > 0) {
+                packer.setThreadsCount(m_options.threads);
+            }
+            resetPeakRss();
+            timer.start();
+            packer.pack(archive, level, m_options.method, m_options.checksumType, m_options.packOptions, { QFileInfo(corpus.path) });
+            const auto packTime = timer.nsecsElapsed();
+            const uint64_t archiveSize = QFileInfo(archive).size();
+            report(corpus, "pack", level, packTime, archiveSize, peakRss());
+
+            std::atomic_bool processing { true };
+            QSharedPointer<ArchiveReader> reader(new ArchiveReader(processing));
+            resetPeakRss();
+            timer.start();
+            reader->readArchive(archive);
+            report(corpus, "read", level, timer.nsecsElapsed(), archiveSize, peakRss());
+
+            Depacker depacker(m_cancelOperation);
+            if (m_options.threads > 0) {
+                depacker.setThreadsCount(m_options.threads);
+            }
+            QDir(outDir).removeRecursively();
+            QDir().mkpath(outDir);
+            resetPeakRss();
+            timer.start();
+            depacker.depackFile(outDir, archive);
+            report(corpus, "depack_file", level, timer.nsecsElapsed(), archiveSize, peakRss());
+
+            //Selected entries path of the GUI, the root entries are expanded through the reader
+            QList<ArchiveReader::FileInfo> rootEntries;
+            for (const auto& entry: reader->getFileInfoList("./")) {
+                if (entry.getFileName() != "..") {
+                    rootEntries.append(entry);
+                }
+            }
+            QDir(outDir).removeRecursively();
+            QDir().mkpath(outDir);
+            resetPeakRss();
+            timer.start();
+            depacker.depack(outDir, archive, reader, rootEntries);
+            report(corpus, "depack", level, timer.nsecsElapsed(), archiveSize, peakRss());
+
+            QDir(outDir).removeRecursively();
+            QFile::remove(archive);
+        }
+    }
+}
+
+bool Bench::exec() {
+    QTemporaryDir tempDir(m_options.workDir.isEmpty() ? QDir::tempPath() + "/sarch-bench-XXXXXX" : m_options.workDir + "/sarch-bench-XXXXXX");
+    if (!tempDir.isValid()) {
+        return false;
+    }
+    const QString corpusRoot { tempDir.path() + "/corpus" };
+    const QVector<QPair<QString, Corpus (Bench::*)(const QString&) const>> generators {
+        { "tiny", &Bench::generateTinyFiles },
+        { "huge", &Bench::generateHugeFiles },
+        { "incompressible", &Bench::generateIncompressible },
+        { "deep", &Bench::generateDeepTree }
+    };
+    for (const auto& generator: generators) {
+        if (m_cancelOperation) {
+            break;
+        }
+        if (!m_options.corpora.isEmpty() && !m_options.corpora.contains(generator.first)) {
+            continue;
+        }
+        //Corpus is generated right before its run and removed after it, so only one of them occupies the disk
+        const auto corpus { (this->*generator.second)(corpusRoot) };
+        run(corpus, tempDir.path());
+        QDir(corpus.path).removeRecursively();
+    }
+    return !m_cancelOperation;
+}
@@ -0,0 +1,52 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <QList>
+#include <QString>
+#include <QTextStream>
+#include "source/archiver/archivebase.h"
+
+//Packs, reads and extracts the generated corpora and prints one JSON object per measurement,
+//so the results of the different builds could be compared line by line
+class Bench
+{
+public:
+    struct Options {
+        QList<ArchiveBase::CompressionLevels> levels;
+        ArchiveBase::CompressionMethods method;
+        ArchiveBase::ChecksumTypes checksumType;
+        ArchiveBase::PackOptions packOptions;
+        int threads;                    //0 keeps the default of the pool
+        int scale;                      //Multiplies the size of every corpus
+        int repeats;
+        QStringList corpora;            //Empty to run all of them
+        QString workDir;                //Temporary directory if empty
+    };
+
+private:
+    const Options& m_options;
+    std::atomic_bool& m_cancelOperation;
+    QTextStream& m_out;
+
+    struct Corpus {
+        QString name;
+        QString path;
+        uint64_t bytes;
+        uint32_t files;
+    };
+
+    Corpus generateTinyFiles(const QString& root) const;
+    Corpus generateHugeFiles(const QString& root) const;
+    Corpus generateIncompressible(const QString& root) const;
+    Corpus generateDeepTree(const QString& root) const;
+    void run(const Corpus& corpus, const QString& workDir);
+    void report(const Corpus& corpus, const QString& phase, ArchiveBase::CompressionLevels level, int64_t nsecs, uint64_t archiveSize, int64_t peakRss);
+
+public:
+    Bench(const Options& options, std::atomic_bool& cancel, QTextStream& out);
+    virtual ~Bench() = default;
+
+    bool exec();
+};
+
+#endif // BENCH_H
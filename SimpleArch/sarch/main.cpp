@@ -0,0 +1,467 @@
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QDateTime>
+#include <QDir>
+#include <QMutex>
+#include <QTextStream>
+#include <QWaitCondition>
+#include <algorithm>
+#include <csignal>
+#include <cstdio>
+#include <limits>
+#include <thread>
+#include "source/archiver/packer.h"
+#include "source/archiver/depacker.h"
+#include "source/archiver/archivereader.h"
+#include "source/archiver/filebatch.h"
+#include "source/archiver/tracer.h"
+#include "bench.h"
+
+namespace {
+    std::atomic_bool cancelOperation { false };
+    bool verbose = false;
+
+    //Milliseconds between the progress samples printed in the verbose mode
+    const unsigned long PROGRESS_INTERVAL = 200;
+
+    enum ExitCodes {
+        EC_SUCCESS = 0,
+        EC_FAILURE,
+        EC_USAGE
+    };
+
+    void onSignal(int) {
+        cancelOperation = true;
+    }
+
+    //Archiver classes report every file through qDebug, which is the noise in scripts unless asked for
+    void messageHandler(QtMsgType type, const QMessageLogContext&, const QString& message) {
+        if (type == QtDebugMsg && !verbose) {
+            return;
+        }
+        QTextStream(stderr) << message << Qt::endl;
+    }
+
+    QTextStream& out() {
+        static QTextStream s(stdout);
+        return s;
+    }
+
+    QTextStream& err() {
+        static QTextStream s(stderr);
+        return s;
+    }
+
+    //Jobs run on the main thread, so their progress is sampled by the thread of its own. Entries finished in between
+    //the samples are not printed
+    class ProgressPrinter
+    {
+        const Progress& m_progress;
+        QMutex m_mutex;
+        QWaitCondition m_stopped;
+        bool m_stop;
+        std::thread m_thread;
+
+        void run() {
+            QString last;
+            QMutexLocker lock(&m_mutex);
+            while (!m_stop) {
+                m_stopped.wait(&m_mutex, PROGRESS_INTERVAL);
+                const auto snapshot { m_progress.snapshot() };
+                if (!snapshot.fileName.isEmpty() && snapshot.fileName != last) {
+                    last = snapshot.fileName;
+                    QTextStream(stderr) << QString("[%1/%2] ").arg(snapshot.entriesDone).arg(snapshot.entriesTotal) << last << Qt::endl;
+                }
+            }
+        }
+
+    public:
+        explicit ProgressPrinter(const Progress& progress) :
+            m_progress(progress),
+            m_stop(false),
+            m_thread(&ProgressPrinter::run, this)
+        {
+
+        }
+
+        virtual ~ProgressPrinter() {
+            {
+                QMutexLocker lock(&m_mutex);
+                m_stop = true;
+                m_stopped.wakeAll();
+            }
+            m_thread.join();
+        }
+    };
+
+    bool parseMethod(const QString& name, ArchiveBase::CompressionMethods& method) {
+        static const QHash<QString, ArchiveBase::CompressionMethods> methods {
+            { "deflate", ArchiveBase::CM_DEFLATE },
+            { "zstd", ArchiveBase::CM_ZSTD },
+            { "zstd-long", ArchiveBase::CM_ZSTD_LONG },
+            { "lz4", ArchiveBase::CM_LZ4 }
+        };
+        const auto it = methods.constFind(name.toLower());
+        if (it == methods.constEnd() || !Codec::get(it.value())) {
+            return false;
+        }
+        method = it.value();
+        return true;
+    }
+
+    bool parseChecksum(const QString& name, ArchiveBase::ChecksumTypes& checksum) {
+        const auto lower = name.toLower();
+        if (lower == "adler32") {
+            checksum = ArchiveBase::CS_ADLER32;
+        } else if (lower == "crc32c") {
+            checksum = ArchiveBase::CS_CRC32C;
+        } else {
+            return false;
+        }
+        return Checksum::isSupported(checksum);
+    }
+
+    QString methodName(uint8_t compression) {
+        switch (ArchiveBase::getCompressionMethod(compression)) {
+        case ArchiveBase::CM_DEFLATE:
+            return "deflate";
+        case ArchiveBase::CM_STORE:
+            return "store";
+        case ArchiveBase::CM_ZSTD:
+            return "zstd";
+        case ArchiveBase::CM_ZSTD_LONG:
+            return "zstd-long";
+        case ArchiveBase::CM_LZ4:
+            return "lz4";
+        }
+        return "unknown";
+    }
+
+    bool parseLevel(const QString& value, ArchiveBase::CompressionLevels& level) {
+        bool ok = true;
+        const int l = value.toInt(&ok);
+        if (!ok || l < ArchiveBase::C_NO_COMPRESSION || l > ArchiveBase::C_BEST_COMPRESSION) {
+            err() << "Invalid level " << value << Qt::endl;
+            return false;
+        }
+        level = static_cast<ArchiveBase::CompressionLevels>(l);
+        return true;
+    }
+
+    //Method, checksum and flags shared by pack and bench
+    bool parsePackOptions(const QCommandLineParser& parser, ArchiveBase::CompressionMethods& method, ArchiveBase::ChecksumTypes& checksum, ArchiveBase::PackOptions& options) {
+        if (!parseMethod(parser.value("method"), method)) {
+            err() << "Unsupported method " << parser.value("method") << Qt::endl;
+            return false;
+        }
+        if (!parseChecksum(parser.value("checksum"), checksum)) {
+            err() << "Unsupported checksum " << parser.value("checksum") << Qt::endl;
+            return false;
+        }
+
+        static const QVector<QPair<QString, ArchiveBase::PackOption>> flags {
+            { "parallel-deflate", ArchiveBase::PO_PARALLEL_DEFLATE },
+            { "blocks", ArchiveBase::PO_INDEPENDENT_BLOCKS },
+            { "trailing-index", ArchiveBase::PO_TRAILING_INDEX },
+            { "solid", ArchiveBase::PO_SOLID_BLOCKS },
+            { "store-incompressible", ArchiveBase::PO_STORE_INCOMPRESSIBLE },
+            { "dedup", ArchiveBase::PO_DEDUPLICATE },
+            { "update", ArchiveBase::PO_UPDATE },
+            { "update-checksum", ArchiveBase::PO_UPDATE_CHECKSUM },
+            { "dictionary", ArchiveBase::PO_DICTIONARY }
+        };
+        options = ArchiveBase::PO_NONE;
+        for (const auto& flag: flags) {
+            if (parser.isSet(flag.first)) {
+                options |= flag.second;
+            }
+        }
+        if (options.testFlag(ArchiveBase::PO_UPDATE_CHECKSUM)) {
+            options |= ArchiveBase::PO_UPDATE;
+        }
+        return true;
+    }
+
+    //Report goes to stderr for -, as stdout could be the archive itself
+    void writeReport(const QCommandLineParser& parser, const Metrics& metrics) {
+        if (!parser.isSet("report")) {
+            return;
+        }
+        const QString path { parser.value("report") };
+        QFile f(path);
+        const bool opened = path == "-" ? f.open(fileno(stderr), QIODevice::WriteOnly) : f.open(QIODevice::WriteOnly | QIODevice::Truncate);
+        if (!opened || f.write(metrics.report().append('\n')) < 0) {
+            err() << "Couldn't write the report to " << path << Qt::endl;
+        }
+    }
+
+    int pack(const QCommandLineParser& parser, const QStringList& args) {
+        if (args.size() < 2) {
+            err() << "pack needs the archive name and at least one file" << Qt::endl;
+            return EC_USAGE;
+        }
+        ArchiveBase::CompressionLevels level;
+        ArchiveBase::CompressionMethods method = ArchiveBase::CM_DEFLATE;
+        ArchiveBase::ChecksumTypes checksum = ArchiveBase::CS_ADLER32;
+        ArchiveBase::PackOptions options;
+        if (!parseLevel(parser.value("level"), level) || !parsePackOptions(parser, method, checksum, options)) {
+            return EC_USAGE;
+        }
+
+        QFileInfoList entries;
+        for (int i = 1; i < args.size(); ++i) {
+            const QFileInfo info(args.at(i));
+            if (!info.exists()) {
+                err() << "No such file " << args.at(i) << Qt::endl;
+                return EC_FAILURE;
+            }
+            entries.append(info);
+        }
+
+        Packer packer(cancelOperation);
+        if (parser.isSet("threads")) {
+            packer.setThreadsCount(parser.value("threads").toInt());
+        }
+        if (parser.isSet("adaptive")) {
+            options |= ArchiveBase::PO_ADAPTIVE_LEVEL;
+            packer.setTargetThroughput(parser.value("adaptive").toUInt());
+        }
+        if (parser.isSet("time-budget")) {
+            options |= ArchiveBase::PO_ADAPTIVE_LEVEL;
+            packer.setTimeBudget(parser.value("time-budget").toUInt());
+        }
+        bool failed = false;
+        QObject::connect(&packer, &Packer::packerStateChanged, [&failed](ArchiveBase::ArchiverStates state) {
+            failed = failed || state == ArchiveBase::ArchiverStates::PS_COMPRESSION_ERROR;
+        });
+        QScopedPointer<ProgressPrinter> printer(verbose ? new ProgressPrinter(packer.getProgress()) : nullptr);
+        if (args.first() == "-") {
+            //Archive goes to the pipe in a single pass, so it could be extracted from the other end right away
+            QFile stream;
+            if (!stream.open(fileno(stdout), QIODevice::WriteOnly)) {
+                return EC_FAILURE;
+            }
+            packer.packStream(stream, level, method, checksum, options, entries);
+            failed = !stream.flush() || failed;
+        } else {
+            packer.pack(QDir::current().absoluteFilePath(args.first()), level, method, checksum, options, entries);
+        }
+        printer.reset();
+        writeReport(parser, packer.getMetrics());
+        if (failed) {
+            err() << "Couldn't write " << args.first() << Qt::endl;
+        }
+        return failed || cancelOperation ? EC_FAILURE : EC_SUCCESS;
+    }
+
+    int extract(const QCommandLineParser& parser, const QStringList& args) {
+        if (args.isEmpty() || args.size() > 2) {
+            err() << "extract needs the archive name and optionally the output directory" << Qt::endl;
+            return EC_USAGE;
+        }
+        const QString outDir = args.size() > 1 ? args.at(1) : QDir::currentPath();
+        if (!QDir().mkpath(outDir)) {
+            err() << "Couldn't create " << outDir << Qt::endl;
+            return EC_FAILURE;
+        }
+        Depacker depacker(cancelOperation);
+        if (parser.isSet("threads")) {
+            depacker.setThreadsCount(parser.value("threads").toInt());
+        }
+        bool failed = false;
+        QObject::connect(&depacker, &Depacker::depackerStateChanged, [&failed](ArchiveBase::ArchiverStates state) {
+            failed = failed || state == ArchiveBase::ArchiverStates::PS_DECOMPRESSION_ERROR;
+        });
+        QScopedPointer<ProgressPrinter> printer(verbose ? new ProgressPrinter(depacker.getProgress()) : nullptr);
+        if (args.first() == "-") {
+            QFile stream;
+            if (!stream.open(fileno(stdin), QIODevice::ReadOnly)) {
+                return EC_FAILURE;
+            }
+            const bool ok = depacker.depackStream(stream, QDir(outDir).absolutePath());
+            printer.reset();
+            writeReport(parser, depacker.getMetrics());
+            return ok && !cancelOperation ? EC_SUCCESS : EC_FAILURE;
+        }
+        if (!ArchiveBase::isArchive(args.first())) {
+            err() << args.first() << " is not an archive" << Qt::endl;
+            return EC_FAILURE;
+        }
+        depacker.depackFile(QDir(outDir).absolutePath(), args.first());
+        printer.reset();
+        writeReport(parser, depacker.getMetrics());
+        return failed || cancelOperation ? EC_FAILURE : EC_SUCCESS;
+    }
+
+    int list(const QStringList& args) {
+        if (args.size() != 1) {
+            err() << "list needs the archive name" << Qt::endl;
+            return EC_USAGE;
+        }
+        QFile f(args.first());
+        QVector<ArchiveReader::FileInfo> entries;
+        if (!f.open(QIODevice::ReadOnly) || !ArchiveReader::readIndex(f, entries)) {
+            err() << "Couldn't read the index of " << args.first() << Qt::endl;
+            return EC_FAILURE;
+        }
+        uint64_t total = 0;
+        uint64_t totalCompressed = 0;
+        for (const auto& entry: entries) {
+            const auto& archEntry = entry.getArchEntry();
+            const bool dir = archEntry.entry_type == ArchiveBase::ET_DIR;
+            out() << (dir ? "d " : "- ")
+                  << QString::number(archEntry.uncompressed_size).rightJustified(14) << ' '
+                  << QString::number(archEntry.compressed_size).rightJustified(14) << ' '
+                  << (dir ? QString(12, ' ') : QString("%1/%2").arg(methodName(archEntry.compression)).arg(ArchiveBase::getCompressionLevel(archEntry.compression)).leftJustified(12)) << ' '
+                  << QDateTime::fromSecsSinceEpoch(archEntry.file_time).toString(Qt::ISODate) << ' '
+                  << entry.getFileName() << '\n';
+            total += archEntry.uncompressed_size;
+            totalCompressed += archEntry.compressed_size;
+        }
+        out() << entries.size() << " entries, " << total << " bytes, " << totalCompressed << " compressed" << Qt::endl;
+        return EC_SUCCESS;
+    }
+
+    int cat(const QStringList& args) {
+        if (args.size() < 2 || args.size() > 4) {
+            err() << "cat needs the archive name, the entry and optionally the offset and the length" << Qt::endl;
+            return EC_USAGE;
+        }
+        bool offsetValid = true;
+        bool lengthValid = true;
+        const uint64_t offset = args.size() > 2 ? args.at(2).toULongLong(&offsetValid) : 0;
+        const uint64_t length = args.size() > 3 ? args.at(3).toULongLong(&lengthValid) : std::numeric_limits<uint64_t>::max();
+        if (!offsetValid || !lengthValid) {
+            err() << "Invalid range " << args.mid(2).join(' ') << Qt::endl;
+            return EC_USAGE;
+        }
+        QFile f(args.first());
+        QVector<ArchiveReader::FileInfo> entries;
+        ArchiveReader::ArchiveInfo info;
+        if (!f.open(QIODevice::ReadOnly) || !ArchiveReader::readIndex(f, entries, &info)) {
+            err() << "Couldn't read the index of " << args.first() << Qt::endl;
+            return EC_FAILURE;
+        }
+        const auto it = std::find_if(entries.cbegin(), entries.cend(), [&args](const ArchiveReader::FileInfo& entry) {
+            return entry.getFileName() == args.at(1) && entry.getArchEntry().entry_type == ArchiveBase::ET_FILE;
+        });
+        if (it == entries.cend()) {
+            err() << "No such file " << args.at(1) << " in " << args.first() << Qt::endl;
+            return EC_FAILURE;
+        }
+        //Only the blocks of the entry overlapping the range are inflated
+        Depacker depacker(cancelOperation);
+        QByteArray data;
+        if (!depacker.readRange(f, info, *it, offset, qMin(length, std::numeric_limits<uint64_t>::max() - offset), data)) {
+            err() << "Couldn't read " << args.at(1) << Qt::endl;
+            return EC_FAILURE;
+        }
+        QFile stream;
+        if (!stream.open(fileno(stdout), QIODevice::WriteOnly) || stream.write(data) != data.size() || !stream.flush()) {
+            return EC_FAILURE;
+        }
+        return EC_SUCCESS;
+    }
+
+    int test(const QCommandLineParser& parser, const QStringList& args) {
+        if (args.size() != 1) {
+            err() << "test needs the archive name" << Qt::endl;
+            return EC_USAGE;
+        }
+        Depacker depacker(cancelOperation);
+        if (parser.isSet("threads")) {
+            depacker.setThreadsCount(parser.value("threads").toInt());
+        }
+        const bool ok = depacker.testArchive(args.first());
+        writeReport(parser, depacker.getMetrics());
+        out() << args.first() << (ok ? ": OK" : ": FAILED") << Qt::endl;
+        return ok ? EC_SUCCESS : EC_FAILURE;
+    }
+
+    int bench(const QCommandLineParser& parser) {
+        Bench::Options options { { }, ArchiveBase::CM_DEFLATE, ArchiveBase::CS_ADLER32, ArchiveBase::PO_NONE,
+                                 parser.value("threads").toInt(), qMax(parser.value("scale").toInt(), 1), qMax(parser.value("repeat").toInt(), 1),
+                                 parser.values("corpus"), parser.value("work-dir") };
+        if (!parsePackOptions(parser, options.method, options.checksumType, options.packOptions)) {
+            return EC_USAGE;
+        }
+        //Update would reuse the payloads of the previous run
+        options.packOptions.setFlag(ArchiveBase::PO_UPDATE, false);
+        options.packOptions.setFlag(ArchiveBase::PO_UPDATE_CHECKSUM, false);
+        for (const auto& value: parser.value("levels").split(',')) {
+            ArchiveBase::CompressionLevels level;
+            if (!parseLevel(value, level)) {
+                return EC_USAGE;
+            }
+            options.levels.append(level);
+        }
+        Bench b(options, cancelOperation, out());
+        return b.exec() ? EC_SUCCESS : EC_FAILURE;
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    QCoreApplication::setApplicationName("sarch");
+    qInstallMessageHandler(messageHandler);
+    std::signal(SIGINT, onSignal);
+    std::signal(SIGTERM, onSignal);
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("SimpleArch command line archiver");
+    parser.addHelpOption();
+    parser.addPositionalArgument("command", "pack <archive> <files...> | extract <archive> [dir] | list <archive> | cat <archive> <entry> [offset [length]] | test <archive> | bench, "
+                                            "the archive - is written to stdout or read from stdin");
+    parser.addOptions({
+        { { "l", "level" }, "Compression level, 0 stores the files.", "level", "6" },
+        { { "m", "method" }, "Compression method: deflate, zstd, zstd-long or lz4.", "method", "deflate" },
+        { { "c", "checksum" }, "Checksum: adler32 or crc32c.", "checksum", "adler32" },
+        { { "j", "threads" }, "Number of the worker threads.", "count" },
+        { "parallel-deflate", "Deflate large files by chunks on all the threads." },
+        { "blocks", "Split files into independently compressed blocks." },
+        { "trailing-index", "Write the archive in a single pass." },
+        { "solid", "Compress small files together in solid blocks." },
+        { "store-incompressible", "Store the already compressed files as is." },
+        { "dedup", "Store the identical files once." },
+        { "update", "Reuse the payloads of the unchanged files of the existing archive." },
+        { "update-checksum", "Also compare the files by the checksum while updating." },
+        { "dictionary", "Compress small files with the trained dictionary." },
+        { "adaptive", "Pick the level up to --level to keep up with the throughput.", "MB/s" },
+        { "time-budget", "Pick the level up to --level to finish in time.", "seconds" },
+        { "levels", "Comma separated levels to benchmark.", "levels", "1,6,9" },
+        { "corpus", "Corpus to benchmark: tiny, huge, incompressible or deep, all of them by default.", "corpus" },
+        { "scale", "Multiplier of the corpus sizes.", "factor", "1" },
+        { "repeat", "Number of the runs of every level.", "count", "1" },
+        { "work-dir", "Directory for the corpora and archives instead of the temporary one.", "dir" },
+        { "report", "Write the JSON report of the phase timings of the job to the file, - for stderr.", "file" },
+        { "trace", "Write the Chrome trace of the threads doing the job to the file.", "file" },
+        { "no-io-uring", "Open, read and write the small files one by one even where io_uring is there." },
+        { { "v", "verbose" }, "Print the files being processed." }
+    });
+    parser.process(app);
+    verbose = parser.isSet("verbose");
+    Tracer::setOutput(parser.value("trace"));
+    FileBatch::setEnabled(!parser.isSet("no-io-uring"));
+
+    auto args = parser.positionalArguments();
+    if (args.isEmpty()) {
+        parser.showHelp(EC_USAGE);
+    }
+    const QString command = args.takeFirst();
+    if (command == "pack") {
+        return pack(parser, args);
+    } else if (command == "extract") {
+        return extract(parser, args);
+    } else if (command == "list") {
+        return list(args);
+    } else if (command == "cat") {
+        return cat(args);
+    } else if (command == "test") {
+        return test(parser, args);
+    } else if (command == "bench") {
+        return bench(parser);
+    }
+    err() << "Unknown command " << command << Qt::endl;
+    parser.showHelp(EC_USAGE);
+}
@@ -0,0 +1,20 @@
+#Headless archiver for scripts and benchmarks, built without QtGui and QtQuick
+QT = core concurrent
+
+CONFIG += c++11 console
+CONFIG -= app_bundle
+
+TARGET = sarch
+
+SOURCES += \
+        bench.cpp \
+        main.cpp
+
+HEADERS += \
+        bench.h
+
+include(../archiver.pri)
+
+# Default rules for deployment.
+unix:!android: target.path = /opt/$${TARGET}/bin
+!isEmpty(target.path): INSTALLS += target
@@ -1,18 +1,35 @@
 #include "archivebase.h"
 #include <cstring>
 #include <QFile>
+#include <QThread>
 
 const uint8_t ArchiveBase::SIGNATURE[SIGNATURE_SIZE] = { 'S', 'i', 'm', 'p', 'l', 'e', 'A', 'r', 'c', 'h' };
+const uint8_t ArchiveBase::SIGNATURE_V2[SIGNATURE_SIZE] = { 'S', 'i', 'm', 'p', 'l', 'e', 'A', 'r', 'c', '2' };
 
 ArchiveBase::ArchiveBase(QObject* parent) :
     QObject(parent)
 {
     qRegisterMetaType<ArchiveBase::CompressionLevels>("ArchiveBase::CompressionLevels");
+    qRegisterMetaType<ArchiveBase::CompressionMethods>("ArchiveBase::CompressionMethods");
+    qRegisterMetaType<ArchiveBase::ChecksumTypes>("ArchiveBase::ChecksumTypes");
     qRegisterMetaType<ArchiveBase::ArchiverStates>("ArchiveBase::ArchiverStates");
+    qRegisterMetaType<ArchiveBase::PackOptions>("ArchiveBase::PackOptions");
+
+    m_workers.setMaxThreadCount(QThread::idealThreadCount());
+}
+
+ArchiveBase::FormatVersions ArchiveBase::getFormatVersion(const QByteArray& ba) {
+    if (ba.size() < SIGNATURE_SIZE) {
+        return FV_INVALID;
+    }
+    if (memcmp(ba.data(), SIGNATURE_V2, SIGNATURE_SIZE) == 0) {
+        return FV_VERSION_2;
+    }
+    return memcmp(ba.data(), SIGNATURE, SIGNATURE_SIZE) == 0 ? FV_VERSION_1 : FV_INVALID;
 }
 
 bool ArchiveBase::isSignatureValid(const QByteArray &ba) {
-    return ba.size() >= SIGNATURE_SIZE && memcmp(ba.data(), SIGNATURE, SIGNATURE_SIZE) == 0;
+    return getFormatVersion(ba) != FV_INVALID;
 }
 
 bool ArchiveBase::isArchive(const QString& filename) {
@@ -24,3 +41,23 @@ bool ArchiveBase::isArchive(const QString& filename) {
     f.close();
     return isSignatureValid(b);
 }
+
+void ArchiveBase::setThreadsCount(int count) {
+    m_workers.setMaxThreadCount(count > 0 ? count : QThread::idealThreadCount());
+}
+
+int ArchiveBase::getThreadsCount() const {
+    return m_workers.maxThreadCount();
+}
+
+uint8_t ArchiveBase::packCompression(CompressionLevels level, CompressionMethods method) {
+    return static_cast<uint8_t>(level | (method << COMPRESSION_METHOD_SHIFT));
+}
+
+ArchiveBase::CompressionLevels ArchiveBase::getCompressionLevel(uint8_t compression) {
+    return static_cast<CompressionLevels>(compression & ((1 << COMPRESSION_METHOD_SHIFT) - 1));
+}
+
+ArchiveBase::CompressionMethods ArchiveBase::getCompressionMethod(uint8_t compression) {
+    return static_cast<CompressionMethods>(compression >> COMPRESSION_METHOD_SHIFT);
+}
@@ -3,10 +3,17 @@
 
 #include <QObject>
 #include <QString>
+#include <QThreadPool>
 #include <cstdint>
 
 #define SIGNATURE_SIZE 10
 #define BYTES_TO_READ  1048576
+#define DEFLATE_WINDOW_SIZE 32768
+#define BLOCK_SIZE     (4 * BYTES_TO_READ)
+#define SOLID_BLOCK_SIZE     BLOCK_SIZE
+#define MAX_SOLID_ENTRY_SIZE 65536
+#define MAX_DICTIONARY_ENTRY_SIZE 65536
+#define COMPRESSION_METHOD_SHIFT 5
 
 class ArchiveBase : public QObject
 {
@@ -18,39 +25,146 @@ public:
         PS_SCANNING_FILESYSTEM,
         PS_COMPRESSING,
         PS_DECOMPRESSING,
-        PS_DECOMPRESSION_ERROR
+        PS_DECOMPRESSION_ERROR,
+        PS_COMPRESSION_ERROR
     };
     Q_ENUMS(ArchiverStates)
 
+    enum PackOption : uint32_t {
+        PO_NONE                 = 0,
+        PO_PARALLEL_DEFLATE     = 1 << 0,   //Large files are deflated by chunks on the worker pool and stitched into the one zlib stream
+        PO_INDEPENDENT_BLOCKS   = 1 << 1,   //File payloads are split into independently compressed blocks of BLOCK_SIZE
+        PO_TRAILING_INDEX       = 1 << 2,   //Archive is written strictly sequentially, the index is located through the footer
+        PO_SOLID_BLOCKS         = 1 << 3,   //Consecutive small files share solid blocks compressed as the one stream
+        PO_STORE_INCOMPRESSIBLE = 1 << 4,   //Files of the already compressed formats or with high entropy are stored as is
+        PO_DEDUPLICATE          = 1 << 5,   //Files with the same content reference the payload of the first of them
+        PO_UPDATE               = 1 << 6,   //Existing archive is rewritten, payloads of the files with the same size and time are copied as is
+        PO_UPDATE_CHECKSUM      = 1 << 7,   //Files are also compared with the existing archive by the checksum while updating
+        PO_DICTIONARY           = 1 << 8,   //Small files are compressed with the preset dictionary trained on them, stored once in the archive
+        PO_ADAPTIVE_LEVEL       = 1 << 9    //Level of every entry is picked up to the requested one to keep up with the target throughput
+    };
+    Q_ENUMS(PackOption)
+    Q_DECLARE_FLAGS(PackOptions, PackOption)
+
     enum EntryTypes : uint8_t {
         ET_DIR,
         ET_FILE
     };
 
+    enum FormatVersions : uint16_t {
+        FV_INVALID = 0,
+        FV_VERSION_1,
+        FV_VERSION_2,
+        FV_CURRENT = FV_VERSION_2
+    };
+
+    enum ExtraTypes : uint16_t {
+        EX_SOLID_MEMBER = 1,
+        EX_DICTIONARY                   //Entry blocks are compressed with the preset dictionary of the archive, the record has no data
+    };
+
+    enum ArchiveFlags : uint32_t {
+        AF_NONE           = 0,
+        AF_STREAM_RECORDS = 1 << 0      //Entries and blocks are preceded by StreamRecord, so the archive could be extracted in a single pass
+    };
+
+    //Records of the streamed archive, readers seeking by the index skip them as the payload offsets point past them
+    enum StreamRecordTypes : uint16_t {
+        SR_ENTRY = 1,                   //Index record of the entry, its blocks follow unless they are shared with an entry restored earlier
+        SR_BLOCK,                       //BlockEntry followed by the payload of the block of the last entry
+        SR_END                          //Index and footer follow
+    };
+
 #pragma pack(push, 1)
+    //Index entry of the v2 archive. Entries of v1 archives are converted into it while reading
     struct ArchEntry {
         uint8_t compression;
         uint8_t entry_type;
         uint64_t file_time;
         uint16_t file_permissions;
         uint32_t checksum;
-        uint32_t compressed_size;
-        uint32_t uncompressed_size;
+        uint64_t compressed_size;
+        uint64_t uncompressed_size;
         uint64_t payload_offset;
+        uint32_t blocks_count;          //Number of BlockEntry records following the file name
         uint16_t filename_length;
+        uint16_t extra_length;          //Size of the optional attributes following the block table, readers skip the unknown ones
+    };
+
+    //Independently compressed part of the entry payload, each one is a complete zlib stream
+    struct BlockEntry {
+        uint64_t offset;
+        uint64_t compressed_size;
+        uint64_t uncompressed_size;
+        uint32_t checksum;
+    };
+
+    //Prefix of every optional attribute of the entry
+    struct ExtraHeader {
+        uint16_t type;
+        uint16_t size;
+    };
+
+    //Entry data is a part of the solid block referenced by the single BlockEntry of the entry
+    struct SolidMember {
+        uint64_t offset;                //Offset of the entry data within the uncompressed solid block
     };
 
 protected:
     std::atomic_bool& getFakeAtomicBool();
 
+    struct ArchEntryV1 {
+        uint8_t compression;
+        uint8_t entry_type;
+        uint64_t file_time;
+        uint16_t file_permissions;
+        uint32_t checksum;
+        uint32_t compressed_size;
+        uint32_t uncompressed_size;
+        uint64_t payload_offset;
+        uint16_t filename_length;
+    };
+
     struct RootArchEntry {
         uint32_t total_entries;
         uint32_t entries_size;
     };
+
+    //Header of v2 archives, follows the signature. Fields could only be appended, header_size tells how many of them are present
+    struct ArchiveHeader {
+        uint16_t header_size;
+        uint16_t version;
+        uint32_t block_size;            //0 if every entry is stored as a single block
+        uint32_t total_entries;
+        uint64_t index_offset;          //Index follows the payloads, 0 if its location is stored in the footer
+        uint64_t index_size;
+        uint8_t checksum_type;          //ChecksumTypes of all the checksums of the archive, Adler-32 if the header has no such field
+        uint64_t dictionary_offset;     //Preset dictionary of the entries marked with EX_DICTIONARY, 0 if there is none
+        uint32_t dictionary_size;
+        uint32_t flags;                 //ArchiveFlags
+    };
+
+    struct StreamRecord {
+        uint16_t type;
+        uint64_t size;                  //Size of the data following the record
+    };
+
+    //Ends the archive written in a single pass, as the index location is unknown when the header is written
+    struct ArchiveFooter {
+        uint64_t index_offset;
+        uint64_t index_size;
+        uint32_t total_entries;
+        uint8_t signature[SIGNATURE_SIZE];
+    };
 #pragma pack(pop)
 
+    //Pool shared by the workers of the packing/depacking jobs
+    QThreadPool m_workers;
+
     static const uint8_t SIGNATURE[SIGNATURE_SIZE];
+    static const uint8_t SIGNATURE_V2[SIGNATURE_SIZE];
 
+    static FormatVersions getFormatVersion(const QByteArray& ba);
     static bool isSignatureValid(const QByteArray& ba);
 
 public:
@@ -72,7 +186,33 @@ public:
         C_BEST_COMPRESSION    = C_LEVEL_9
     };
 
+    //Method is kept in the upper bits of ArchEntry::compression, the level in the lower ones
+    enum CompressionMethods : uint8_t {
+        CM_DEFLATE = 0,
+        CM_STORE,
+        CM_ZSTD,
+        CM_ZSTD_LONG,
+        CM_LZ4
+    };
+    Q_ENUMS(CompressionMethods)
+
+    //Algorithm of the block and entry checksums over the uncompressed data, chosen per archive
+    enum ChecksumTypes : uint8_t {
+        CS_ADLER32 = 0,
+        CS_CRC32C
+    };
+    Q_ENUMS(ChecksumTypes)
+
+    static uint8_t packCompression(CompressionLevels level, CompressionMethods method);
+    static CompressionLevels getCompressionLevel(uint8_t compression);
+    static CompressionMethods getCompressionMethod(uint8_t compression);
+
     static bool isArchive(const QString& filename);
+
+    void setThreadsCount(int count);
+    int getThreadsCount() const;
 };
 
+Q_DECLARE_OPERATORS_FOR_FLAGS(ArchiveBase::PackOptions)
+
 #endif // ARCHIVEBASE_H
@@ -2,17 +2,25 @@
 #include <QScopeGuard>
 #include <QByteArray>
 #include <QMutexLocker>
+#include <cstring>
+#include "checksum.h"
 
-ArchiveReader::FileInfo::FileInfo(const ArchEntry& e, const QString& fileName) :
+ArchiveReader::FileInfo::FileInfo(const ArchEntry& e, const QString& fileName, const QVector<BlockEntry>& blocks, int64_t solidOffset, bool dictionary) :
     m_archEntry(e),
-    m_fileName(fileName)
+    m_fileName(fileName),
+    m_blocks(blocks),
+    m_solidOffset(solidOffset),
+    m_dictionary(dictionary)
 {
 
 }
 
-ArchiveReader::FileInfo::FileInfo(ArchEntry&& e, QString&& fileName) :
+ArchiveReader::FileInfo::FileInfo(ArchEntry&& e, QString&& fileName, QVector<BlockEntry>&& blocks, int64_t solidOffset, bool dictionary) :
     m_archEntry(std::move(e)),
-    m_fileName(std::move(fileName))
+    m_fileName(std::move(fileName)),
+    m_blocks(std::move(blocks)),
+    m_solidOffset(solidOffset),
+    m_dictionary(dictionary)
 {
 
 }
@@ -25,15 +33,31 @@ const QString& ArchiveReader::FileInfo::getFileName() const {
     return m_fileName;
 }
 
+const QVector<ArchiveReader::BlockEntry>& ArchiveReader::FileInfo::getBlocks() const {
+    return m_blocks;
+}
+
+int64_t ArchiveReader::FileInfo::getSolidOffset() const {
+    return m_solidOffset;
+}
+
+bool ArchiveReader::FileInfo::usesDictionary() const {
+    return m_dictionary;
+}
+
 ArchiveReader::FileInfo& ArchiveReader::FileInfo::operator= (const FileInfo& other) {
     m_archEntry = other.m_archEntry;
     m_fileName = other.m_fileName;
+    m_blocks = other.m_blocks;
+    m_solidOffset = other.m_solidOffset;
+    m_dictionary = other.m_dictionary;
     return *this;
 }
 
 ArchiveReader::ArchiveReader(std::atomic_bool& processing, QObject* parent) :
     ArchiveBase(parent),
-    m_processingOperation(processing)
+    m_processingOperation(processing),
+    m_archiveInfo { CS_ADLER32, 0, 0 }
 {
 
 }
@@ -54,49 +78,195 @@ void ArchiveReader::readArchive(const QString& fileName) {
 
     QHash<QString, QVector<FileInfo>> archFilesystem;
 
+    m_metrics.start("read_archive");
+    bool success = false;
     QFile f(fileName);
-    if (!f.open(QIODevice::ReadOnly)) {
-        return;
+    auto guard = qScopeGuard([this, &f, &success]() {
+        f.close();
+        m_metrics.finish(success);
+    });
+
+    QVector<FileInfo> entries;
+    ArchiveInfo archiveInfo;
+    {
+        Metrics::Scope index(m_metrics, Metrics::PH_INDEX, f.size());
+        if (!m_processingOperation || !f.open(QIODevice::ReadOnly) || !readIndex(f, entries, &archiveInfo)) {
+            return;
+        }
+    }
+    //Directories of the archive are built from the flat index
+    Metrics::Scope scan(m_metrics, Metrics::PH_SCAN);
+    for (auto it = entries.begin(); m_processingOperation && it != entries.end(); ++it) {
+        const auto dir { getDirName(it->getFileName()) };
+        auto dirIt = archFilesystem.find(dir);
+        if (dirIt == archFilesystem.end()) {
+            //Insert ".." entry first
+            archFilesystem.insert(dir, { FileInfo( {0, ET_DIR, 0, 0, 0, 0, 0, 0, 0, 0, 0}, ".." ), *it });
+        } else {
+            dirIt.value().append(*it);
+        }
     }
-    auto guard = qScopeGuard([&f]() { f.close(); });
 
-    if (!m_processingOperation || !isSignatureValid(f.read(SIGNATURE_SIZE))) {
-        return;
+    QMutexLocker lock(&m_mutex);
+    m_archFilesystem = archFilesystem;
+    m_archiveInfo = archiveInfo;
+    success = m_processingOperation;
+}
+
+bool ArchiveReader::readHeader(QFile& f, ArchiveHeader& header) {
+    //Header written by the newer version could be longer, so only the known fields are taken
+    memset(&header, 0, sizeof (ArchiveHeader));
+    if (!readData(f, header.header_size) || header.header_size < sizeof (header.header_size)) {
+        return false;
     }
-    RootArchEntry root;
-    auto res = readData(f, root);
-    if (!m_processingOperation || !res) {
-        return;
+    const auto rest { f.read(header.header_size - sizeof (header.header_size)) };
+    if (rest.size() != header.header_size - static_cast<int>(sizeof (header.header_size))) {
+        return false;
     }
+    memcpy(reinterpret_cast<char*>(&header) + sizeof (header.header_size), rest.constData(), qMin<size_t>(rest.size(), sizeof (ArchiveHeader) - sizeof (header.header_size)));
+    return true;
+}
 
-    auto buf = f.read(root.entries_size);
-    if (!m_processingOperation || buf.size() != static_cast<int64_t>(root.entries_size)) {
-        return;
+bool ArchiveReader::locateIndex(QFile& f, FormatVersions& version, ArchiveInfo& info, uint64_t& offset, uint64_t& size) {
+    version = getFormatVersion(f.read(SIGNATURE_SIZE));
+    info = { CS_ADLER32, 0, 0 };
+    if (version == FV_VERSION_1) {
+        //v1 index follows the root entry right away
+        RootArchEntry root;
+        if (!readData(f, root)) {
+            return false;
+        }
+        offset = f.pos();
+        size = root.entries_size;
+    } else if (version == FV_VERSION_2) {
+        ArchiveHeader header;
+        if (!readHeader(f, header) || !Checksum::isSupported(static_cast<ChecksumTypes>(header.checksum_type))) {
+            return false;
+        }
+        info = { static_cast<ChecksumTypes>(header.checksum_type), header.dictionary_offset, header.dictionary_size };
+        if (header.index_offset == 0) {
+            ArchiveFooter footer;
+            if (f.size() < static_cast<int64_t>(sizeof (ArchiveFooter)) || !f.seek(f.size() - sizeof (ArchiveFooter)) || !readData(f, footer) ||
+                    memcmp(footer.signature, SIGNATURE_V2, SIGNATURE_SIZE) != 0) {
+                return false;
+            }
+            header.index_offset = footer.index_offset;
+            header.index_size = footer.index_size;
+            header.total_entries = footer.total_entries;
+        }
+        offset = header.index_offset;
+        size = header.index_size;
+    } else {
+        return false;
     }
+    //Sum of the offset and the size read from the file could wrap around
+    const uint64_t fileSize = f.size();
+    return size <= fileSize && offset <= fileSize - size;
+}
+
+bool ArchiveReader::readIndex(QFile& f, QVector<FileInfo>& entries, ArchiveInfo* info) {
+    FormatVersions version;
+    ArchiveInfo archiveInfo;
+    uint64_t offset = 0;
+    uint64_t size = 0;
+    if (!locateIndex(f, version, archiveInfo, offset, size)) {
+        return false;
+    }
+    if (info) {
+        *info = archiveInfo;
+    }
+    if (size == 0) {
+        return true;
+    }
+    if (uchar* mapped = f.map(offset, size)) {
+        auto guard = qScopeGuard([&f, mapped]() { f.unmap(mapped); });
+        return parseIndex(QByteArray::fromRawData(reinterpret_cast<const char*>(mapped), size), version, entries);
+    }
+    if (!f.seek(offset)) {
+        return false;
+    }
+    const auto buf { f.read(size) };
+    if (buf.size() != static_cast<int64_t>(size)) {
+        return false;
+    }
+    return parseIndex(buf, version, entries);
+}
+
+bool ArchiveReader::parseIndex(const QByteArray& buf, FormatVersions version, QVector<FileInfo>& entries) {
+    const int64_t entrySize = version == FV_VERSION_1 ? sizeof (ArchEntryV1) : sizeof (ArchEntry);
     int64_t pos = 0;
-    while (m_processingOperation && pos < buf.size()) {
-        ArchEntry& entry = *(reinterpret_cast<ArchEntry*>(&pos[buf.data()]));
-        pos += sizeof (ArchEntry);
-        QByteArray name(&pos[buf.data()], entry.filename_length);
-        QString fname { name };
-        const auto dir { getDirName(fname) };
-        auto it = archFilesystem.find(dir);
-        if (it == archFilesystem.end()) {
-            //Insert ".." entry first
-            archFilesystem.insert(dir, { FileInfo( {0, ET_DIR, 0, 0, 0, 0, 0, 0, 0}, ".." ), FileInfo(entry, fname) });
+    while (pos < buf.size()) {
+        if (pos + entrySize > buf.size()) {
+            return false;
+        }
+        ArchEntry entry;
+        if (version == FV_VERSION_1) {
+            const ArchEntryV1& e = *(reinterpret_cast<const ArchEntryV1*>(&pos[buf.constData()]));
+            entry = { e.compression, e.entry_type, e.file_time, e.file_permissions, e.checksum, e.compressed_size, e.uncompressed_size, e.payload_offset,
+                      e.uncompressed_size > 0 ? 1u : 0u, e.filename_length, 0 };
         } else {
-            it.value().append(FileInfo(entry, fname));
+            memcpy(&entry, &pos[buf.constData()], sizeof (ArchEntry));
         }
+        pos += entrySize;
+        if (pos + entry.filename_length > buf.size()) {
+            return false;
+        }
+        QString fileName { QByteArray(&pos[buf.constData()], entry.filename_length) };
         pos += entry.filename_length;
-    }
 
-    QMutexLocker lock(&m_mutex);
-    m_archFilesystem = archFilesystem;
+        QVector<BlockEntry> blocks;
+        int64_t solidOffset = -1;
+        bool dictionary = false;
+        if (version == FV_VERSION_1) {
+            //Payload of the v1 entry is the single zlib stream
+            if (entry.blocks_count > 0) {
+                blocks.append({ entry.payload_offset, entry.compressed_size, entry.uncompressed_size, entry.checksum });
+            }
+        } else {
+            const int64_t blocksSize = static_cast<int64_t>(entry.blocks_count) * sizeof (BlockEntry);
+            if (pos + blocksSize + entry.extra_length > buf.size()) {
+                return false;
+            }
+            blocks.resize(entry.blocks_count);
+            memcpy(blocks.data(), &pos[buf.constData()], blocksSize);
+            pos += blocksSize;
+            for (const int64_t extraEnd = pos + entry.extra_length; pos < extraEnd; ) {
+                ExtraHeader extra;
+                if (pos + static_cast<int64_t>(sizeof (ExtraHeader)) > extraEnd) {
+                    return false;
+                }
+                memcpy(&extra, &pos[buf.constData()], sizeof (ExtraHeader));
+                pos += sizeof (ExtraHeader);
+                if (pos + extra.size > extraEnd) {
+                    return false;
+                }
+                if (extra.type == EX_SOLID_MEMBER && extra.size >= sizeof (SolidMember) && blocks.size() == 1) {
+                    SolidMember member;
+                    memcpy(&member, &pos[buf.constData()], sizeof (SolidMember));
+                    solidOffset = member.offset;
+                } else if (extra.type == EX_DICTIONARY) {
+                    dictionary = true;
+                }
+                pos += extra.size;
+            }
+        }
+        entries.append(FileInfo(std::move(entry), std::move(fileName), std::move(blocks), solidOffset, dictionary));
+    }
+    return true;
 }
 
 const QVector<ArchiveReader::FileInfo>& ArchiveReader::getFileInfoList(const QString& archPath) const {
-    static const QVector<FileInfo> empty { FileInfo( {0, ET_DIR, 0, 0, 0, 0, 0, 0, 0}, ".." ) };
+    static const QVector<FileInfo> empty { FileInfo( {0, ET_DIR, 0, 0, 0, 0, 0, 0, 0, 0, 0}, ".." ) };
     QMutexLocker lock(&m_mutex);
     const auto it = m_archFilesystem.find(archPath);
     return it == m_archFilesystem.end() ? empty : *it;
 }
+
+ArchiveReader::ArchiveInfo ArchiveReader::getArchiveInfo() const {
+    QMutexLocker lock(&m_mutex);
+    return m_archiveInfo;
+}
+
+const Metrics& ArchiveReader::getMetrics() const {
+    return m_metrics;
+}
@@ -2,6 +2,7 @@
 #define ARCHIVEREADER_H
 
 #include "archivebase.h"
+#include "metrics.h"
 #include <QFile>
 #include <QHash>
 #include <QString>
@@ -14,31 +15,50 @@ class ArchiveReader : public ArchiveBase
     QString m_currentFile;
 
 public:
+    //Properties of the whole archive taken from its header
+    struct ArchiveInfo {
+        ChecksumTypes checksumType;
+        uint64_t dictionaryOffset;
+        uint32_t dictionarySize;
+    };
+
     class FileInfo
     {
         ArchEntry m_archEntry;
         QString m_fileName;
+        QVector<BlockEntry> m_blocks;
+        int64_t m_solidOffset;
+        bool m_dictionary;
 
     public:
-        FileInfo(const ArchEntry& e, const QString& fileName);
-        FileInfo(ArchEntry&& e, QString&& fileName);
+        FileInfo(const ArchEntry& e, const QString& fileName, const QVector<BlockEntry>& blocks = QVector<BlockEntry>(), int64_t solidOffset = -1, bool dictionary = false);
+        FileInfo(ArchEntry&& e, QString&& fileName, QVector<BlockEntry>&& blocks = QVector<BlockEntry>(), int64_t solidOffset = -1, bool dictionary = false);
         virtual ~FileInfo() = default;
         FileInfo& operator= (const FileInfo& other);
 
         const ArchEntry& getArchEntry() const;
         const QString& getFileName() const;
+        const QVector<BlockEntry>& getBlocks() const;
+        //Offset of the entry data within its solid block, -1 if the entry has blocks of its own
+        int64_t getSolidOffset() const;
+        //Blocks of the entry are compressed with the preset dictionary of the archive
+        bool usesDictionary() const;
     };
 
 protected:
     std::atomic_bool& m_processingOperation;
     mutable QMutex m_mutex;
     QHash<QString, QVector<FileInfo>> m_archFilesystem;
+    ArchiveInfo m_archiveInfo;
+    Metrics m_metrics;
 
     template<typename T>
-    bool readData(QFile& f, T& t, int64_t size = sizeof (T)) {
+    static bool readData(QFile& f, T& t, int64_t size = sizeof (T)) {
         auto b = f.read(reinterpret_cast<char *>(&t), size);
         return b == size;
     }
+    static bool readHeader(QFile& f, ArchiveHeader& header);
+    static bool locateIndex(QFile& f, FormatVersions& version, ArchiveInfo& info, uint64_t& offset, uint64_t& size);
     QString getDirName(const QString& fileName) const;
 
 public:
@@ -48,7 +68,16 @@ public:
     void cancel();
 
     void readArchive(const QString& fileName);
+    //Reads the signature, the header and the index of either format version, leaves the file position undefined.
+    //Index is parsed in place from the file mapping whenever the file could be mapped.
+    //Archives of the unsupported checksum type are rejected, as their entries couldn't be verified
+    static bool readIndex(QFile& f, QVector<FileInfo>& entries, ArchiveInfo* info = nullptr);
+    //Parses the index block of the archive into the list of entries in the order they are stored
+    static bool parseIndex(const QByteArray& buf, FormatVersions version, QVector<FileInfo>& entries);
     const QVector<FileInfo>& getFileInfoList(const QString& archPath) const;
+    ArchiveInfo getArchiveInfo() const;
+    //Report of the last readArchive call
+    const Metrics& getMetrics() const;
 };
 
 #endif // ARCHIVEREADER_H
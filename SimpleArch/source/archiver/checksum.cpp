@@ -0,0 +1,201 @@
+#include "checksum.h"
+#include <cstring>
+#include "zlib.h"
+#ifdef USE_LIBDEFLATE
+#include "libdeflate.h"
+#endif
+#if defined(__GNUC__) && defined(__x86_64__)
+#include <nmmintrin.h>
+#define CRC32C_HARDWARE_X86
+#elif defined(__GNUC__) && defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+#define CRC32C_HARDWARE_ARM
+#endif
+
+//Castagnoli polynomial, bit-reversed
+#define CRC32C_POLYNOMIAL 0x82f63b78u
+//Length of each of the three streams the hardware CRC is computed by at once
+#define CRC32C_STRIPE_SIZE 8192
+
+namespace {
+    //Multiplies a and b modulo the polynomial, both are bit-reversed as the CRC itself
+    uint32_t multModP(uint32_t a, uint32_t b) {
+        uint32_t m = 1u << 31;
+        uint32_t p = 0;
+        for (;;) {
+            if (a & m) {
+                p ^= b;
+                if ((a & (m - 1)) == 0) {
+                    break;
+                }
+            }
+            m >>= 1;
+            b = b & 1 ? (b >> 1) ^ CRC32C_POLYNOMIAL : b >> 1;
+        }
+        return p;
+    }
+
+    struct Crc32cTables {
+        uint32_t slices[8][256];
+        uint32_t powers[32];            //x^(2^n) modulo the polynomial
+
+        Crc32cTables() {
+            for (uint32_t i = 0; i < 256; ++i) {
+                uint32_t crc = i;
+                for (int bit = 0; bit < 8; ++bit) {
+                    crc = crc & 1 ? (crc >> 1) ^ CRC32C_POLYNOMIAL : crc >> 1;
+                }
+                slices[0][i] = crc;
+            }
+            for (uint32_t i = 0; i < 256; ++i) {
+                for (int s = 1; s < 8; ++s) {
+                    slices[s][i] = (slices[s - 1][i] >> 8) ^ slices[0][slices[s - 1][i] & 0xff];
+                }
+            }
+            uint32_t p = 1u << 30;
+            powers[0] = p;
+            for (int n = 1; n < 32; ++n) {
+                powers[n] = p = multModP(p, p);
+            }
+        }
+    };
+
+    const Crc32cTables& tables() {
+        static const Crc32cTables t;
+        return t;
+    }
+
+    //x^(n * 2^k) modulo the polynomial, CRC register is shifted over n zero bytes by multiplying it with x2nModP(n, 3)
+    uint32_t x2nModP(uint64_t n, unsigned k) {
+        const auto& t = tables();
+        uint32_t p = 1u << 31;
+        while (n) {
+            if (n & 1) {
+                p = multModP(t.powers[k & 31], p);
+            }
+            n >>= 1;
+            ++k;
+        }
+        return p;
+    }
+
+    uint32_t crc32cSoftware(uint32_t crc, const uint8_t* p, size_t n) {
+        const auto& t = tables().slices;
+        crc = ~crc;
+        while (n >= 8) {
+            crc ^= p[0] | p[1] << 8 | p[2] << 16 | static_cast<uint32_t>(p[3]) << 24;
+            crc = t[7][crc & 0xff] ^ t[6][(crc >> 8) & 0xff] ^ t[5][(crc >> 16) & 0xff] ^ t[4][crc >> 24] ^
+                  t[3][p[4]] ^ t[2][p[5]] ^ t[1][p[6]] ^ t[0][p[7]];
+            p += 8;
+            n -= 8;
+        }
+        while (n--) {
+            crc = t[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+        }
+        return ~crc;
+    }
+
+#if defined(CRC32C_HARDWARE_X86) || defined(CRC32C_HARDWARE_ARM)
+#ifdef CRC32C_HARDWARE_X86
+#define CRC32C_TARGET __attribute__((target("sse4.2")))
+    CRC32C_TARGET inline uint32_t crc32cByte(uint32_t crc, uint8_t b) { return _mm_crc32_u8(crc, b); }
+    CRC32C_TARGET inline uint32_t crc32cWord(uint32_t crc, uint64_t w) { return static_cast<uint32_t>(_mm_crc32_u64(crc, w)); }
+#else
+#define CRC32C_TARGET
+    inline uint32_t crc32cByte(uint32_t crc, uint8_t b) { return __crc32cb(crc, b); }
+    inline uint32_t crc32cWord(uint32_t crc, uint64_t w) { return __crc32cd(crc, w); }
+#endif
+
+    CRC32C_TARGET uint32_t crc32cHardware(uint32_t crc, const uint8_t* p, size_t n) {
+        //Three independent streams hide the latency of the crc instruction, then they are merged by shifting over the zeros
+        static const uint32_t shiftOne = x2nModP(CRC32C_STRIPE_SIZE, 3);
+        static const uint32_t shiftTwo = x2nModP(2 * CRC32C_STRIPE_SIZE, 3);
+        uint32_t c0 = ~crc;
+        while (n >= 3 * CRC32C_STRIPE_SIZE) {
+            uint32_t c1 = 0;
+            uint32_t c2 = 0;
+            for (size_t i = 0; i < CRC32C_STRIPE_SIZE; i += 8) {
+                uint64_t w0, w1, w2;
+                memcpy(&w0, p + i, 8);
+                memcpy(&w1, p + CRC32C_STRIPE_SIZE + i, 8);
+                memcpy(&w2, p + 2 * CRC32C_STRIPE_SIZE + i, 8);
+                c0 = crc32cWord(c0, w0);
+                c1 = crc32cWord(c1, w1);
+                c2 = crc32cWord(c2, w2);
+            }
+            c0 = multModP(shiftTwo, c0) ^ multModP(shiftOne, c1) ^ c2;
+            p += 3 * CRC32C_STRIPE_SIZE;
+            n -= 3 * CRC32C_STRIPE_SIZE;
+        }
+        for (; n >= 8; p += 8, n -= 8) {
+            uint64_t w;
+            memcpy(&w, p, 8);
+            c0 = crc32cWord(c0, w);
+        }
+        while (n--) {
+            c0 = crc32cByte(c0, *p++);
+        }
+        return ~c0;
+    }
+#endif
+
+    uint32_t crc32c(uint32_t crc, const uint8_t* p, size_t n) {
+#if defined(CRC32C_HARDWARE_X86)
+        static const bool hardware = __builtin_cpu_supports("sse4.2");
+        return hardware ? crc32cHardware(crc, p, n) : crc32cSoftware(crc, p, n);
+#elif defined(CRC32C_HARDWARE_ARM)
+        return crc32cHardware(crc, p, n);
+#else
+        return crc32cSoftware(crc, p, n);
+#endif
+    }
+}
+
+Checksum::Checksum(ArchiveBase::ChecksumTypes type) :
+    m_type(type),
+    m_value(initial(type))
+{
+
+}
+
+void Checksum::update(const char* data, size_t size) {
+    m_value = update(m_type, m_value, data, size);
+}
+
+uint32_t Checksum::value() const {
+    return m_value;
+}
+
+ArchiveBase::ChecksumTypes Checksum::type() const {
+    return m_type;
+}
+
+bool Checksum::isSupported(ArchiveBase::ChecksumTypes type) {
+    return type == ArchiveBase::CS_ADLER32 || type == ArchiveBase::CS_CRC32C;
+}
+
+uint32_t Checksum::initial(ArchiveBase::ChecksumTypes type) {
+    return type == ArchiveBase::CS_ADLER32 ? 1 : 0;
+}
+
+uint32_t Checksum::update(ArchiveBase::ChecksumTypes type, uint32_t value, const char* data, size_t size) {
+    if (type == ArchiveBase::CS_CRC32C) {
+        return crc32c(value, reinterpret_cast<const uint8_t*>(data), size);
+    }
+#ifdef USE_LIBDEFLATE
+    return libdeflate_adler32(value, data, size);
+#else
+    return adler32_z(value, reinterpret_cast<const Bytef*>(data), size);
+#endif
+}
+
+uint32_t Checksum::compute(ArchiveBase::ChecksumTypes type, const char* data, size_t size) {
+    return update(type, initial(type), data, size);
+}
+
+uint32_t Checksum::combine(ArchiveBase::ChecksumTypes type, uint32_t first, uint32_t second, uint64_t secondSize) {
+    if (type == ArchiveBase::CS_CRC32C) {
+        return multModP(x2nModP(secondSize, 3), first) ^ second;
+    }
+    return adler32_combine64(first, second, secondSize);
+}
@@ -0,0 +1,29 @@
+#ifndef CHECKSUM_H
+#define CHECKSUM_H
+
+#include <cstddef>
+#include "archivebase.h"
+
+//Checksum of the uncompressed data of the algorithm chosen for the archive.
+//Both algorithms could be combined, so the entry checksum is made of the checksums of its blocks
+class Checksum
+{
+    ArchiveBase::ChecksumTypes m_type;
+    uint32_t m_value;
+
+public:
+    explicit Checksum(ArchiveBase::ChecksumTypes type);
+
+    void update(const char* data, size_t size);
+    uint32_t value() const;
+    ArchiveBase::ChecksumTypes type() const;
+
+    static bool isSupported(ArchiveBase::ChecksumTypes type);
+    static uint32_t initial(ArchiveBase::ChecksumTypes type);
+    static uint32_t update(ArchiveBase::ChecksumTypes type, uint32_t value, const char* data, size_t size);
+    static uint32_t compute(ArchiveBase::ChecksumTypes type, const char* data, size_t size);
+    //Checksum of the data made of the first part followed by the second one of secondSize bytes
+    static uint32_t combine(ArchiveBase::ChecksumTypes type, uint32_t first, uint32_t second, uint64_t secondSize);
+};
+
+#endif // CHECKSUM_H
@@ -0,0 +1,74 @@
+#include "codec.h"
+#include "deflatecodec.h"
+#include "zstdcodec.h"
+#include "lz4codec.h"
+#include <QDebug>
+#include <QScopedPointer>
+#include <cstring>
+#define ZDICT_STATIC_LINKING_ONLY
+#include "zdict.h"
+
+//Content of the trained dictionaries, it is more than the deflate window, zstd makes use of all of it
+#define DICTIONARY_SIZE (4 * DEFLATE_WINDOW_SIZE)
+
+const Codec* Codec::get(ArchiveBase::CompressionMethods method) {
+    static const DeflateCodec deflateCodec;
+    static const ZstdCodec zstdCodec(false);
+    static const ZstdCodec zstdLongCodec(true);
+    static const Lz4Codec lz4Codec;
+
+    switch (method) {
+    case ArchiveBase::CM_DEFLATE:
+        return &deflateCodec;
+    case ArchiveBase::CM_ZSTD:
+        return &zstdCodec;
+    case ArchiveBase::CM_ZSTD_LONG:
+        return &zstdLongCodec;
+    case ArchiveBase::CM_LZ4:
+        return &lz4Codec;
+    default:
+        return nullptr;
+    }
+}
+
+bool Codec::decompress(const char* data, size_t size, ArchiveBase::ChecksumTypes checksumType, const Dictionary* dictionary,
+                       char* out, size_t outSize, uint32_t& checksum) const {
+    QScopedPointer<Decoder> decoder(createDecoder(checksumType, dictionary));
+    size_t written = 0;
+    const auto sink = [&](const char* chunk, size_t chunkSize) {
+        if (chunkSize > outSize - written) {
+            return false;
+        }
+        memcpy(out + written, chunk, chunkSize);
+        written += chunkSize;
+        return true;
+    };
+    bool finished = false;
+    if (!decoder->decode(data, size, sink, finished) || !finished || written != outSize) {
+        return false;
+    }
+    checksum = decoder->checksum();
+    return true;
+}
+
+Codec::Dictionary* Codec::createDictionary(const QByteArray& content, ArchiveBase::CompressionLevels level) const {
+    Q_UNUSED(content)
+    Q_UNUSED(level)
+    return nullptr;
+}
+
+QByteArray Codec::trainDictionary(const QByteArray& samples, const QVector<size_t>& sampleSizes) {
+    QByteArray dictionary(DICTIONARY_SIZE, Qt::Initialization::Uninitialized);
+    const auto size = ZDICT_trainFromBuffer(dictionary.data(), dictionary.size(), samples.constData(), sampleSizes.constData(), sampleSizes.size());
+    if (ZDICT_isError(size)) {
+        qDebug() << "ZDICT_trainFromBuffer failed:" << ZDICT_getErrorName(size);
+        return QByteArray();
+    }
+    //Only the content is kept, as every codec takes the raw content dictionaries.
+    //The most valuable segments are at the end of it, which is the part deflate makes use of
+    const auto headerSize = ZDICT_getDictHeaderSize(dictionary.constData(), size);
+    if (ZDICT_isError(headerSize)) {
+        return QByteArray();
+    }
+    return dictionary.mid(headerSize, size - headerSize);
+}
@@ -0,0 +1,74 @@
+#ifndef CODEC_H
+#define CODEC_H
+
+#include <QByteArray>
+#include <QVector>
+#include <functional>
+#include "archivebase.h"
+#include "checksum.h"
+
+//Compression engine of the entry payloads, every block is the complete frame of the codec.
+//Checksum of the block is the one of the archive over the uncompressed data, whatever the codec is
+class Codec
+{
+public:
+    //Receives the produced data, returns false to abort the operation
+    using Sink = std::function<bool(const char* data, size_t size)>;
+
+    class Encoder
+    {
+    protected:
+        Checksum m_checksum;
+
+    public:
+        explicit Encoder(ArchiveBase::ChecksumTypes checksumType) : m_checksum(checksumType) { }
+        virtual ~Encoder() = default;
+
+        //Compresses the next part of the data, the frame is completed by the call with last set
+        virtual bool encode(const char* data, size_t size, bool last, const Sink& sink) = 0;
+        virtual uint32_t checksum() const { return m_checksum.value(); }
+    };
+
+    class Decoder
+    {
+    protected:
+        Checksum m_checksum;
+
+    public:
+        explicit Decoder(ArchiveBase::ChecksumTypes checksumType) : m_checksum(checksumType) { }
+        virtual ~Decoder() = default;
+
+        //Decompresses the next part of the frame, finished is set once the whole frame is decoded
+        virtual bool decode(const char* data, size_t size, const Sink& sink, bool& finished) = 0;
+        virtual uint32_t checksum() const { return m_checksum.value(); }
+    };
+
+    //Preset dictionary of the archive prepared for the codec once, it is shared by all the workers
+    class Dictionary
+    {
+    public:
+        virtual ~Dictionary() = default;
+    };
+
+    virtual ~Codec() = default;
+
+    //Dictionary passed to the encoders and decoders has to be created by the same codec, nullptr if there is none
+    virtual Encoder* createEncoder(ArchiveBase::CompressionLevels level, ArchiveBase::ChecksumTypes checksumType, const Dictionary* dictionary) const = 0;
+    virtual Decoder* createDecoder(ArchiveBase::ChecksumTypes checksumType, const Dictionary* dictionary) const = 0;
+    //Compresses the buffer fitting the memory into the single frame at once
+    virtual bool compress(const char* data, size_t size, ArchiveBase::CompressionLevels level, ArchiveBase::ChecksumTypes checksumType, const Dictionary* dictionary,
+                          QByteArray& out, uint32_t& checksum) const = 0;
+    //Decompresses the whole frame at once into the buffer of exactly the uncompressed size
+    virtual bool decompress(const char* data, size_t size, ArchiveBase::ChecksumTypes checksumType, const Dictionary* dictionary,
+                            char* out, size_t outSize, uint32_t& checksum) const;
+    //Prepares the dictionary content for the codec, nullptr if the codec doesn't support dictionaries. Level matters for the compression only
+    virtual Dictionary* createDictionary(const QByteArray& content, ArchiveBase::CompressionLevels level) const;
+
+    //Builds the dictionary content out of the samples of similar data, it is empty if the samples are not enough for it
+    static QByteArray trainDictionary(const QByteArray& samples, const QVector<size_t>& sampleSizes);
+
+    //Codec of the compression method, nullptr for the store method and the unknown ones
+    static const Codec* get(ArchiveBase::CompressionMethods method);
+};
+
+#endif // CODEC_H
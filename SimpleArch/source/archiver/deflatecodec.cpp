@@ -0,0 +1,459 @@
+#include "deflatecodec.h"
+#include <QDebug>
+#include <QScopeGuard>
+#include "zlib.h"
+#ifdef USE_LIBDEFLATE
+#include "libdeflate.h"
+#endif
+
+//Released streams kept per thread, the older ones are freed
+#define MAX_POOLED_STREAMS 4
+
+namespace {
+#ifdef USE_LIBDEFLATE
+    //Allocation of the compressor is expensive, so every thread keeps one for the last level used
+    class LibdeflateCompressor
+    {
+        libdeflate_compressor* m_compressor;
+        int m_level;
+
+    public:
+        LibdeflateCompressor() :
+            m_compressor(nullptr),
+            m_level(-1)
+        {
+
+        }
+
+        ~LibdeflateCompressor() {
+            libdeflate_free_compressor(m_compressor);
+        }
+
+        libdeflate_compressor* get(int level) {
+            if (level != m_level) {
+                libdeflate_free_compressor(m_compressor);
+                m_compressor = libdeflate_alloc_compressor(level);
+                m_level = m_compressor ? level : -1;
+            }
+            return m_compressor;
+        }
+    };
+
+    class LibdeflateDecompressor
+    {
+        libdeflate_decompressor* m_decompressor;
+
+    public:
+        LibdeflateDecompressor() :
+            m_decompressor(libdeflate_alloc_decompressor())
+        {
+
+        }
+
+        ~LibdeflateDecompressor() {
+            libdeflate_free_decompressor(m_decompressor);
+        }
+
+        libdeflate_decompressor* get() const {
+            return m_decompressor;
+        }
+    };
+#endif
+
+    //Deflate makes use of the window size tail of the dictionary only
+    class DeflateDictionary : public Codec::Dictionary
+    {
+        QByteArray m_content;
+
+    public:
+        explicit DeflateDictionary(const QByteArray& content) :
+            m_content(content.right(DEFLATE_WINDOW_SIZE))
+        {
+
+        }
+
+        const Bytef* data() const {
+            return reinterpret_cast<const Bytef*>(m_content.constData());
+        }
+
+        uInt size() const {
+            return m_content.size();
+        }
+    };
+
+    //Deflate state takes about 256 KB, so the stream is reset for the next frame instead of being set up again.
+    //Buffer of the streamed output is kept along with it
+    class DeflateStream
+    {
+        int m_level;
+        bool m_valid;
+        QByteArray m_buf;
+
+    public:
+        z_stream stream;
+
+        explicit DeflateStream(int level) :
+            m_level(level)
+        {
+            stream.zalloc = Z_NULL;
+            stream.zfree = Z_NULL;
+            stream.opaque = Z_NULL;
+            const auto err = deflateInit(&stream, level);
+            m_valid = err == Z_OK;
+            if (!m_valid) {
+                qDebug() << QString("deflateInit failed: %1").arg(err);
+            }
+        }
+
+        ~DeflateStream() {
+            if (m_valid) {
+                deflateEnd(&stream);
+            }
+        }
+
+        bool isValid() const {
+            return m_valid;
+        }
+
+        int level() const {
+            return m_level;
+        }
+
+        bool reset() {
+            return deflateReset(&stream) == Z_OK;
+        }
+
+        QByteArray& buffer() {
+            if (m_buf.isEmpty()) {
+                m_buf = QByteArray(BYTES_TO_READ, Qt::Initialization::Uninitialized);
+            }
+            return m_buf;
+        }
+    };
+
+    class InflateStream
+    {
+        bool m_valid;
+        QByteArray m_buf;
+
+    public:
+        z_stream stream;
+
+        explicit InflateStream(int level) {
+            Q_UNUSED(level)
+            stream.zalloc = Z_NULL;
+            stream.zfree = Z_NULL;
+            stream.opaque = Z_NULL;
+            stream.next_in = Z_NULL;
+            stream.avail_in = 0;
+            const auto err = inflateInit(&stream);
+            m_valid = err == Z_OK;
+            if (!m_valid) {
+                qDebug() << QString("inflateInit failed: %1").arg(err);
+            }
+        }
+
+        ~InflateStream() {
+            if (m_valid) {
+                inflateEnd(&stream);
+            }
+        }
+
+        bool isValid() const {
+            return m_valid;
+        }
+
+        int level() const {
+            return 0;
+        }
+
+        bool reset() {
+            return inflateReset(&stream) == Z_OK;
+        }
+
+        QByteArray& buffer() {
+            if (m_buf.isEmpty()) {
+                m_buf = QByteArray(BYTES_TO_READ, Qt::Initialization::Uninitialized);
+            }
+            return m_buf;
+        }
+    };
+
+    //Streams released by the encoders and decoders of the thread. The level can't be changed on the reset stream
+    //with every zlib version, so the stream of the same level is looked for
+    template<typename Stream>
+    class StreamPool
+    {
+        QVector<Stream*> m_streams;
+
+    public:
+        ~StreamPool() {
+            qDeleteAll(m_streams);
+        }
+
+        //Stream is ready for the new frame, it has to be checked for being valid
+        Stream* take(int level) {
+            for (int i = m_streams.size() - 1; i >= 0; --i) {
+                if (m_streams.at(i)->level() == level) {
+                    auto* stream = m_streams.takeAt(i);
+                    if (stream->reset()) {
+                        return stream;
+                    }
+                    delete stream;
+                    break;
+                }
+            }
+            return new Stream(level);
+        }
+
+        void give(Stream* stream) {
+            if (!stream->isValid()) {
+                delete stream;
+                return;
+            }
+            if (m_streams.size() >= MAX_POOLED_STREAMS) {
+                delete m_streams.takeFirst();
+            }
+            m_streams.append(stream);
+        }
+    };
+
+    StreamPool<DeflateStream>& deflatePool() {
+        static thread_local StreamPool<DeflateStream> pool;
+        return pool;
+    }
+
+    StreamPool<InflateStream>& inflatePool() {
+        static thread_local StreamPool<InflateStream> pool;
+        return pool;
+    }
+
+    bool setDictionary(z_stream& stream, const Codec::Dictionary* dictionary) {
+        if (!dictionary) {
+            return true;
+        }
+        const auto* d = static_cast<const DeflateDictionary*>(dictionary);
+        return deflateSetDictionary(&stream, d->data(), d->size()) == Z_OK;
+    }
+
+    class DeflateEncoder : public Codec::Encoder
+    {
+        DeflateStream* m_stream;
+        bool m_valid;
+
+    public:
+        DeflateEncoder(int level, ArchiveBase::ChecksumTypes checksumType, const Codec::Dictionary* dictionary) :
+            Encoder(checksumType),
+            m_stream(deflatePool().take(level))
+        {
+            m_valid = m_stream->isValid() && setDictionary(m_stream->stream, dictionary);
+        }
+
+        ~DeflateEncoder() override {
+            deflatePool().give(m_stream);
+        }
+
+        bool encode(const char* data, size_t size, bool last, const Codec::Sink& sink) override {
+            if (!m_valid) {
+                return false;
+            }
+            //Adler-32 is the one of the zlib stream, the other checksums are computed aside
+            if (m_checksum.type() != ArchiveBase::CS_ADLER32) {
+                m_checksum.update(data, size);
+            }
+            auto& stream = m_stream->stream;
+            auto& buf = m_stream->buffer();
+            stream.next_in = reinterpret_cast<z_const Bytef*>(const_cast<char*>(data));
+            stream.avail_in = size;
+            int err;
+            do {
+                stream.next_out = reinterpret_cast<Bytef*>(buf.data());
+                stream.avail_out = buf.size();
+                err = deflate(&stream, last ? Z_FINISH : Z_NO_FLUSH);
+                if (err == Z_STREAM_ERROR || !sink(buf.constData(), buf.size() - stream.avail_out)) {
+                    return false;
+                }
+                //Output buffer filled up means deflate could have more data pending
+            } while (stream.avail_out == 0 || (last && err != Z_STREAM_END));
+            return true;
+        }
+
+        uint32_t checksum() const override {
+            return m_checksum.type() == ArchiveBase::CS_ADLER32 ? m_stream->stream.adler : m_checksum.value();
+        }
+    };
+
+    class DeflateDecoder : public Codec::Decoder
+    {
+        const DeflateDictionary* m_dictionary;
+        InflateStream* m_stream;
+        bool m_valid;
+
+    public:
+        DeflateDecoder(ArchiveBase::ChecksumTypes checksumType, const Codec::Dictionary* dictionary) :
+            Decoder(checksumType),
+            m_dictionary(static_cast<const DeflateDictionary*>(dictionary)),
+            m_stream(inflatePool().take(0)),
+            m_valid(m_stream->isValid())
+        {
+
+        }
+
+        ~DeflateDecoder() override {
+            inflatePool().give(m_stream);
+        }
+
+        bool decode(const char* data, size_t size, const Codec::Sink& sink, bool& finished) override {
+            if (!m_valid) {
+                return false;
+            }
+            auto& stream = m_stream->stream;
+            auto& buf = m_stream->buffer();
+            stream.next_in = reinterpret_cast<z_const Bytef*>(const_cast<char*>(data));
+            stream.avail_in = size;
+            do {
+                //We use Z_NO_FLUSH always, as if we will use Z_FINISH, we have to ensure, that output buffer will be large enough to fit all the decompressed data left
+                stream.next_out = reinterpret_cast<Bytef*>(buf.data());
+                stream.avail_out = buf.size();
+                auto err = inflate(&stream, Z_NO_FLUSH);
+                //Stream compressed with the preset dictionary asks for it right after the header
+                if (err == Z_NEED_DICT) {
+                    if (!m_dictionary || inflateSetDictionary(&stream, m_dictionary->data(), m_dictionary->size()) != Z_OK) {
+                        return false;
+                    }
+                    err = inflate(&stream, Z_NO_FLUSH);
+                }
+                const auto produced = buf.size() - stream.avail_out;
+                if (err != Z_OK && err != Z_STREAM_END && err != Z_BUF_ERROR) {
+                    return false;
+                }
+                if (m_checksum.type() != ArchiveBase::CS_ADLER32) {
+                    m_checksum.update(buf.constData(), produced);
+                }
+                if (!sink(buf.constData(), produced)) {
+                    return false;
+                }
+                if (err == Z_STREAM_END) {
+                    finished = true;
+                    return true;
+                }
+                if (err == Z_BUF_ERROR) {
+                    break;
+                }
+            } while (stream.avail_in > 0 || stream.avail_out == 0);
+            return true;
+        }
+
+        uint32_t checksum() const override {
+            return m_checksum.type() == ArchiveBase::CS_ADLER32 ? m_stream->stream.adler : m_checksum.value();
+        }
+    };
+}
+
+Codec::Encoder* DeflateCodec::createEncoder(ArchiveBase::CompressionLevels level, ArchiveBase::ChecksumTypes checksumType, const Dictionary* dictionary) const {
+    return new DeflateEncoder(level, checksumType, dictionary);
+}
+
+Codec::Decoder* DeflateCodec::createDecoder(ArchiveBase::ChecksumTypes checksumType, const Dictionary* dictionary) const {
+    return new DeflateDecoder(checksumType, dictionary);
+}
+
+Codec::Dictionary* DeflateCodec::createDictionary(const QByteArray& content, ArchiveBase::CompressionLevels level) const {
+    Q_UNUSED(level)
+    return new DeflateDictionary(content);
+}
+
+bool DeflateCodec::compress(const char* data, size_t size, ArchiveBase::CompressionLevels level, ArchiveBase::ChecksumTypes checksumType, const Dictionary* dictionary,
+                            QByteArray& out, uint32_t& checksum) const {
+#ifdef USE_LIBDEFLATE
+    //libdeflate has no preset dictionaries, such buffers go through zlib
+    if (!dictionary) {
+        static thread_local LibdeflateCompressor compressor;
+        auto* c = compressor.get(level);
+        if (!c) {
+            qDebug() << "libdeflate_alloc_compressor failed";
+            return false;
+        }
+        out.resize(libdeflate_zlib_compress_bound(c, size));
+        const auto written = libdeflate_zlib_compress(c, data, size, out.data(), out.size());
+        if (!written) {
+            qDebug() << "libdeflate_zlib_compress failed";
+            return false;
+        }
+        out.resize(written);
+        checksum = Checksum::compute(checksumType, data, size);
+        return true;
+    }
+#endif
+
+    auto& pool = deflatePool();
+    auto* stream = pool.take(level);
+    auto guard = qScopeGuard([&pool, stream]() { pool.give(stream); });
+    if (!stream->isValid() || !setDictionary(stream->stream, dictionary)) {
+        return false;
+    }
+
+    //Whole input fits into the output buffer of deflateBound size, so single Z_FINISH call is enough
+    auto& zlibstream = stream->stream;
+    out.resize(deflateBound(&zlibstream, size));
+    zlibstream.next_in = reinterpret_cast<z_const Bytef*>(const_cast<char*>(data));
+    zlibstream.avail_in = size;
+    zlibstream.next_out = reinterpret_cast<Bytef*>(out.data());
+    zlibstream.avail_out = out.size();
+    const auto err = deflate(&zlibstream, Z_FINISH);
+    out.resize(zlibstream.total_out);
+    checksum = checksumType == ArchiveBase::CS_ADLER32 ? zlibstream.adler : Checksum::compute(checksumType, data, size);
+    if (err != Z_STREAM_END) {
+        qDebug() << QString("deflate failed: %1").arg(err);
+        return false;
+    }
+    return true;
+}
+
+bool DeflateCodec::decompress(const char* data, size_t size, ArchiveBase::ChecksumTypes checksumType, const Dictionary* dictionary,
+                              char* out, size_t outSize, uint32_t& checksum) const {
+#ifdef USE_LIBDEFLATE
+    //libdeflate has no preset dictionaries, such frames go through zlib
+    if (!dictionary) {
+        static thread_local LibdeflateDecompressor decompressor;
+        if (!decompressor.get()) {
+            return false;
+        }
+        //Exact size is known from the index, so the short output is an error as well
+        const auto result = libdeflate_zlib_decompress(decompressor.get(), data, size, out, outSize, nullptr);
+        if (result != LIBDEFLATE_SUCCESS) {
+            qDebug() << QString("libdeflate_zlib_decompress failed: %1").arg(result);
+            return false;
+        }
+        checksum = Checksum::compute(checksumType, out, outSize);
+        return true;
+    }
+#endif
+
+    auto& pool = inflatePool();
+    auto* stream = pool.take(0);
+    auto guard = qScopeGuard([&pool, stream]() { pool.give(stream); });
+    if (!stream->isValid()) {
+        return false;
+    }
+
+    //Output is of the exact size, so the frame is inflated right into it by the single Z_FINISH call
+    auto& zlibstream = stream->stream;
+    zlibstream.next_in = reinterpret_cast<z_const Bytef*>(const_cast<char*>(data));
+    zlibstream.avail_in = size;
+    zlibstream.next_out = reinterpret_cast<Bytef*>(out);
+    zlibstream.avail_out = outSize;
+    auto err = inflate(&zlibstream, Z_FINISH);
+    if (err == Z_NEED_DICT) {
+        const auto* d = static_cast<const DeflateDictionary*>(dictionary);
+        if (!d || inflateSetDictionary(&zlibstream, d->data(), d->size()) != Z_OK) {
+            return false;
+        }
+        err = inflate(&zlibstream, Z_FINISH);
+    }
+    if (err != Z_STREAM_END || zlibstream.avail_out != 0) {
+        return false;
+    }
+    checksum = checksumType == ArchiveBase::CS_ADLER32 ? zlibstream.adler : Checksum::compute(checksumType, out, outSize);
+    return true;
+}
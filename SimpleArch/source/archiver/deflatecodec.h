@@ -0,0 +1,21 @@
+#ifndef DEFLATECODEC_H
+#define DEFLATECODEC_H
+
+#include "codec.h"
+
+//zlib streams, the only codec of the v1 archives.
+//With USE_LIBDEFLATE the whole buffers are handled by libdeflate, streams and the buffers with the preset dictionary stay on zlib,
+//the output format is the same. The zlib streams are kept per thread and reset for the next frame
+class DeflateCodec : public Codec
+{
+public:
+    Encoder* createEncoder(ArchiveBase::CompressionLevels level, ArchiveBase::ChecksumTypes checksumType, const Dictionary* dictionary) const override;
+    Decoder* createDecoder(ArchiveBase::ChecksumTypes checksumType, const Dictionary* dictionary) const override;
+    bool compress(const char* data, size_t size, ArchiveBase::CompressionLevels level, ArchiveBase::ChecksumTypes checksumType, const Dictionary* dictionary,
+                  QByteArray& out, uint32_t& checksum) const override;
+    Dictionary* createDictionary(const QByteArray& content, ArchiveBase::CompressionLevels level) const override;
+    bool decompress(const char* data, size_t size, ArchiveBase::ChecksumTypes checksumType, const Dictionary* dictionary,
+                    char* out, size_t outSize, uint32_t& checksum) const override;
+};
+
+#endif // DEFLATECODEC_H
@@ -1,10 +1,142 @@
 #include "depacker.h"
-#include "source/models/filesystemdirmodel.h"
-#include "zlib.h"
 #include <QScopeGuard>
+#include <QBuffer>
 #include <QDateTime>
 #include <QDir>
 #include <QDebug>
+#include <QSet>
+#include <QtConcurrent>
+#include <cstring>
+#include <limits>
+#include "filebatch.h"
+#include "pipeline.h"
+#ifdef Q_OS_UNIX
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+//Mapped blocks up to this size are decompressed by the single call into the memory
+#define MAX_ONE_SHOT_BLOCK_SIZE BLOCK_SIZE
+//Streamed blocks are at most BLOCK_SIZE before compression, anything much larger is the corrupted stream
+#define MAX_STREAM_BLOCK_SIZE   (2 * BLOCK_SIZE)
+#define MAX_STREAM_RECORD_SIZE  (16 * BYTES_TO_READ)
+
+namespace {
+    //Offsets and sizes come from the archive, so their sum isn't taken as it could wrap around
+    bool fitsIn(uint64_t offset, uint64_t size, uint64_t limit) {
+        return size <= limit && offset <= limit - size;
+    }
+
+    //Names read from the pipe aren't trusted, the entry restored outside of the output directory is rejected
+    bool isSafeName(const QString& name) {
+        const QString path { QString(name).replace('\\', '/') };
+        if (path.isEmpty() || path.startsWith('/') || QDir::isAbsolutePath(path)) {
+            return false;
+        }
+        for (const auto& part: path.split('/')) {
+            if (part == "..") {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    //Hints the kernel to read ahead the mapped range, which is going to be inflated front to back
+    void adviseSequential(const uchar* mapped, uint64_t offset, uint64_t length) {
+#ifdef Q_OS_UNIX
+        static const uint64_t pageSize = sysconf(_SC_PAGESIZE);
+        const uint64_t alignedOffset = offset - offset % pageSize;
+        void* start = const_cast<uchar*>(mapped + alignedOffset);
+        madvise(start, length + offset - alignedOffset, MADV_SEQUENTIAL);
+        madvise(start, length + offset - alignedOffset, MADV_WILLNEED);
+#else
+        Q_UNUSED(mapped)
+        Q_UNUSED(offset)
+        Q_UNUSED(length)
+#endif
+    }
+
+    enum OneShotBuffers {
+        ONE_SHOT_INPUT,
+        ONE_SHOT_OUTPUT,
+        ONE_SHOT_BUFFERS
+    };
+
+    //Buffers of the one-shot blocks are kept per thread and only grow, so restoring the small entries allocates nothing
+    char* threadBuffer(OneShotBuffers index, uint64_t size) {
+        static thread_local QByteArray buffers[ONE_SHOT_BUFFERS];
+        auto& buffer = buffers[index];
+        if (static_cast<uint64_t>(buffer.size()) < size) {
+            buffer.resize(size);
+        }
+        return buffer.data();
+    }
+
+    Metrics::EntryClasses entryClass(const ArchiveReader::FileInfo& entry) {
+        if (ArchiveBase::getCompressionMethod(entry.getArchEntry().compression) == ArchiveBase::CM_STORE) {
+            return Metrics::CL_STORED;
+        }
+        if (entry.getSolidOffset() >= 0) {
+            return Metrics::CL_SOLID;
+        }
+        return entry.getBlocks().size() > 1 ? Metrics::CL_BLOCKS : Metrics::CL_WHOLE_FILE;
+    }
+
+    //Pipes and sockets return the data as it arrives, so the reads are repeated until the whole buffer is filled
+    bool readExactly(QIODevice& in, char* data, int64_t size) {
+        for (int64_t done = 0; done < size; ) {
+            const auto n = in.read(data + done, size - done);
+            if (n < 0) {
+                return false;
+            }
+            if (n == 0) {
+                Tracer::Span wait("wait_input");
+                if (!in.waitForReadyRead(-1)) {
+                    return false;
+                }
+            }
+            done += n;
+        }
+        return true;
+    }
+
+    template<typename T>
+    bool readExactly(QIODevice& in, T& t) {
+        return readExactly(in, reinterpret_cast<char*>(&t), sizeof (T));
+    }
+
+    //Reads the device till its end keeping only the last tail size bytes, returns the bytes read or -1 if the read failed
+    int64_t readToEnd(QIODevice& in, QByteArray& tail, int tailSize) {
+        QByteArray chunk(BYTES_TO_READ, Qt::Initialization::Uninitialized);
+        int64_t done = 0;
+        tail.clear();
+        while (true) {
+            const auto n = in.read(chunk.data(), chunk.size());
+            if (n < 0) {
+                return -1;
+            }
+            if (n == 0) {
+                Tracer::Span wait("wait_input");
+                if (!in.waitForReadyRead(-1)) {
+                    return done;
+                }
+                continue;
+            }
+            done += n;
+            tail.append(chunk.constData(), n);
+            if (tail.size() > tailSize) {
+                tail.remove(0, tail.size() - tailSize);
+            }
+        }
+    }
+
+    //Discards the data written into it, tested blocks are only checked against their checksums
+    class NullDevice : public QIODevice {
+    protected:
+        qint64 readData(char*, qint64) override { return -1; }
+        qint64 writeData(const char*, qint64 len) override { return len; }
+    };
+}
 
 Depacker::Depacker(std::atomic_bool& cancel, QObject* parent) :
     ArchiveBase(parent),
@@ -17,6 +149,14 @@ void Depacker::cancel() {
     m_cancelOperation = true;
 }
 
+const Progress& Depacker::getProgress() const {
+    return m_progress;
+}
+
+const Metrics& Depacker::getMetrics() const {
+    return m_metrics;
+}
+
 //Result is an overall entries count for root entry
 uint32_t Depacker::prepareEntries(const QSharedPointer<ArchiveReader>& archiveReader, const QVector<ArchiveReader::FileInfo>& entries, QVector<ArchiveReader::FileInfo>& result) {
     uint32_t overall_count = 0;
@@ -24,36 +164,198 @@ uint32_t Depacker::prepareEntries(const QSharedPointer<ArchiveReader>& archiveRe
         if (m_cancelOperation) {
             break;
         }
+        //".." entry heading every listing is made up by the reader, it is neither extracted nor followed
+        if (entry.getFileName() == "..") {
+            continue;
+        }
         const QString entryFileName { entry.getFileName().mid(entry.getFileName().lastIndexOf('/') + 1) };
         result.append(entry);
         ++overall_count;
-        emit scanningFilesystem(entryFileName);
+        m_progress.entryScanned();
         if (entry.getArchEntry().entry_type == ET_DIR) {
+            m_progress.setScanning(entryFileName);
             overall_count += prepareEntries(archiveReader, archiveReader->getFileInfoList(entry.getFileName()), result);
         }
     }
     return overall_count;
 }
 
-bool Depacker::decompressFile(QFile& f, const ArchiveReader::FileInfo& entry, const QString& outPath) {
-    const auto& name = entry.getFileName();
-    emit fileProgress(name, 0, 0);
-    QString dirName = name;
-    bool exit = true;
-    if (entry.getArchEntry().entry_type != ET_DIR) {
-        const auto idx = name.lastIndexOf('/');
-        dirName = idx < 1 ? QString() : name.left(idx);
-        exit = false;
+bool Depacker::loadDictionaries(QFile& f, const ArchiveReader::ArchiveInfo& info, const QVector<ArchiveReader::FileInfo>& entries, Dictionaries& dictionaries) {
+    QSet<int> methods;
+    for (const auto& entry: entries) {
+        if (entry.usesDictionary()) {
+            methods.insert(getCompressionMethod(entry.getArchEntry().compression));
+        }
     }
-    if (!dirName.isEmpty()) {
-        QDir d;
-        d.mkpath(outPath + dirName);
+    if (methods.isEmpty()) {
+        return true;
+    }
+    if (info.dictionarySize == 0 || !f.seek(info.dictionaryOffset)) {
+        return false;
+    }
+    const auto content { f.read(info.dictionarySize) };
+    if (content.size() != static_cast<int>(info.dictionarySize)) {
+        return false;
+    }
+    for (const auto method: methods) {
+        if (!prepareDictionary(content, method, dictionaries)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool Depacker::prepareDictionary(const QByteArray& content, int method, Dictionaries& dictionaries) {
+    const auto* codec = Codec::get(static_cast<CompressionMethods>(method));
+    auto* dictionary = codec ? codec->createDictionary(content, C_NO_COMPRESSION) : nullptr;
+    if (!dictionary) {
+        return false;
+    }
+    dictionaries.insert(method, QSharedPointer<Codec::Dictionary>(dictionary));
+    return true;
+}
+
+bool Depacker::decodeBlock(ArchiveSource& source, const Codec* codec, const Codec::Dictionary* dictionary, const BlockEntry& block, QIODevice& o, int slot) {
+    if (source.mapped) {
+        if (!fitsIn(block.offset, block.compressed_size, source.mappedSize)) {
+            return false;
+        }
+        adviseSequential(source.mapped, block.offset, block.compressed_size);
+    } else if (!source.file.seek(block.offset)) {
+        return false;
     }
 
-    if (exit) {
+    //Small block is read at once unless it is mapped, then decompressed by the single call into the buffer of the thread
+    if (block.uncompressed_size <= MAX_ONE_SHOT_BLOCK_SIZE && (source.mapped || block.compressed_size <= MAX_STREAM_BLOCK_SIZE)) {
+        const char* data = reinterpret_cast<const char*>(source.mapped + block.offset);
+        if (!source.mapped) {
+            Metrics::Scope read(m_metrics, Metrics::PH_READ, block.compressed_size);
+            char* input = threadBuffer(ONE_SHOT_INPUT, block.compressed_size);
+            if (source.file.read(input, block.compressed_size) != static_cast<int64_t>(block.compressed_size)) {
+                return false;
+            }
+            data = input;
+        }
+        char* buf = threadBuffer(ONE_SHOT_OUTPUT, block.uncompressed_size);
+        uint32_t checksum;
+        {
+            Metrics::Scope decompress(m_metrics, Metrics::PH_DECOMPRESS, block.compressed_size);
+            if (!codec->decompress(data, block.compressed_size, source.checksumType, dictionary, buf, block.uncompressed_size, checksum) ||
+                    checksum != block.checksum) {
+                return false;
+            }
+        }
+        Metrics::Scope write(m_metrics, Metrics::PH_WRITE, block.uncompressed_size);
+        if (o.write(buf, block.uncompressed_size) != static_cast<int64_t>(block.uncompressed_size)) {
+            return false;
+        }
+        m_progress.advance(slot, block.uncompressed_size);
         return true;
     }
 
+    QScopedPointer<Codec::Decoder> decoder(codec->createDecoder(source.checksumType, dictionary));
+    //Large block is read ahead and written behind, so the storage and the codec work at the same time
+    const bool pipelined = block.uncompressed_size >= MIN_PIPELINED_SIZE;
+    WriteBehind writer(o, BYTES_TO_READ, pipelined, m_metrics);
+    const auto sink = [&](const char* data, size_t size) {
+        if (!writer.write(data, size)) {
+            return false;
+        }
+        m_progress.advance(slot, size);
+        return true;
+    };
+
+    //Mapped data is decoded in place, otherwise it is read chunk by chunk
+    QScopedPointer<ReadAhead> reader(source.mapped ? nullptr : new ReadAhead(source.file, block.compressed_size, BYTES_TO_READ, pipelined, m_metrics));
+    PipelineChunk chunk { QByteArray(), 0, false };
+    bool finished = false;
+    for (uint64_t bytesRead = 0; !finished && bytesRead < block.compressed_size; ) {
+        if (m_cancelOperation) {
+            return false;
+        }
+        int64_t length = qMin((uint64_t) BYTES_TO_READ, block.compressed_size - bytesRead);
+        const char* data = reinterpret_cast<const char*>(source.mapped + block.offset + bytesRead);
+        if (reader) {
+            if (!reader->next(chunk) || chunk.size <= 0) {
+                return false;
+            }
+            data = chunk.data.constData();
+            length = chunk.size;
+        }
+        bytesRead += length;
+        {
+            Metrics::Scope decompress(m_metrics, Metrics::PH_DECOMPRESS, length);
+            if (!decoder->decode(data, length, sink, finished)) {
+                return false;
+            }
+        }
+        if (reader) {
+            reader->recycle(chunk);
+        }
+    }
+
+    return finished && writer.finish() && block.checksum == decoder->checksum();
+}
+
+bool Depacker::copyBlock(ArchiveSource& source, const BlockEntry& block, QIODevice& o, int slot) {
+    //Stored block is written right from the mapping, only the unmapped archive is read into the buffers
+    if (source.mapped) {
+        if (!fitsIn(block.offset, block.uncompressed_size, source.mappedSize)) {
+            return false;
+        }
+        adviseSequential(source.mapped, block.offset, block.uncompressed_size);
+    } else if (!source.file.seek(block.offset)) {
+        return false;
+    }
+
+    const bool pipelined = block.uncompressed_size >= MIN_PIPELINED_SIZE;
+    QScopedPointer<ReadAhead> reader(source.mapped ? nullptr : new ReadAhead(source.file, block.uncompressed_size, BYTES_TO_READ, pipelined, m_metrics));
+    WriteBehind writer(o, BYTES_TO_READ, pipelined, m_metrics);
+    PipelineChunk chunk { QByteArray(), 0, false };
+    Checksum checksum(source.checksumType);
+    for (uint64_t bytesDone = 0; bytesDone < block.uncompressed_size; ) {
+        if (m_cancelOperation) {
+            return false;
+        }
+        int64_t length = qMin((uint64_t) BYTES_TO_READ, block.uncompressed_size - bytesDone);
+        const char* data = reinterpret_cast<const char*>(source.mapped + block.offset + bytesDone);
+        if (reader) {
+            if (!reader->next(chunk) || chunk.size <= 0) {
+                return false;
+            }
+            data = chunk.data.constData();
+            length = chunk.size;
+        }
+        checksum.update(data, length);
+        if (!writer.write(data, length)) {
+            return false;
+        }
+        bytesDone += length;
+        m_progress.advance(slot, length);
+        if (reader) {
+            reader->recycle(chunk);
+        }
+    }
+    return writer.finish() && block.checksum == checksum.value();
+}
+
+bool Depacker::restoreBlock(ArchiveSource& source, const ArchiveReader::FileInfo& entry, const BlockEntry& block, QIODevice& o, int slot) {
+    const auto method = getCompressionMethod(entry.getArchEntry().compression);
+    bool result = false;
+    if (method == CM_STORE) {
+        result = copyBlock(source, block, o, slot);
+    } else {
+        const auto* codec = Codec::get(method);
+        const auto* dictionary = entry.usesDictionary() ? source.dictionaries.value(method).data() : nullptr;
+        result = codec && (!entry.usesDictionary() || dictionary) && decodeBlock(source, codec, dictionary, block, o, slot);
+    }
+    if (result && slot >= 0) {
+        m_progress.addBytes(block.compressed_size, block.uncompressed_size);
+    }
+    return result;
+}
+
+bool Depacker::decompressFile(ArchiveSource& source, const ArchiveReader::FileInfo& entry, const QString& outPath, int slot) {
     QFile o(outPath + entry.getFileName());
     if (!o.open(QIODevice::WriteOnly)) {
         return false;
@@ -61,65 +363,288 @@ bool Depacker::decompressFile(QFile& f, const ArchiveReader::FileInfo& entry, co
 
     const auto& archEntry = entry.getArchEntry();
     auto guard = qScopeGuard([&o, &archEntry]() {
-        o.setPermissions(static_cast<QFileDevice::Permissions>(archEntry.file_permissions));
-        o.setFileTime(QDateTime::fromSecsSinceEpoch(archEntry.file_time), QFileDevice::FileBirthTime);
         o.close();
+        restoreAttributes(o, archEntry);
     });
-    if (archEntry.uncompressed_size == 0) {
-        return true;
+
+    for (const auto& block: entry.getBlocks()) {
+        if (!restoreBlock(source, entry, block, o, slot)) {
+            return false;
+        }
     }
+    return true;
+}
 
-    QByteArray fileBuf;
-    QByteArray depackBuf(BYTES_TO_READ, Qt::Initialization::Uninitialized);
+bool Depacker::decompressSolid(ArchiveSource& source, const QVector<ArchiveReader::FileInfo>& entries, const QVector<int>& members, const QString& outPath, int slot) {
+    //Solid block is inflated once, then split between its members. It is shown as its first member while it is inflated
+    QByteArray data;
+    QBuffer b(&data);
+    b.open(QIODevice::WriteOnly);
+    const auto& firstMember = entries.at(members.first());
+    m_progress.setEntry(slot, members.first(), 0, firstMember.getBlocks().first().uncompressed_size);
+    if (!restoreBlock(source, firstMember, firstMember.getBlocks().first(), b, slot)) {
+        return false;
+    }
 
-    f.seek(archEntry.payload_offset);
-    fileBuf = f.read(qMin((uint32_t) BYTES_TO_READ, archEntry.compressed_size));
-    uLong inBufLen = fileBuf.size();
-    uLong depackBufLen = depackBuf.size();
+    bool result = true;
+    uint64_t bytes = 0;
+    QVector<FileBatch::WriteFile> files;
+    QVector<int> written;
+    for (const auto i: members) {
+        const auto& entry = entries.at(i);
+        const auto& archEntry = entry.getArchEntry();
+        const uint64_t offset = entry.getSolidOffset();
+        const uint64_t size = archEntry.uncompressed_size;
+        if (!fitsIn(offset, size, data.size()) ||
+                Checksum::compute(source.checksumType, data.constData() + offset, size) != archEntry.checksum) {
+            result = false;
+            continue;
+        }
+        files.append({ QFile::encodeName(outPath + entry.getFileName()), data.constData() + offset, static_cast<int64_t>(size), static_cast<int64_t>(archEntry.file_time), archEntry.file_permissions, false });
+        written.append(i);
+        bytes += size;
+    }
 
-    z_stream zlibstream;
-    zlibstream.zalloc = Z_NULL;
-    zlibstream.zfree = Z_NULL;
-    zlibstream.opaque = Z_NULL;
+    //Small members are created, written and closed in batches where io_uring is there, one by one otherwise
+    Metrics::Scope write(m_metrics, Metrics::PH_WRITE, bytes);
+    if (FileBatch::write(files)) {
+        for (const auto& file: qAsConst(files)) {
+            result = result && file.ok;
+        }
+        m_progress.advance(slot, bytes);
+        return result;
+    }
+    for (int i = 0; i < files.size(); ++i) {
+        const auto& file = files.at(i);
+        QFile o(QFile::decodeName(file.path));
+        m_progress.setEntry(slot, written.at(i), 0, file.size);
+        if (!o.open(QIODevice::WriteOnly) || o.write(file.data, file.size) != file.size) {
+            result = false;
+        }
+        o.close();
+        restoreAttributes(o, entries.at(written.at(i)).getArchEntry());
+        m_progress.advance(slot, file.size);
+    }
+    return result;
+}
 
-    zlibstream.next_in = reinterpret_cast<z_const Bytef*>(fileBuf.data());
-    zlibstream.avail_in = inBufLen;
-    zlibstream.next_out = reinterpret_cast<Bytef*>(depackBuf.data());
-    zlibstream.avail_out = depackBufLen;
-    auto err = inflateInit(&zlibstream);
-    if (err != Z_OK) {
-        qDebug() << QString("deflateInit failed: %1").arg(err);
-        return false;
+void Depacker::restoreAttributes(QFile& o, const ArchEntry& archEntry) {
+    //File time could be set on the opened file only, so it goes before the permissions possibly making the file unreadable
+    if (o.open(QIODevice::ReadOnly)) {
+        o.setFileTime(QDateTime::fromSecsSinceEpoch(archEntry.file_time), QFileDevice::FileModificationTime);
+        o.close();
     }
+    o.setPermissions(static_cast<QFileDevice::Permissions>(archEntry.file_permissions));
+}
 
-    auto inflateGuard = qScopeGuard([&zlibstream]() { inflateEnd(&zlibstream); });
-    uint64_t bytesRead = inBufLen;
-    do {
-        if (m_cancelOperation) {
+bool Depacker::readRange(QFile& f, const ArchiveReader::ArchiveInfo& info, const ArchiveReader::FileInfo& entry, uint64_t offset, uint64_t length, QByteArray& out) {
+    //Only the blocks overlapping the range are inflated
+    out.clear();
+    Dictionaries dictionaries;
+    if (!loadDictionaries(f, info, { entry }, dictionaries)) {
+        return false;
+    }
+    ArchiveSource source { f, nullptr, 0, info.checksumType, dictionaries };
+    if (entry.getSolidOffset() >= 0) {
+        //Data of the solid block member starts somewhere inside the only block
+        QByteArray data;
+        QBuffer b(&data);
+        b.open(QIODevice::WriteOnly);
+        if (entry.getBlocks().isEmpty() || !restoreBlock(source, entry, entry.getBlocks().first(), b, -1)) {
             return false;
         }
-        //We use Z_NO_FLUSH always, as if we will use Z_FINISH, we have to ensure, that output buffer will be large enough to fit all the decompressed data left
-        err = inflate(&zlibstream, Z_NO_FLUSH);
-        if (err == Z_OK || err == Z_STREAM_END) {
-            //One of the buffers run out, storing decompressed data
-            auto decompressedSize = depackBufLen - zlibstream.avail_out;
-            o.write(depackBuf.data(), decompressedSize);
+        const uint64_t size = entry.getArchEntry().uncompressed_size;
+        if (offset < size) {
+            out = data.mid(entry.getSolidOffset() + offset, qMin(length, size - offset));
+        }
+        return true;
+    }
+    //Range running past the end of the entry is cut at the end
+    const uint64_t end = offset + qMin(length, std::numeric_limits<uint64_t>::max() - offset);
+    uint64_t blockStart = 0;
+    for (const auto& block: entry.getBlocks()) {
+        const uint64_t blockEnd = blockStart + block.uncompressed_size;
+        if (blockStart >= end) {
+            break;
+        }
+        if (blockEnd > offset) {
+            QByteArray data;
+            QBuffer b(&data);
+            b.open(QIODevice::WriteOnly);
+            if (!restoreBlock(source, entry, block, b, -1)) {
+                return false;
+            }
+            const uint64_t from = offset > blockStart ? offset - blockStart : 0;
+            out.append(data.mid(from, qMin(blockEnd, end) - blockStart - from));
+        }
+        blockStart = blockEnd;
+    }
+    return true;
+}
+
+bool Depacker::extractEntries(const QString& file, const ArchiveReader::ArchiveInfo& info, const QVector<ArchiveReader::FileInfo>& entries, const QString& outPath) {
+    const uint32_t numEntries = entries.size();
+    const int threads = getThreadsCount();
+    QStringList names;
+    uint64_t totalBytes = 0;
+    names.reserve(entries.size());
+    for (const auto& entry: entries) {
+        names.append(entry.getFileName());
+        totalBytes += entry.getArchEntry().uncompressed_size;
+    }
+    m_progress.start(names, numEntries, totalBytes);
+    auto progressGuard = qScopeGuard([this]() { m_progress.finish(); });
+
+    //Directories are created up front, so the workers only have to restore the files
+    QSet<QString> dirs;
+    QVector<ExtractJob> jobs;
+    QVector<int> splitEntries;
+    QVector<QVector<int>> solidGroups;
+    QHash<uint64_t, int> solidJobs;
+    uint32_t fileEntries = 0;
+    for (int i = 0; i < entries.size(); ++i) {
+        const auto& entry = entries.at(i);
+        const auto& name = entry.getFileName();
+        if (entry.getArchEntry().entry_type == ET_DIR) {
+            dirs.insert(name);
+            continue;
+        }
+        const auto idx = name.lastIndexOf('/');
+        if (idx > 0) {
+            dirs.insert(name.left(idx));
+        }
+        ++fileEntries;
+        if (entry.getSolidOffset() >= 0 && !entry.getBlocks().isEmpty()) {
+            //Members are grouped by the solid block they share
+            const auto blockOffset = entry.getBlocks().first().offset;
+            auto it = solidJobs.find(blockOffset);
+            if (it == solidJobs.end()) {
+                it = solidJobs.insert(blockOffset, solidGroups.size());
+                jobs.append({ i, -1, 0, solidGroups.size() });
+                solidGroups.append(QVector<int>());
+            }
+            solidGroups[it.value()].append(i);
+        } else if (threads > 1 && entry.getBlocks().size() > 1) {
+            //Entry made of several blocks is inflated on all the workers, each one writes its own part of the file
+            uint64_t outOffset = 0;
+            for (int b = 0; b < entry.getBlocks().size(); ++b) {
+                jobs.append({ i, b, outOffset, -1 });
+                outOffset += entry.getBlocks().at(b).uncompressed_size;
+            }
+            splitEntries.append(i);
+        } else {
+            jobs.append({ i, -1, 0, -1 });
+        }
+    }
+    {
+        Metrics::Scope write(m_metrics, Metrics::PH_WRITE);
+        QDir d;
+        for (const auto& dir: dirs) {
+            d.mkpath(outPath + dir);
+        }
+        for (const auto i: qAsConst(splitEntries)) {
+            QFile o(outPath + entries.at(i).getFileName());
+            if (!o.open(QIODevice::WriteOnly) || !o.resize(entries.at(i).getArchEntry().uncompressed_size)) {
+                return false;
+            }
+        }
+    }
 
-            bool needRead = err == Z_OK;
-            zlibstream.next_out = reinterpret_cast<Bytef*>(depackBuf.data());
-            zlibstream.avail_out = depackBufLen;
-            if (needRead && zlibstream.avail_in == 0 && bytesRead < archEntry.compressed_size) {
-                fileBuf = f.read(qMin((uint64_t) BYTES_TO_READ, archEntry.compressed_size - bytesRead));
-                inBufLen = fileBuf.size();
-                zlibstream.next_in = reinterpret_cast<z_const Bytef*>(fileBuf.data());
-                zlibstream.avail_in = inBufLen;
-                bytesRead += inBufLen;
+    std::vector<std::atomic_int> blocksLeft(entries.size());
+    for (const auto& job: qAsConst(jobs)) {
+        if (job.solidGroup >= 0) {
+            for (const auto member: solidGroups.at(job.solidGroup)) {
+                ++blocksLeft[member];
             }
-            emit fileProgress(entry.getFileName(), bytesRead, archEntry.uncompressed_size);
+        } else {
+            ++blocksLeft[job.entry];
         }
-    } while (err == Z_OK);
+    }
+    std::atomic_int nextJob { 0 };
+    std::atomic_int nextSlot { 0 };
+    std::atomic_bool success { true };
+    m_progress.entryDone(numEntries - fileEntries);
 
-    return archEntry.checksum == zlibstream.adler;
+    //The archive mapping is shared by all the workers, it is unavailable for the archives not fitting the address space
+    QFile archive(file);
+    Dictionaries dictionaries;
+    {
+        Metrics::Scope index(m_metrics, Metrics::PH_INDEX);
+        if (!archive.open(QIODevice::ReadOnly) || !loadDictionaries(archive, info, entries, dictionaries)) {
+            return false;
+        }
+    }
+    const uchar* mapped = archive.map(0, archive.size());
+    auto archiveGuard = qScopeGuard([&archive, mapped]() {
+        if (mapped) {
+            archive.unmap(const_cast<uchar*>(mapped));
+        }
+        archive.close();
+    });
+    //Otherwise every worker uses its own archive handle, so the seeks don't interfere
+    auto worker = [&]() {
+        const int slot = nextSlot++;
+        QFile f(file);
+        if (!mapped && !f.open(QIODevice::ReadOnly)) {
+            success = false;
+            return;
+        }
+        ArchiveSource source { f, mapped, static_cast<uint64_t>(archive.size()), info.checksumType, dictionaries };
+        for (int i = nextJob++; i < jobs.size() && !m_cancelOperation; i = nextJob++) {
+            const auto& job = jobs.at(i);
+            const auto& entry = entries.at(job.entry);
+            const int64_t busySince = Metrics::wallTime();
+            bool result = false;
+            if (job.solidGroup >= 0) {
+                result = decompressSolid(source, entries, solidGroups.at(job.solidGroup), outPath, slot);
+            } else if (job.block < 0) {
+                m_progress.setEntry(slot, job.entry, 0, entry.getArchEntry().uncompressed_size);
+                result = decompressFile(source, entry, outPath, slot);
+            } else {
+                QFile o(outPath + entry.getFileName());
+                m_progress.setEntry(slot, job.entry, job.outOffset, entry.getArchEntry().uncompressed_size);
+                result = o.open(QIODevice::ReadWrite) && o.seek(job.outOffset) &&
+                         restoreBlock(source, entry, entry.getBlocks().at(job.block), o, slot);
+            }
+            if (!result) {
+                success = false;
+            }
+            for (const auto e: job.solidGroup >= 0 ? solidGroups.at(job.solidGroup) : QVector<int> { job.entry }) {
+                if (--blocksLeft[e] == 0) {
+                    qDebug() << "Decompressing" << entries.at(e).getFileName() << result;
+                    m_progress.entryDone();
+                    //Solid block is counted by the first of its members
+                    const auto& archEntry = entries.at(e).getArchEntry();
+                    const bool firstMember = job.solidGroup >= 0 && e == solidGroups.at(job.solidGroup).first();
+                    m_metrics.addEntry(entryClass(entries.at(e)), archEntry.uncompressed_size,
+                                       firstMember ? entries.at(e).getBlocks().first().compressed_size : archEntry.compressed_size);
+                }
+            }
+            m_metrics.addBusy(slot, Metrics::wallTime() - busySince);
+        }
+        m_progress.clearEntry(slot);
+        f.close();
+    };
+
+    //The depacker thread is one of the workers itself
+    const int workers = qMin(threads, jobs.size());
+    QVector<QFuture<void>> futures;
+    for (int i = 1; i < workers; ++i) {
+        futures.append(QtConcurrent::run(&m_workers, worker));
+    }
+    worker();
+    {
+        Tracer::Span wait("wait_workers");
+        for (auto& future: futures) {
+            future.waitForFinished();
+        }
+    }
+
+    for (const auto i: qAsConst(splitEntries)) {
+        QFile o(outPath + entries.at(i).getFileName());
+        restoreAttributes(o, entries.at(i).getArchEntry());
+    }
+    return success && !m_cancelOperation;
 }
 
 void Depacker::depackFile(QString depackDir, QString file) {
@@ -131,9 +656,11 @@ void Depacker::depackFile(QString depackDir, QString file) {
         depackDir += '/';
     }
 
+    m_metrics.start("depack");
     bool decompressionError = true;
     auto guard = qScopeGuard([&f, &decompressionError, this]() {
         f.close();
+        m_metrics.finish(!decompressionError);
         if (decompressionError) {
             emit depackerStateChanged(ArchiverStates::PS_DECOMPRESSION_ERROR);
         } else {
@@ -145,75 +672,337 @@ void Depacker::depackFile(QString depackDir, QString file) {
         return;
     }
     emit depackerStateChanged(ArchiverStates::PS_DECOMPRESSING);
-    RootArchEntry rootEntry;
-    if (f.read(reinterpret_cast<char *>(&rootEntry), sizeof (RootArchEntry)) != sizeof (RootArchEntry)) {
-        return;
+    //The whole index is known before any payload is read
+    QVector<ArchiveReader::FileInfo> entries;
+    ArchiveReader::ArchiveInfo info;
+    {
+        Metrics::Scope index(m_metrics, Metrics::PH_INDEX);
+        if (!f.seek(0) || !ArchiveReader::readIndex(f, entries, &info)) {
+            return;
+        }
     }
-    auto pos = f.pos();
-    for (auto count = rootEntry.total_entries; count > 0; --count) {
-        if (m_cancelOperation) {
-            break;
+    decompressionError = !extractEntries(file, info, entries, depackDir);
+}
+
+bool Depacker::testArchive(const QString& file) {
+    QFile f(file);
+    QVector<ArchiveReader::FileInfo> entries;
+    ArchiveReader::ArchiveInfo info;
+    Dictionaries dictionaries;
+    m_metrics.start("test");
+    bool opened = false;
+    {
+        Metrics::Scope index(m_metrics, Metrics::PH_INDEX);
+        opened = f.open(QIODevice::ReadOnly) && ArchiveReader::readIndex(f, entries, &info) && loadDictionaries(f, info, entries, dictionaries);
+    }
+    if (!opened) {
+        m_metrics.finish(false);
+        return false;
+    }
+    const uchar* mapped = f.map(0, f.size());
+    auto guard = qScopeGuard([&f, mapped]() {
+        if (mapped) {
+            f.unmap(const_cast<uchar*>(mapped));
         }
+        f.close();
+    });
+    ArchiveSource source { f, mapped, static_cast<uint64_t>(f.size()), info.checksumType, dictionaries };
+    NullDevice null;
+    null.open(QIODevice::WriteOnly);
 
-        f.seek(pos);
-        ArchEntry entry;
-        if (f.read(reinterpret_cast<char *>(&entry), sizeof (ArchEntry)) != sizeof (ArchEntry)) {
-            return;
+    //Blocks shared by the duplicates are checked once, solid blocks are kept to check their members
+    QSet<uint64_t> testedBlocks;
+    QHash<uint64_t, QByteArray> solidBlocks;
+    bool result = true;
+    const uint32_t numEntries = entries.size();
+    QStringList names;
+    names.reserve(entries.size());
+    for (const auto& entry: qAsConst(entries)) {
+        names.append(entry.getFileName());
+    }
+    m_progress.start(names, numEntries, 0);
+    for (uint32_t i = 0; i < numEntries && !m_cancelOperation; ++i) {
+        const auto& entry = entries.at(i);
+        const auto& archEntry = entry.getArchEntry();
+        bool valid = true;
+        uint64_t compressedSize = archEntry.compressed_size;
+        m_progress.setEntry(0, i, 0, archEntry.uncompressed_size);
+        if (entry.getSolidOffset() >= 0 && !entry.getBlocks().isEmpty()) {
+            const auto& block = entry.getBlocks().first();
+            auto it = solidBlocks.find(block.offset);
+            //Solid block is counted by the member it is restored for
+            compressedSize = it == solidBlocks.end() ? block.compressed_size : 0;
+            if (it == solidBlocks.end()) {
+                QByteArray data;
+                QBuffer b(&data);
+                b.open(QIODevice::WriteOnly);
+                if (!restoreBlock(source, entry, block, b, 0)) {
+                    data.clear();
+                }
+                it = solidBlocks.insert(block.offset, data);
+            }
+            const uint64_t offset = entry.getSolidOffset();
+            valid = fitsIn(offset, archEntry.uncompressed_size, it->size()) &&
+                    Checksum::compute(info.checksumType, it->constData() + offset, archEntry.uncompressed_size) == archEntry.checksum;
+        } else {
+            for (const auto& block: entry.getBlocks()) {
+                if (!testedBlocks.contains(block.offset)) {
+                    testedBlocks.insert(block.offset);
+                    valid = valid && restoreBlock(source, entry, block, null, 0);
+                }
+            }
         }
-        const auto fileName { f.read(entry.filename_length) };
-        if (fileName.size() != entry.filename_length) {
-            return;
+        if (!valid) {
+            qWarning() << "Corrupted" << entry.getFileName();
+            result = false;
         }
-        pos = f.pos();
-        bool result = decompressFile(f, { entry, fileName }, depackDir);
-        qDebug() << "Decompressing" << fileName << result;
-        emit overallProgress(rootEntry.total_entries - count + 1, rootEntry.total_entries);
-        decompressionError &= result;
+        if (archEntry.entry_type == ET_FILE) {
+            m_metrics.addEntry(entryClass(entry), archEntry.uncompressed_size, compressedSize);
+        }
+        m_progress.entryDone();
     }
+    m_progress.finish();
+    m_metrics.finish(result && !m_cancelOperation);
+    return result && !m_cancelOperation;
 }
 
-void Depacker::depack(QString depackDir, QString file, QList<ArchiveReader::FileInfo> entries) {
+bool Depacker::depackStream(QIODevice& in, QString depackDir) {
+    if (!depackDir.endsWith('/')) {
+        depackDir += '/';
+    }
+    m_metrics.start("depack_stream");
+    emit depackerStateChanged(ArchiverStates::PS_DECOMPRESSING);
+    bool result = false;
+    auto guard = qScopeGuard([this, &result]() {
+        m_progress.finish();
+        m_metrics.finish(result);
+        emit depackerStateChanged(result ? ArchiverStates::PS_IDLE : ArchiverStates::PS_DECOMPRESSION_ERROR);
+    });
+
+    //Header is read the same way as from the file, the fields unknown to this version are skipped
+    QByteArray signature(SIGNATURE_SIZE, Qt::Initialization::Uninitialized);
+    ArchiveHeader header;
+    memset(&header, 0, sizeof (ArchiveHeader));
+    if (!readExactly(in, signature.data(), SIGNATURE_SIZE) || getFormatVersion(signature) != FV_VERSION_2 ||
+            !readExactly(in, header.header_size) || header.header_size < sizeof (header.header_size)) {
+        return false;
+    }
+    QByteArray rest(header.header_size - sizeof (header.header_size), Qt::Initialization::Uninitialized);
+    if (!readExactly(in, rest.data(), rest.size())) {
+        return false;
+    }
+    memcpy(reinterpret_cast<char*>(&header) + sizeof (header.header_size), rest.constData(), qMin<size_t>(rest.size(), sizeof (ArchiveHeader) - sizeof (header.header_size)));
+    const auto checksumType = static_cast<ChecksumTypes>(header.checksum_type);
+    if (!(header.flags & AF_STREAM_RECORDS) || !Checksum::isSupported(checksumType)) {
+        return false;
+    }
+    uint64_t pos = SIGNATURE_SIZE + header.header_size;
+    QByteArray dictionaryContent;
+    if (header.dictionary_size > 0) {
+        dictionaryContent.resize(header.dictionary_size);
+        if (header.dictionary_offset != pos || !readExactly(in, dictionaryContent.data(), dictionaryContent.size())) {
+            return false;
+        }
+        pos += header.dictionary_size;
+    }
+
+    //Only the current entry, its block and the last solid block are kept in memory.
+    //Entries sharing the payload restored earlier are copied from the files restored from it
+    Dictionaries dictionaries;
+    QFile unused;
+    ArchiveSource source { unused, nullptr, 0, checksumType, dictionaries };
+    QVector<ArchiveReader::FileInfo> current;
+    QFile o;
+    uint64_t bytesDone = 0;
+    QByteArray solidData;
+    uint64_t solidOffset = 0;
+    QHash<QPair<uint64_t, int64_t>, QString> restored;
+    QByteArray buf;
+    m_progress.start(QStringList(), 0, 0);
+
+    auto finishEntry = [&]() {
+        if (o.isOpen()) {
+            o.close();
+            restoreAttributes(o, current.first().getArchEntry());
+        }
+        current.clear();
+        bytesDone = 0;
+    };
+    auto writeMember = [&](const ArchiveReader::FileInfo& entry) {
+        const auto& archEntry = entry.getArchEntry();
+        const uint64_t offset = entry.getSolidOffset();
+        if (solidData.isNull() || !fitsIn(offset, archEntry.uncompressed_size, solidData.size())) {
+            return false;
+        }
+        const char* memberData = solidData.constData() + offset;
+        return Checksum::compute(checksumType, memberData, archEntry.uncompressed_size) == archEntry.checksum &&
+               o.write(memberData, archEntry.uncompressed_size) == static_cast<int64_t>(archEntry.uncompressed_size);
+    };
+    auto copyRestored = [&](const QString& from) {
+        QFile f(from);
+        if (!f.open(QIODevice::ReadOnly)) {
+            return false;
+        }
+        for (auto chunk { f.read(BYTES_TO_READ) }; !chunk.isEmpty(); chunk = f.read(BYTES_TO_READ)) {
+            if (o.write(chunk) != chunk.size()) {
+                return false;
+            }
+        }
+        return true;
+    };
+
+    while (!m_cancelOperation) {
+        StreamRecord record;
+        if (!readExactly(in, record)) {
+            return false;
+        }
+        pos += sizeof (StreamRecord);
+        if (record.type == SR_END) {
+            finishEntry();
+            //Index and footer follow the last record, they are read through so the writer of the pipe isn't cut off
+            QByteArray tail;
+            const int64_t trailerSize = readToEnd(in, tail, sizeof (ArchiveFooter));
+            if (trailerSize < static_cast<int64_t>(sizeof (ArchiveFooter))) {
+                return false;
+            }
+            ArchiveFooter footer;
+            memcpy(&footer, tail.constData(), sizeof (ArchiveFooter));
+            result = memcmp(footer.signature, SIGNATURE_V2, SIGNATURE_SIZE) == 0 && footer.index_offset == pos &&
+                     footer.index_size == static_cast<uint64_t>(trailerSize) - sizeof (ArchiveFooter);
+            return result;
+        }
+        if (record.type == SR_ENTRY) {
+            finishEntry();
+            buf.resize(record.size);
+            if (record.size > MAX_STREAM_RECORD_SIZE || !readExactly(in, buf.data(), buf.size()) ||
+                    !ArchiveReader::parseIndex(buf, FV_VERSION_2, current) || current.size() != 1) {
+                return false;
+            }
+            pos += record.size;
+            const auto& entry = current.first();
+            const auto& archEntry = entry.getArchEntry();
+            if (!isSafeName(entry.getFileName())) {
+                qDebug() << "Unsafe entry name" << entry.getFileName();
+                return false;
+            }
+            const QString path { depackDir + entry.getFileName() };
+            //Entries of the stream are unknown ahead, so the name of the current one is the only one known
+            m_progress.setNames({ entry.getFileName() });
+            m_progress.setEntry(0, 0, 0, archEntry.uncompressed_size);
+            m_progress.entryDone();
+            if (archEntry.entry_type == ET_DIR) {
+                QDir().mkpath(path);
+                continue;
+            }
+            QDir().mkpath(QFileInfo(path).absolutePath());
+            o.setFileName(path);
+            if (!o.open(QIODevice::WriteOnly)) {
+                return false;
+            }
+            const auto method = getCompressionMethod(archEntry.compression);
+            if (entry.usesDictionary() && !dictionaries.contains(method) && !prepareDictionary(dictionaryContent, method, dictionaries)) {
+                return false;
+            }
+            //Blocks of the entry with the payload of its own either follow or aren't listed in its record
+            if (entry.getBlocks().isEmpty() || (entry.getSolidOffset() >= 0 && entry.getBlocks().first().offset >= pos)) {
+                continue;
+            }
+            const auto key = qMakePair(entry.getBlocks().first().offset, entry.getSolidOffset());
+            bool restoredEntry = false;
+            if (entry.getSolidOffset() >= 0 && key.first == solidOffset) {
+                restoredEntry = writeMember(entry);
+            } else if (restored.contains(key)) {
+                restoredEntry = copyRestored(restored.value(key));
+            }
+            if (!restoredEntry) {
+                return false;
+            }
+            restored.insert(key, path);
+            continue;
+        }
+        if (record.type != SR_BLOCK) {
+            //Records of the newer versions are skipped
+            for (uint64_t skipped = 0; skipped < record.size; ) {
+                const auto chunk { in.read(qMin<uint64_t>(BYTES_TO_READ, record.size - skipped)) };
+                if (chunk.isEmpty() && !in.waitForReadyRead(-1)) {
+                    return false;
+                }
+                skipped += chunk.size();
+            }
+            pos += record.size;
+            continue;
+        }
+
+        BlockEntry block;
+        if (current.isEmpty() || !o.isOpen() || record.size > MAX_STREAM_BLOCK_SIZE || !readExactly(in, block) ||
+                record.size != sizeof (BlockEntry) + block.compressed_size) {
+            return false;
+        }
+        buf.resize(block.compressed_size);
+        {
+            Metrics::Scope read(m_metrics, Metrics::PH_READ, buf.size());
+            if (!readExactly(in, buf.data(), buf.size())) {
+                return false;
+            }
+        }
+        pos += record.size;
+        //Block is decoded right from the buffer as if it was the mapped archive
+        const auto& entry = current.first();
+        const uint64_t offset = block.offset;
+        block.offset = 0;
+        source.mapped = reinterpret_cast<const uchar*>(buf.constData());
+        source.mappedSize = buf.size();
+        if (entry.getSolidOffset() >= 0) {
+            solidData.clear();
+            QBuffer b(&solidData);
+            b.open(QIODevice::WriteOnly);
+            if (!restoreBlock(source, entry, block, b, 0)) {
+                return false;
+            }
+            solidOffset = offset;
+            if (!writeMember(entry)) {
+                return false;
+            }
+            restored.insert(qMakePair(offset, entry.getSolidOffset()), o.fileName());
+            continue;
+        }
+        if (bytesDone == 0) {
+            restored.insert(qMakePair(offset, static_cast<int64_t>(-1)), o.fileName());
+        }
+        if (!restoreBlock(source, entry, block, o, 0)) {
+            return false;
+        }
+        bytesDone += block.uncompressed_size;
+    }
+    return false;
+}
+
+void Depacker::depack(QString depackDir, QString file, QSharedPointer<ArchiveReader> archiveReader, QList<ArchiveReader::FileInfo> entries) {
     QVector<ArchiveReader::FileInfo> result;
-    uint32_t numEntries = 0;
-    const auto archiveReader { FilesystemDirModel::instance()->getArchiveReader() };
     if (archiveReader.isNull()) {
         return;
     }
     if (!depackDir.endsWith('/')) {
         depackDir += '/';
     }
-    QFile f(file);
-    if (!f.open(QIODevice::ReadOnly)) {
+    if (!QFile::exists(file)) {
         return;
     }
 
+    m_metrics.start("depack");
+    m_progress.startScanning();
     emit depackerStateChanged(ArchiverStates::PS_SCANNING_FILESYSTEM);
 
-    for (const auto& e: entries) {
-        numEntries += prepareEntries(archiveReader, { e }, result);
+    {
+        Metrics::Scope scan(m_metrics, Metrics::PH_SCAN);
+        for (const auto& e: entries) {
+            prepareEntries(archiveReader, { e }, result);
+        }
     }
 
     emit depackerStateChanged(ArchiverStates::PS_DECOMPRESSING);
-    emit overallProgress(0, numEntries);
-
-    bool decompressionError = true;
-    auto guard = qScopeGuard([&f, &decompressionError, this]() {
-        f.close();
-        if (decompressionError) {
-            emit depackerStateChanged(ArchiverStates::PS_DECOMPRESSION_ERROR);
-        } else {
-            emit depackerStateChanged(ArchiverStates::PS_IDLE);
-        }
-    });
 
-    uint32_t counter = 0;
-    for (const auto& entry: entries) {
-        if (m_cancelOperation) {
-            break;
-        }
-        bool result = decompressFile(f, { entry.getArchEntry(), entry.getFileName() }, depackDir);
-        qDebug() << "Decompressing" << entry.getFileName() << result;
-        emit overallProgress(counter, numEntries);
-        decompressionError &= result;
-    }
+    const bool decompressionError = !extractEntries(file, archiveReader->getArchiveInfo(), result, depackDir);
+    m_metrics.finish(!decompressionError);
+    emit depackerStateChanged(decompressionError ? ArchiverStates::PS_DECOMPRESSION_ERROR : ArchiverStates::PS_IDLE);
 }
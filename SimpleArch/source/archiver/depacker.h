@@ -2,16 +2,53 @@
 #define DEPACKER_H
 
 #include <QObject>
+#include <QHash>
+#include <QSharedPointer>
 #include "archivereader.h"
+#include "codec.h"
+#include "metrics.h"
+#include "progress.h"
 
 class Depacker : public ArchiveBase
 {
     Q_OBJECT
 
     std::atomic_bool& m_cancelOperation;
+    Progress m_progress;
+    Metrics m_metrics;
+
+    //Unit of work of the extraction: either the whole entry, the single block of the entry split between the workers
+    //or the solid block restoring all of its members
+    struct ExtractJob {
+        int entry;
+        int block;
+        uint64_t outOffset;
+        int solidGroup;
+    };
+
+    //Preset dictionary of the archive prepared for every method of the entries using it
+    using Dictionaries = QHash<int, QSharedPointer<Codec::Dictionary>>;
+
+    //Source of the compressed data: the archive mapping if the archive could be mapped, the file handle otherwise
+    struct ArchiveSource {
+        QFile& file;
+        const uchar* mapped;
+        uint64_t mappedSize;
+        ChecksumTypes checksumType;
+        const Dictionaries& dictionaries;
+    };
 
     uint32_t prepareEntries(const QSharedPointer<ArchiveReader>& archiveReader, const QVector<ArchiveReader::FileInfo>& entries, QVector<ArchiveReader::FileInfo>& result);
-    bool decompressFile(QFile& f, const ArchiveReader::FileInfo& entry, const QString& outPath);
+    static bool prepareDictionary(const QByteArray& content, int method, Dictionaries& dictionaries);
+    static bool loadDictionaries(QFile& f, const ArchiveReader::ArchiveInfo& info, const QVector<ArchiveReader::FileInfo>& entries, Dictionaries& dictionaries);
+    //Blocks restored as a part of the job advance the progress slot of the worker, -1 for the ones restored otherwise
+    bool decodeBlock(ArchiveSource& source, const Codec* codec, const Codec::Dictionary* dictionary, const BlockEntry& block, QIODevice& o, int slot);
+    bool copyBlock(ArchiveSource& source, const BlockEntry& block, QIODevice& o, int slot);
+    bool restoreBlock(ArchiveSource& source, const ArchiveReader::FileInfo& entry, const BlockEntry& block, QIODevice& o, int slot);
+    bool decompressFile(ArchiveSource& source, const ArchiveReader::FileInfo& entry, const QString& outPath, int slot);
+    bool decompressSolid(ArchiveSource& source, const QVector<ArchiveReader::FileInfo>& entries, const QVector<int>& members, const QString& outPath, int slot);
+    static void restoreAttributes(QFile& o, const ArchEntry& archEntry);
+    bool extractEntries(const QString& file, const ArchiveReader::ArchiveInfo& info, const QVector<ArchiveReader::FileInfo>& entries, const QString& outPath);
 
 public:
     explicit Depacker(QObject* parent = nullptr);
@@ -19,16 +56,25 @@ public:
     virtual ~Depacker() = default;
 
     void cancel();
+    //Sampled by the observers of the job, the slots are the workers
+    const Progress& getProgress() const;
+    //Report of the last job is complete once the job has signalled its final state
+    const Metrics& getMetrics() const;
+
+    //Inflates only the blocks of the entry overlapping the requested range
+    bool readRange(QFile& f, const ArchiveReader::ArchiveInfo& info, const ArchiveReader::FileInfo& entry, uint64_t offset, uint64_t length, QByteArray& out);
+    //Decompresses every block of the archive without writing it anywhere and verifies the checksums
+    bool testArchive(const QString& file);
+    //Restores the archive written by Packer::packStream entry by entry as it is read from the device, without seeking it
+    bool depackStream(QIODevice& in, QString depackDir);
 
 public slots:
-    void depack(QString depackDir, QString file, QList<ArchiveReader::FileInfo> entries);
+    //Directory entries are expanded through the reader the archive was browsed with
+    void depack(QString depackDir, QString file, QSharedPointer<ArchiveReader> archiveReader, QList<ArchiveReader::FileInfo> entries);
     void depackFile(QString depackDir, QString file);
 
 signals:
     void depackerStateChanged(ArchiveBase::ArchiverStates state);
-    void overallProgress(quint32 current, quint32 whole);
-    void fileProgress(QString fileName, quint32 current, quint32 whole);
-    void scanningFilesystem(QString fileName);
 };
 
 #endif // DEPACKER_H
@@ -0,0 +1,397 @@
+#include "filebatch.h"
+#ifdef Q_OS_LINUX
+#include <sys/syscall.h>
+#if defined(SYS_io_uring_setup) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define HAVE_IO_URING
+#endif
+#endif
+#endif
+
+#ifdef HAVE_IO_URING
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <functional>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+//Single read or write is limited by the kernel anyway, the rest of the file goes in the next round
+#define MAX_TRANSFER_SIZE (1 << 30)
+
+namespace {
+    //Submission and completion rings shared with the kernel, used by the thread that created them only
+    class Ring
+    {
+        int m_fd;
+        void* m_sqRing;
+        size_t m_sqRingSize;
+        void* m_cqRing;
+        size_t m_cqRingSize;
+        io_uring_sqe* m_sqes;
+        size_t m_sqesSize;
+        unsigned* m_sqTail;
+        unsigned* m_sqMask;
+        unsigned* m_sqArray;
+        unsigned* m_cqHead;
+        unsigned* m_cqTail;
+        unsigned* m_cqMask;
+        io_uring_cqe* m_cqes;
+        bool m_stat;
+
+        static bool supports(int fd, bool& stat);
+        void release();
+
+    public:
+        Ring();
+        virtual ~Ring();
+
+        bool isValid() const {
+            return m_fd >= 0;
+        }
+        //Statx came along with the other operations, but it is checked on its own as the batches don't need it
+        bool canStat() const {
+            return isValid() && m_stat;
+        }
+        //Prepares the request of every index, submits them at once and waits for all of them, the results are stored
+        //by index. Count is at most the size of the ring
+        bool run(int count, const std::function<void(io_uring_sqe&, int)>& prepare, QVector<int>& results);
+    };
+
+    //File of the batch while it is processed
+    struct Transfer {
+        const char* path;
+        int fd;
+        char* data;
+        int64_t size;
+        int64_t done;
+    };
+
+    Ring::Ring() :
+        m_fd(-1),
+        m_sqRing(MAP_FAILED),
+        m_sqRingSize(0),
+        m_cqRing(MAP_FAILED),
+        m_cqRingSize(0),
+        m_sqes(static_cast<io_uring_sqe*>(MAP_FAILED)),
+        m_sqesSize(0),
+        m_stat(false)
+    {
+        io_uring_params params;
+        memset(&params, 0, sizeof(params));
+        //Seccomp filters of the containers usually answer with EPERM or ENOSYS, the batches are off then
+        const int fd = syscall(SYS_io_uring_setup, FILE_BATCH_RING_ENTRIES, &params);
+        if (fd < 0) {
+            return;
+        }
+        m_fd = fd;
+        m_sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        m_cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        const bool singleMap = params.features & IORING_FEAT_SINGLE_MMAP;
+        if (singleMap) {
+            m_sqRingSize = m_cqRingSize = qMax(m_sqRingSize, m_cqRingSize);
+        }
+        m_sqRing = mmap(nullptr, m_sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+        if (!singleMap) {
+            m_cqRing = mmap(nullptr, m_cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+        }
+        m_sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+        m_sqes = static_cast<io_uring_sqe*>(mmap(nullptr, m_sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES));
+        const auto cqRing = singleMap ? m_sqRing : m_cqRing;
+        if (m_sqRing == MAP_FAILED || cqRing == MAP_FAILED || m_sqes == MAP_FAILED || !supports(fd, m_stat)) {
+            release();
+            return;
+        }
+
+        const auto sq = static_cast<char*>(m_sqRing);
+        m_sqTail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+        m_sqMask = reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+        m_sqArray = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+        const auto cq = static_cast<char*>(cqRing);
+        m_cqHead = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+        m_cqTail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+        m_cqMask = reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+        m_cqes = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+    }
+
+    Ring::~Ring() {
+        release();
+    }
+
+    bool Ring::supports(int fd, bool& stat) {
+        //Operations on the files came with 5.6, the older kernels have the ring but can't do the batches
+        QByteArray buffer(sizeof(io_uring_probe) + 256 * sizeof(io_uring_probe_op), 0);
+        auto probe = reinterpret_cast<io_uring_probe*>(buffer.data());
+        if (syscall(SYS_io_uring_register, fd, IORING_REGISTER_PROBE, probe, 256) < 0) {
+            return false;
+        }
+        const auto supported = [probe](int op) {
+            return op <= probe->last_op && (probe->ops[op].flags & IO_URING_OP_SUPPORTED);
+        };
+        stat = supported(IORING_OP_STATX);
+        for (const int op: { IORING_OP_OPENAT, IORING_OP_READ, IORING_OP_WRITE, IORING_OP_CLOSE }) {
+            if (!supported(op)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    void Ring::release() {
+        if (m_sqes != MAP_FAILED) {
+            munmap(m_sqes, m_sqesSize);
+            m_sqes = static_cast<io_uring_sqe*>(MAP_FAILED);
+        }
+        if (m_cqRing != MAP_FAILED) {
+            munmap(m_cqRing, m_cqRingSize);
+            m_cqRing = MAP_FAILED;
+        }
+        if (m_sqRing != MAP_FAILED) {
+            munmap(m_sqRing, m_sqRingSize);
+            m_sqRing = MAP_FAILED;
+        }
+        if (m_fd >= 0) {
+            close(m_fd);
+            m_fd = -1;
+        }
+    }
+
+    bool Ring::run(int count, const std::function<void(io_uring_sqe&, int)>& prepare, QVector<int>& results) {
+        results.fill(0, count);
+        //Ring released after the failed round is never touched again
+        if (!isValid()) {
+            return false;
+        }
+        if (count == 0) {
+            return true;
+        }
+        unsigned tail = *m_sqTail;
+        for (int i = 0; i < count; ++i, ++tail) {
+            const unsigned index = tail & *m_sqMask;
+            auto& sqe = m_sqes[index];
+            memset(&sqe, 0, sizeof(sqe));
+            prepare(sqe, i);
+            sqe.user_data = i;
+            m_sqArray[index] = index;
+        }
+        __atomic_store_n(m_sqTail, tail, __ATOMIC_RELEASE);
+
+        //Completion ring is twice the submission one, so all the results of the round fit in it
+        int submitted = 0;
+        int completed = 0;
+        while (completed < count) {
+            const int n = syscall(SYS_io_uring_enter, m_fd, count - submitted, count - completed, IORING_ENTER_GETEVENTS, nullptr, 0);
+            if (n < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                //Ring is left in the unknown state, the thread goes through QFile from now on
+                release();
+                return false;
+            }
+            submitted += n;
+            unsigned head = *m_cqHead;
+            for (const unsigned end = __atomic_load_n(m_cqTail, __ATOMIC_ACQUIRE); head != end; ++head, ++completed) {
+                const auto& cqe = m_cqes[head & *m_cqMask];
+                results[cqe.user_data] = cqe.res;
+            }
+            __atomic_store_n(m_cqHead, head, __ATOMIC_RELEASE);
+        }
+        return true;
+    }
+
+    Ring& threadRing() {
+        thread_local Ring ring;
+        return ring;
+    }
+
+    //QFile::setPermissions gives the owner the user permissions as well
+    mode_t fileMode(uint16_t permissions) {
+        const uint16_t owner = ((permissions >> 12) | (permissions >> 8)) & 7;
+        return owner << 6 | ((permissions >> 4) & 7) << 3 | (permissions & 7);
+    }
+
+    //Opens all the files of the window in one round, then reads or writes them in as many rounds as the short
+    //transfers take, then closes them in one round. Descriptor stays negative for the file that couldn't be opened
+    bool runBatch(Ring& ring, int op, int flags, QVector<Transfer>& window, const std::function<void(const Transfer&)>& beforeClose) {
+        QVector<int> results;
+        if (!ring.run(window.size(), [&window, flags](io_uring_sqe& sqe, int i) {
+                sqe.opcode = IORING_OP_OPENAT;
+                sqe.fd = AT_FDCWD;
+                sqe.addr = reinterpret_cast<uintptr_t>(window.at(i).path);
+                sqe.len = 0666;
+                sqe.open_flags = flags;
+            }, results)) {
+            return false;
+        }
+        QVector<int> pending;
+        QVector<int> opened;
+        for (int i = 0; i < window.size(); ++i) {
+            window[i].fd = results.at(i);
+            if (window.at(i).fd >= 0) {
+                opened.append(window.at(i).fd);
+                if (window.at(i).size > 0) {
+                    pending.append(i);
+                }
+            }
+        }
+
+        bool result = true;
+        while (result && !pending.isEmpty()) {
+            result = ring.run(pending.size(), [&window, &pending, op](io_uring_sqe& sqe, int j) {
+                const auto& t = window.at(pending.at(j));
+                sqe.opcode = op;
+                sqe.fd = t.fd;
+                sqe.addr = reinterpret_cast<uintptr_t>(t.data + t.done);
+                sqe.len = static_cast<uint32_t>(qMin<int64_t>(t.size - t.done, MAX_TRANSFER_SIZE));
+                sqe.off = t.done;
+            }, results);
+            //File that ended or failed is done with, whatever was transferred till then stays
+            QVector<int> next;
+            for (int j = 0; result && j < pending.size(); ++j) {
+                auto& t = window[pending.at(j)];
+                if (results.at(j) > 0) {
+                    t.done += results.at(j);
+                    if (t.done < t.size) {
+                        next.append(pending.at(j));
+                    }
+                }
+            }
+            pending.swap(next);
+        }
+
+        if (beforeClose) {
+            for (const auto& t: qAsConst(window)) {
+                if (t.fd >= 0) {
+                    beforeClose(t);
+                }
+            }
+        }
+        //Descriptors are closed directly if the ring was released by the failed round
+        if (!ring.isValid() || !ring.run(opened.size(), [&opened](io_uring_sqe& sqe, int i) {
+                sqe.opcode = IORING_OP_CLOSE;
+                sqe.fd = opened.at(i);
+            }, results)) {
+            for (const auto fd: qAsConst(opened)) {
+                close(fd);
+            }
+        }
+        return result;
+    }
+}
+#endif
+
+std::atomic_bool FileBatch::s_enabled(true);
+
+void FileBatch::setEnabled(bool enabled) {
+    s_enabled = enabled;
+}
+
+bool FileBatch::available() {
+#ifdef HAVE_IO_URING
+    return s_enabled && threadRing().isValid();
+#else
+    return false;
+#endif
+}
+
+bool FileBatch::read(QVector<ReadFile>& files) {
+#ifdef HAVE_IO_URING
+    if (!available()) {
+        return false;
+    }
+    QVector<Transfer> window;
+    for (int first = 0; first < files.size(); first += FILE_BATCH_RING_ENTRIES) {
+        const int count = qMin(FILE_BATCH_RING_ENTRIES, files.size() - first);
+        window.resize(0);
+        for (int i = first; i < first + count; ++i) {
+            const auto& f = files.at(i);
+            window.append({ f.path.constData(), -1, f.data, f.size, 0 });
+        }
+        if (!runBatch(threadRing(), IORING_OP_READ, O_RDONLY | O_CLOEXEC, window, nullptr)) {
+            return false;
+        }
+        for (int i = 0; i < count; ++i) {
+            files[first + i].done = window.at(i).done;
+        }
+    }
+    return true;
+#else
+    Q_UNUSED(files)
+    return false;
+#endif
+}
+
+bool FileBatch::write(QVector<WriteFile>& files) {
+#ifdef HAVE_IO_URING
+    if (!available()) {
+        return false;
+    }
+    QVector<Transfer> window;
+    for (int first = 0; first < files.size(); first += FILE_BATCH_RING_ENTRIES) {
+        const int count = qMin(FILE_BATCH_RING_ENTRIES, files.size() - first);
+        window.resize(0);
+        for (int i = first; i < first + count; ++i) {
+            const auto& f = files.at(i);
+            window.append({ f.path.constData(), -1, const_cast<char*>(f.data), f.size, 0 });
+        }
+        //Attributes are set through the descriptor that is still open, there are no ring operations for them
+        const auto restore = [&files, &window, first](const Transfer& t) {
+            const auto& f = files.at(first + static_cast<int>(&t - window.constData()));
+            const timespec times[2] = { { 0, UTIME_OMIT }, { static_cast<time_t>(f.modified), 0 } };
+            futimens(t.fd, times);
+            fchmod(t.fd, fileMode(f.permissions));
+        };
+        if (!runBatch(threadRing(), IORING_OP_WRITE, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, window, restore)) {
+            return false;
+        }
+        for (int i = 0; i < count; ++i) {
+            files[first + i].ok = window.at(i).fd >= 0 && window.at(i).done == window.at(i).size;
+        }
+    }
+    return true;
+#else
+    Q_UNUSED(files)
+    return false;
+#endif
+}
+
+bool FileBatch::stat(int dirFd, QVector<StatFile>& files) {
+#if defined(HAVE_IO_URING) && defined(STATX_BASIC_STATS)
+    if (!available() || !threadRing().canStat()) {
+        return false;
+    }
+    QVector<struct statx> buffers(qMin(FILE_BATCH_RING_ENTRIES, files.size()));
+    QVector<int> results;
+    for (int first = 0; first < files.size(); first += FILE_BATCH_RING_ENTRIES) {
+        const int count = qMin(FILE_BATCH_RING_ENTRIES, files.size() - first);
+        if (!threadRing().run(count, [&files, &buffers, dirFd, first](io_uring_sqe& sqe, int i) {
+                sqe.opcode = IORING_OP_STATX;
+                sqe.fd = dirFd;
+                sqe.addr = reinterpret_cast<uintptr_t>(files.at(first + i).name);
+                sqe.len = STATX_TYPE | STATX_MODE | STATX_UID | STATX_GID | STATX_SIZE | STATX_MTIME;
+                sqe.statx_flags = AT_STATX_DONT_SYNC;
+                sqe.off = reinterpret_cast<uintptr_t>(&buffers[i]);
+            }, results)) {
+            return false;
+        }
+        for (int i = 0; i < count; ++i) {
+            auto& f = files[first + i];
+            const auto& stx = buffers.at(i);
+            f.ok = results.at(i) == 0;
+            f.mode = stx.stx_mode;
+            f.uid = stx.stx_uid;
+            f.gid = stx.stx_gid;
+            f.size = stx.stx_size;
+            f.modified = stx.stx_mtime.tv_sec;
+        }
+    }
+    return true;
+#else
+    Q_UNUSED(dirFd)
+    Q_UNUSED(files)
+    return false;
+#endif
+}
@@ -0,0 +1,59 @@
+#ifndef FILEBATCH_H
+#define FILEBATCH_H
+
+#include <QByteArray>
+#include <QVector>
+#include <atomic>
+
+//Requests submitted to the ring at once, the larger batches go in several rounds
+#define FILE_BATCH_RING_ENTRIES 64
+
+//Opens, reads or writes and closes the group of whole small files with a few io_uring calls instead of several
+//syscalls per file, or stats the entries of the directory at once. Every thread has the ring of its own. Where
+//io_uring is missing, forbidden or turned off the calls return false without doing anything and the caller goes
+//through QFile or the plain syscalls as before
+class FileBatch
+{
+public:
+    struct ReadFile {
+        QByteArray path;                //Local 8-bit path
+        char* data;
+        int64_t size;                   //Bytes expected, the file is read up to that
+        int64_t done;                   //Bytes read, 0 if the file couldn't be opened
+    };
+
+    struct WriteFile {
+        QByteArray path;                //Local 8-bit path, the file is created or truncated
+        const char* data;
+        int64_t size;
+        int64_t modified;               //Seconds since epoch
+        uint16_t permissions;           //QFileDevice::Permissions
+        bool ok;
+    };
+
+    struct StatFile {
+        const char* name;               //Local 8-bit name relative to the directory, terminated
+        uint32_t mode;
+        uint32_t uid;
+        uint32_t gid;
+        int64_t size;
+        int64_t modified;               //Seconds since epoch
+        bool ok;
+    };
+
+private:
+    static std::atomic_bool s_enabled;
+
+public:
+    static void setEnabled(bool enabled);
+    //Whether the ring could be set up with all the operations the batches need
+    static bool available();
+
+    static bool read(QVector<ReadFile>& files);
+    //Modification time and permissions are set before the file is closed
+    static bool write(QVector<WriteFile>& files);
+    //Symbolic links are followed, the cached attributes are good enough
+    static bool stat(int dirFd, QVector<StatFile>& files);
+};
+
+#endif // FILEBATCH_H
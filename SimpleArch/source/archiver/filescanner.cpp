@@ -0,0 +1,337 @@
+#include "filescanner.h"
+#include <QDateTime>
+#include <QDir>
+#include <QFile>
+#include <QMutexLocker>
+#include <algorithm>
+#include "filebatch.h"
+#ifdef Q_OS_LINUX
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#define DIRENT_BUFFER_SIZE (64 * 1024)
+
+namespace {
+    FileScanner::Entry fromFileInfo(const QFileInfo& info) {
+        return { nullptr, info.isDir() ? 0 : info.size(), info.lastModified().toSecsSinceEpoch(), 0, 0, static_cast<uint16_t>(info.permissions()), info.isDir() };
+    }
+
+#ifdef Q_OS_LINUX
+    //Record returned by getdents64, glibc doesn't declare it
+    struct LinuxDirent64 {
+        uint64_t d_ino;
+        int64_t d_off;
+        unsigned short d_reclen;
+        unsigned char d_type;
+        char d_name[1];
+    };
+
+    //Permissions as QFileInfo reports them, the user ones are these of the class the process belongs to
+    uint16_t filePermissions(uint32_t mode, uint32_t uid, uint32_t gid) {
+        const uint32_t user = uid == geteuid() ? mode >> 6 : gid == getegid() ? mode >> 3 : mode;
+        return static_cast<uint16_t>(((mode >> 6) & 7) << 12 | (user & 7) << 8 | ((mode >> 3) & 7) << 4 | (mode & 7));
+    }
+
+    //Files other than the regular ones and the directories are skipped as QDir did
+    bool setEntry(uint32_t mode, uint32_t uid, uint32_t gid, int64_t size, int64_t modified, FileScanner::Entry& entry) {
+        if (!S_ISDIR(mode) && !S_ISREG(mode)) {
+            return false;
+        }
+        entry.dir = S_ISDIR(mode);
+        entry.fileSize = entry.dir ? 0 : size;
+        entry.modified = modified;
+        entry.filePermissions = filePermissions(mode, uid, gid);
+        return true;
+    }
+
+    //Follows the symbolic links as QFileInfo does
+    bool statEntry(int dirFd, const char* name, FileScanner::Entry& entry) {
+        struct stat st;
+#ifdef STATX_BASIC_STATS
+        //Only the fields the archive needs are asked for, the cached attributes are good enough
+        struct statx stx;
+        if (statx(dirFd, name, AT_STATX_DONT_SYNC, STATX_TYPE | STATX_MODE | STATX_UID | STATX_GID | STATX_SIZE | STATX_MTIME, &stx) == 0) {
+            st.st_mode = stx.stx_mode;
+            st.st_uid = stx.stx_uid;
+            st.st_gid = stx.stx_gid;
+            st.st_size = stx.stx_size;
+            st.st_mtime = stx.stx_mtime.tv_sec;
+        } else if (errno != ENOSYS || fstatat(dirFd, name, &st, 0) != 0) {
+            return false;
+        }
+#else
+        if (fstatat(dirFd, name, &st, 0) != 0) {
+            return false;
+        }
+#endif
+        return setEntry(st.st_mode, st.st_uid, st.st_gid, st.st_size, st.st_mtime, entry);
+    }
+#endif
+}
+
+QString FileScanner::Entry::fileName() const {
+    return QFile::decodeName(QByteArray(name, nameSize));
+}
+
+QString FileScanner::Entry::suffix() const {
+    const auto n { fileName() };
+    const auto dot { n.lastIndexOf('.') };
+    return dot < 0 ? QString() : n.mid(dot + 1);
+}
+
+FileScanner::FileScanner(std::atomic_bool& cancel, Progress& progress, Metrics& metrics) :
+    m_cancelOperation(cancel),
+    m_progress(progress),
+    m_metrics(metrics),
+    m_count(0),
+    m_nameBlockUsed(SCAN_NAMES_BLOCK),
+    m_busy(0),
+    m_running(0),
+    m_stop(false)
+{
+    for (auto& chunk: m_chunks) {
+        chunk.store(nullptr, std::memory_order_relaxed);
+    }
+}
+
+FileScanner::~FileScanner() {
+    stop();
+    m_pool.waitForDone();
+    for (auto& chunk: m_chunks) {
+        delete[] chunk.load(std::memory_order_relaxed);
+    }
+    for (const auto block: qAsConst(m_nameBlocks)) {
+        delete[] block;
+    }
+}
+
+void FileScanner::start(const QFileInfoList& roots, int threads) {
+    int workers = 0;
+    {
+        QMutexLocker lock(&m_mutex);
+        int count = m_count.load(std::memory_order_relaxed);
+        for (int i = 0; i < roots.size(); ++i) {
+            const auto& info = roots.at(i);
+            const auto name { QFile::encodeName(info.fileName()) };
+            auto entry { fromFileInfo(info) };
+            entry.parent = -1 - i;
+            entry.nameSize = name.size();
+            m_rootPaths.append(info.canonicalPath());
+            if (entry.dir) {
+                m_dirs.enqueue(count);
+                m_unpublished.enqueue(count);
+            }
+            append(count++, entry, name.constData());
+        }
+        m_count.store(count, std::memory_order_release);
+        m_progress.entryScanned(roots.size());
+        workers = m_dirs.isEmpty() ? 0 : qMax(threads, 1);
+        m_running = workers;
+    }
+    m_pool.setMaxThreadCount(qMax(workers, 1));
+    for (int i = 0; i < workers; ++i) {
+        m_pool.start([this]() { worker(); });
+    }
+}
+
+void FileScanner::stop() {
+    QMutexLocker lock(&m_mutex);
+    m_stop = true;
+    m_dirsQueued.wakeAll();
+}
+
+bool FileScanner::waitFor(int entry) {
+    QMutexLocker lock(&m_mutex);
+    while (m_count.load(std::memory_order_relaxed) <= entry && m_running > 0) {
+        m_entriesAdded.wait(&m_mutex);
+    }
+    return entry < m_count.load(std::memory_order_relaxed);
+}
+
+void FileScanner::wait() {
+    QMutexLocker lock(&m_mutex);
+    while (m_running > 0) {
+        m_entriesAdded.wait(&m_mutex);
+    }
+}
+
+bool FileScanner::isFinished() {
+    QMutexLocker lock(&m_mutex);
+    return m_running == 0;
+}
+
+int FileScanner::size() const {
+    return m_count.load(std::memory_order_acquire);
+}
+
+const FileScanner::Entry& FileScanner::at(int entry) const {
+    return m_chunks[entry / SCAN_CHUNK_ENTRIES].load(std::memory_order_acquire)[entry % SCAN_CHUNK_ENTRIES];
+}
+
+QString FileScanner::relativePath(int entry) const {
+    return entry < size() ? QFile::decodeName(localPath(entry)) : QString();
+}
+
+QString FileScanner::filePath(int entry) const {
+    int root = 0;
+    const auto path { localPath(entry, &root) };
+    return m_rootPaths.at(root) + "/" + QFile::decodeName(path);
+}
+
+void FileScanner::worker() {
+    //Buffer of the records is kept for all the directories the thread reads
+    QByteArray buffer;
+    QMutexLocker lock(&m_mutex);
+    while (true) {
+        //Queue is empty for good once none of the threads is reading the directory that could add to it
+        while (m_dirs.isEmpty() && m_busy > 0 && !m_stop && !m_cancelOperation) {
+            m_dirsQueued.wait(&m_mutex, 100);
+        }
+        if (m_dirs.isEmpty() || m_stop || m_cancelOperation) {
+            break;
+        }
+        const int dir = m_dirs.dequeue();
+        ++m_busy;
+        lock.unlock();
+
+        Listing listing;
+        {
+            Metrics::Scope scan(m_metrics, Metrics::PH_SCAN);
+            auto& found = listing.found;
+            auto& names = listing.names;
+            m_progress.setScanning(at(dir).fileName());
+            int root = 0;
+            const auto path { localPath(dir, &root) };
+            readDirectory(QFile::encodeName(m_rootPaths.at(root)) + "/" + path, found, names, buffer);
+            std::sort(found.begin(), found.end(), [&names](const Found& a, const Found& b) {
+                if (a.entry.dir != b.entry.dir) {
+                    return a.entry.dir;
+                }
+                return QByteArray::fromRawData(names.constData() + a.nameOffset, a.entry.nameSize) <
+                       QByteArray::fromRawData(names.constData() + b.nameOffset, b.entry.nameSize);
+            });
+        }
+
+        lock.relock();
+        //Directory read before the ones found ahead of it waits for them, the last one read publishes all that are ready
+        m_listings.insert(dir, listing);
+        while (!m_unpublished.isEmpty() && m_listings.contains(m_unpublished.head())) {
+            const int next = m_unpublished.dequeue();
+            auto ready { m_listings.take(next) };
+            publish(next, ready.found, ready.names);
+        }
+        --m_busy;
+        m_dirsQueued.wakeAll();
+    }
+    if (--m_running == 0) {
+        m_entriesAdded.wakeAll();
+    }
+    m_dirsQueued.wakeAll();
+}
+
+void FileScanner::readDirectory(const QByteArray& path, QVector<Found>& found, QByteArray& names, QByteArray& buffer) {
+#ifdef Q_OS_LINUX
+    //Directory is read in the large batches of the records and every entry is stat'ed relative to it, so the path is never resolved again
+    const int fd = open(path.constData(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) {
+        return;
+    }
+    buffer.resize(DIRENT_BUFFER_SIZE);
+    for (long n = syscall(SYS_getdents64, fd, buffer.data(), buffer.size()); n > 0 && !m_cancelOperation; n = syscall(SYS_getdents64, fd, buffer.data(), buffer.size())) {
+        for (long pos = 0; pos < n; ) {
+            const auto dirent = reinterpret_cast<const LinuxDirent64*>(buffer.constData() + pos);
+            pos += dirent->d_reclen;
+            //Dot entries and the hidden files are skipped as QDir did
+            if (dirent->d_name[0] == '.') {
+                continue;
+            }
+            //Names are kept terminated till the entries are stat'ed
+            found.append({ names.size(), { nullptr, 0, 0, 0, static_cast<uint16_t>(strlen(dirent->d_name)), 0, false } });
+            names.append(dirent->d_name, found.last().entry.nameSize + 1);
+        }
+    }
+    //Entries of the directory are stat'ed in batches where io_uring is there, one by one otherwise
+    QVector<FileBatch::StatFile> stats;
+    for (const auto& f: qAsConst(found)) {
+        stats.append({ names.constData() + f.nameOffset, 0, 0, 0, 0, 0, false });
+    }
+    const bool batched = FileBatch::stat(fd, stats);
+    int kept = 0;
+    for (int i = 0; i < found.size(); ++i) {
+        auto f { found.at(i) };
+        const auto& st = stats.at(i);
+        if (batched ? st.ok && setEntry(st.mode, st.uid, st.gid, st.size, st.modified, f.entry) : statEntry(fd, st.name, f.entry)) {
+            found[kept++] = f;
+        }
+    }
+    found.resize(kept);
+    close(fd);
+#else
+    Q_UNUSED(buffer)
+    for (const auto& info: QDir(QFile::decodeName(path)).entryInfoList(QDir::Dirs | QDir::Files | QDir::NoDotAndDotDot)) {
+        const auto name { QFile::encodeName(info.fileName()) };
+        Found f { names.size(), fromFileInfo(info) };
+        f.entry.nameSize = name.size();
+        names.append(name);
+        found.append(f);
+    }
+#endif
+}
+
+void FileScanner::publish(int parent, QVector<Found>& found, const QByteArray& names) {
+    //Entries of the directory become visible all at once
+    int count = m_count.load(std::memory_order_relaxed);
+    for (auto& f: found) {
+        f.entry.parent = parent;
+        if (f.entry.dir) {
+            m_dirs.enqueue(count);
+            m_unpublished.enqueue(count);
+        }
+        append(count++, f.entry, names.constData() + f.nameOffset);
+    }
+    m_count.store(count, std::memory_order_release);
+    m_progress.entryScanned(found.size());
+    m_entriesAdded.wakeAll();
+}
+
+void FileScanner::append(int index, Entry entry, const char* name) {
+    if (m_nameBlockUsed + entry.nameSize > SCAN_NAMES_BLOCK) {
+        m_nameBlocks.append(new char[qMax<int>(SCAN_NAMES_BLOCK, entry.nameSize)]);
+        m_nameBlockUsed = 0;
+    }
+    char* stored = m_nameBlocks.last() + m_nameBlockUsed;
+    memcpy(stored, name, entry.nameSize);
+    m_nameBlockUsed += entry.nameSize;
+    entry.name = stored;
+
+    auto& chunk = m_chunks[index / SCAN_CHUNK_ENTRIES];
+    if (!chunk.load(std::memory_order_relaxed)) {
+        chunk.store(new Entry[SCAN_CHUNK_ENTRIES], std::memory_order_release);
+    }
+    chunk.load(std::memory_order_relaxed)[index % SCAN_CHUNK_ENTRIES] = entry;
+}
+
+QByteArray FileScanner::localPath(int entry, int* root) const {
+    //Names of the parents are collected from the entry up to its root
+    QVector<int> chain;
+    for (int i = entry; i >= 0; i = at(i).parent) {
+        chain.append(i);
+    }
+    if (root) {
+        *root = -1 - at(chain.last()).parent;
+    }
+    QByteArray path;
+    for (int i = chain.size() - 1; i >= 0; --i) {
+        const auto& e = at(chain.at(i));
+        path.append(e.name, e.nameSize);
+        if (i > 0) {
+            path.append('/');
+        }
+    }
+    return path;
+}
@@ -0,0 +1,114 @@
+#ifndef FILESCANNER_H
+#define FILESCANNER_H
+
+#include <QByteArray>
+#include <QFileInfoList>
+#include <QHash>
+#include <QMutex>
+#include <QQueue>
+#include <QStringList>
+#include <QThreadPool>
+#include <QVector>
+#include <QWaitCondition>
+#include <atomic>
+#include "metrics.h"
+#include "progress.h"
+
+//Entries are stored in the chunks that never move, so the found ones are read without locking while the scan goes on
+#define SCAN_CHUNK_ENTRIES   4096
+#define MAX_SCAN_CHUNKS      65536
+#define SCAN_NAMES_BLOCK     (1024 * 1024)
+
+//Walks the directory trees on the pool of its own, every thread reads the whole directory taken from the shared queue.
+//Only the stat fields the archive needs are kept per entry, the names are stored once in the arena and the relative
+//path of the entry is made of the names of its parents. Directory precedes its entries, which are sorted the
+//directories first and then by name. Directories are read in the order the threads get to them, but their entries
+//are published in the order the directories were found, so the entries are numbered the same way in every run
+class FileScanner
+{
+public:
+    struct Entry {
+        const char* name;               //Local 8-bit name in the arena, not terminated
+        int64_t fileSize;
+        int64_t modified;               //Seconds since epoch
+        int32_t parent;                 //Index of the directory entry, -1 - root index for the roots
+        uint16_t nameSize;
+        uint16_t filePermissions;       //QFileDevice::Permissions
+        bool dir;
+
+        bool isDir() const {
+            return dir;
+        }
+        bool isFile() const {
+            return !dir;
+        }
+        int64_t size() const {
+            return fileSize;
+        }
+        uint16_t permissions() const {
+            return filePermissions;
+        }
+        QString fileName() const;
+        QString suffix() const;
+    };
+
+private:
+    //Entry read from the directory before it is published, the name is in the buffer of the listing
+    struct Found {
+        int nameOffset;
+        Entry entry;
+    };
+
+    //Directory read ahead of the ones found before it, kept until they are published
+    struct Listing {
+        QVector<Found> found;
+        QByteArray names;
+    };
+
+    std::atomic_bool& m_cancelOperation;
+    Progress& m_progress;
+    Metrics& m_metrics;
+    QThreadPool m_pool;
+    QStringList m_rootPaths;
+    std::atomic<Entry*> m_chunks[MAX_SCAN_CHUNKS];
+    std::atomic_int m_count;
+    //Queue, arena and the state of the workers are behind the lock, the entries are only appended under it
+    QMutex m_mutex;
+    QWaitCondition m_dirsQueued;
+    QWaitCondition m_entriesAdded;
+    QQueue<int> m_dirs;
+    QQueue<int> m_unpublished;          //Directories in the order they were found, up to the last one not published yet
+    QHash<int, Listing> m_listings;
+    QVector<char*> m_nameBlocks;
+    int m_nameBlockUsed;
+    int m_busy;
+    int m_running;
+    bool m_stop;
+
+    void worker();
+    void readDirectory(const QByteArray& path, QVector<Found>& found, QByteArray& names, QByteArray& buffer);
+    void publish(int parent, QVector<Found>& found, const QByteArray& names);
+    void append(int index, Entry entry, const char* name);
+    //Path of the entry relative to the parent directory of its root
+    QByteArray localPath(int entry, int* root = nullptr) const;
+
+public:
+    FileScanner(std::atomic_bool& cancel, Progress& progress, Metrics& metrics);
+    virtual ~FileScanner();
+
+    //Roots are the first entries in the order they are given, the directories among them are walked by the threads
+    void start(const QFileInfoList& roots, int threads);
+    void stop();
+    //Blocks until the entry is found or the scan is over, returns false if there is no such entry
+    bool waitFor(int entry);
+    void wait();
+    bool isFinished();
+
+    //Number of the entries found so far, all of them are readable
+    int size() const;
+    const Entry& at(int entry) const;
+    QString relativePath(int entry) const;
+    QString filePath(int entry) const;
+};
+
+#endif // FILESCANNER_H
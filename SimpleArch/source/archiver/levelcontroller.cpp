@@ -0,0 +1,80 @@
+#include "levelcontroller.h"
+#include <QMutexLocker>
+#include <limits>
+
+//Weight of the latest block in the moving averages
+#define LEVEL_STATS_WEIGHT 0.3
+//Amount of data compressed at the level before it is judged
+#define LEVEL_PROBE_SIZE   (4 * BYTES_TO_READ)
+//Level is raised only if the pool would stay this much faster than the target
+#define LEVEL_RAISE_MARGIN 1.25
+//Higher level has to shrink the output at least by this part to be worth its speed
+#define MIN_RATIO_GAIN     0.01
+
+LevelController::LevelController(ArchiveBase::CompressionLevels maxLevel, int workers, uint64_t targetSpeed, uint32_t timeBudget, uint64_t totalBytes) :
+    m_maxLevel(qBound<int>(ArchiveBase::C_BEST_SPEED, maxLevel, ArchiveBase::C_BEST_COMPRESSION)),
+    m_level((ArchiveBase::C_BEST_SPEED + m_maxLevel + 1) / 2),
+    m_workers(qMax(workers, 1)),
+    m_targetSpeed(targetSpeed),
+    m_deadline(timeBudget * 1000ll),
+    m_totalBytes(totalBytes),
+    m_doneBytes(0),
+    m_bytesAtLevel(0),
+    m_stats()
+{
+    m_timer.start();
+}
+
+double LevelController::targetSpeed() const {
+    if (m_deadline <= 0) {
+        return m_targetSpeed;
+    }
+    //Rest of the data has to be done in the rest of the time budget
+    const int64_t left = m_deadline - m_timer.elapsed();
+    const uint64_t bytesLeft = m_totalBytes > m_doneBytes ? m_totalBytes - m_doneBytes : 0;
+    return left > 0 ? bytesLeft * 1000.0 / left : std::numeric_limits<double>::infinity();
+}
+
+ArchiveBase::CompressionLevels LevelController::level() {
+    QMutexLocker lock(&m_mutex);
+    return static_cast<ArchiveBase::CompressionLevels>(m_level);
+}
+
+void LevelController::report(ArchiveBase::CompressionLevels level, uint64_t size, uint64_t compressedSize, int64_t nsecs) {
+    if (size == 0 || nsecs <= 0 || level < ArchiveBase::C_BEST_SPEED || level > ArchiveBase::C_BEST_COMPRESSION) {
+        return;
+    }
+    QMutexLocker lock(&m_mutex);
+    auto& stats = m_stats[level];
+    const double speed = size * 1e9 / nsecs;
+    const double ratio = static_cast<double>(compressedSize) / size;
+    stats.speed = stats.measured ? stats.speed + LEVEL_STATS_WEIGHT * (speed - stats.speed) : speed;
+    stats.ratio = stats.measured ? stats.ratio + LEVEL_STATS_WEIGHT * (ratio - stats.ratio) : ratio;
+    stats.measured = true;
+    m_doneBytes += size;
+    if (level != m_level) {
+        return;
+    }
+    m_bytesAtLevel += size;
+    if (m_bytesAtLevel < LEVEL_PROBE_SIZE) {
+        return;
+    }
+
+    //Workers compress in parallel, so the pool keeps up with the target if each of them does its share
+    const double target = targetSpeed();
+    const double poolSpeed = stats.speed * m_workers;
+    int next = m_level;
+    if (poolSpeed < target) {
+        next = qMax<int>(m_level - 1, ArchiveBase::C_BEST_SPEED);
+    } else if (m_level < m_maxLevel && poolSpeed > target * LEVEL_RAISE_MARGIN) {
+        const auto& higher = m_stats[m_level + 1];
+        //Level known to be too slow or to gain nothing is not tried again
+        if (!higher.measured || (higher.speed * m_workers >= target && higher.ratio < stats.ratio * (1 - MIN_RATIO_GAIN))) {
+            next = m_level + 1;
+        }
+    }
+    if (next != m_level) {
+        m_level = next;
+        m_bytesAtLevel = 0;
+    }
+}
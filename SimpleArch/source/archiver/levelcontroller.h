@@ -0,0 +1,41 @@
+#ifndef LEVELCONTROLLER_H
+#define LEVELCONTROLLER_H
+
+#include <QElapsedTimer>
+#include <QMutex>
+#include "archivebase.h"
+
+//Picks the compression level of the adaptive pack job. Speed and ratio achieved on every level are measured on the blocks
+//compressed so far, the level is stepped down while the pool falls behind the target and up while it has the headroom
+class LevelController
+{
+    struct LevelStats {
+        double speed;                   //Bytes per second of a single worker, moving average
+        double ratio;                   //Compressed to uncompressed size, moving average
+        bool measured;
+    };
+
+    QMutex m_mutex;
+    QElapsedTimer m_timer;
+    int m_maxLevel;
+    int m_level;
+    int m_workers;
+    double m_targetSpeed;
+    int64_t m_deadline;
+    uint64_t m_totalBytes;
+    uint64_t m_doneBytes;
+    uint64_t m_bytesAtLevel;            //Measured since the level was changed last time
+    LevelStats m_stats[ArchiveBase::C_BEST_COMPRESSION + 1];
+
+    double targetSpeed() const;
+
+public:
+    //Either the target throughput in bytes per second or the time to compress totalBytes in is given, the other one is 0
+    LevelController(ArchiveBase::CompressionLevels maxLevel, int workers, uint64_t targetSpeed, uint32_t timeBudget, uint64_t totalBytes);
+    virtual ~LevelController() = default;
+
+    ArchiveBase::CompressionLevels level();
+    void report(ArchiveBase::CompressionLevels level, uint64_t size, uint64_t compressedSize, int64_t nsecs);
+};
+
+#endif // LEVELCONTROLLER_H
@@ -0,0 +1,143 @@
+#include "lz4codec.h"
+#include <QDebug>
+#include <cstring>
+#include "lz4frame.h"
+
+namespace {
+    LZ4F_preferences_t getPreferences(ArchiveBase::CompressionLevels level) {
+        //Lowest levels trade the ratio for the acceleration, the upper ones go to the high compression mode
+        static const int levels[] { 0, -4, 0, 3, 4, 6, 8, 9, 10, 12 };
+        LZ4F_preferences_t preferences;
+        memset(&preferences, 0, sizeof (preferences));
+        preferences.frameInfo.blockSizeID = LZ4F_max1MB;
+        preferences.frameInfo.blockMode = LZ4F_blockLinked;
+        preferences.compressionLevel = levels[qMin<int>(level, ArchiveBase::C_BEST_COMPRESSION)];
+        return preferences;
+    }
+
+    class Lz4Encoder : public Codec::Encoder
+    {
+        LZ4F_cctx* m_ctx;
+        LZ4F_preferences_t m_preferences;
+        QByteArray m_buf;
+        bool m_started;
+
+    public:
+        Lz4Encoder(ArchiveBase::CompressionLevels level, ArchiveBase::ChecksumTypes checksumType) :
+            Encoder(checksumType),
+            m_ctx(nullptr),
+            m_preferences(getPreferences(level)),
+            m_buf(LZ4F_compressBound(BYTES_TO_READ, &m_preferences), Qt::Initialization::Uninitialized),
+            m_started(false)
+        {
+            if (LZ4F_isError(LZ4F_createCompressionContext(&m_ctx, LZ4F_VERSION))) {
+                m_ctx = nullptr;
+            }
+        }
+
+        ~Lz4Encoder() override {
+            LZ4F_freeCompressionContext(m_ctx);
+        }
+
+        bool encode(const char* data, size_t size, bool last, const Codec::Sink& sink) override {
+            if (!m_ctx) {
+                return false;
+            }
+            m_checksum.update(data, size);
+            if (!m_started) {
+                const auto written = LZ4F_compressBegin(m_ctx, m_buf.data(), m_buf.size(), &m_preferences);
+                if (LZ4F_isError(written) || !sink(m_buf.constData(), written)) {
+                    return false;
+                }
+                m_started = true;
+            }
+            //Output buffer is bound for BYTES_TO_READ of the input at once
+            for (size_t pos = 0; pos < size; pos += BYTES_TO_READ) {
+                const auto written = LZ4F_compressUpdate(m_ctx, m_buf.data(), m_buf.size(), data + pos, qMin<size_t>(BYTES_TO_READ, size - pos), nullptr);
+                if (LZ4F_isError(written) || !sink(m_buf.constData(), written)) {
+                    return false;
+                }
+            }
+            if (last) {
+                const auto written = LZ4F_compressEnd(m_ctx, m_buf.data(), m_buf.size(), nullptr);
+                if (LZ4F_isError(written) || !sink(m_buf.constData(), written)) {
+                    return false;
+                }
+            }
+            return true;
+        }
+    };
+
+    class Lz4Decoder : public Codec::Decoder
+    {
+        LZ4F_dctx* m_ctx;
+        QByteArray m_buf;
+
+    public:
+        explicit Lz4Decoder(ArchiveBase::ChecksumTypes checksumType) :
+            Decoder(checksumType),
+            m_ctx(nullptr),
+            m_buf(BYTES_TO_READ, Qt::Initialization::Uninitialized)
+        {
+            if (LZ4F_isError(LZ4F_createDecompressionContext(&m_ctx, LZ4F_VERSION))) {
+                m_ctx = nullptr;
+            }
+        }
+
+        ~Lz4Decoder() override {
+            LZ4F_freeDecompressionContext(m_ctx);
+        }
+
+        bool decode(const char* data, size_t size, const Codec::Sink& sink, bool& finished) override {
+            if (!m_ctx) {
+                return false;
+            }
+            size_t pos = 0;
+            size_t produced;
+            do {
+                size_t consumed = size - pos;
+                produced = m_buf.size();
+                const auto result = LZ4F_decompress(m_ctx, m_buf.data(), &produced, data + pos, &consumed, nullptr);
+                if (LZ4F_isError(result)) {
+                    qDebug() << "LZ4F_decompress failed:" << LZ4F_getErrorName(result);
+                    return false;
+                }
+                pos += consumed;
+                m_checksum.update(m_buf.constData(), produced);
+                if (!sink(m_buf.constData(), produced)) {
+                    return false;
+                }
+                if (result == 0) {
+                    finished = true;
+                    return true;
+                }
+            } while (pos < size || produced == static_cast<size_t>(m_buf.size()));
+            return true;
+        }
+    };
+}
+
+Codec::Encoder* Lz4Codec::createEncoder(ArchiveBase::CompressionLevels level, ArchiveBase::ChecksumTypes checksumType, const Dictionary* dictionary) const {
+    Q_UNUSED(dictionary)
+    return new Lz4Encoder(level, checksumType);
+}
+
+Codec::Decoder* Lz4Codec::createDecoder(ArchiveBase::ChecksumTypes checksumType, const Dictionary* dictionary) const {
+    Q_UNUSED(dictionary)
+    return new Lz4Decoder(checksumType);
+}
+
+bool Lz4Codec::compress(const char* data, size_t size, ArchiveBase::CompressionLevels level, ArchiveBase::ChecksumTypes checksumType, const Dictionary* dictionary,
+                        QByteArray& out, uint32_t& checksum) const {
+    Q_UNUSED(dictionary)
+    const auto preferences = getPreferences(level);
+    out.resize(LZ4F_compressFrameBound(size, &preferences));
+    const auto result = LZ4F_compressFrame(out.data(), out.size(), data, size, &preferences);
+    if (LZ4F_isError(result)) {
+        qDebug() << "LZ4F_compressFrame failed:" << LZ4F_getErrorName(result);
+        return false;
+    }
+    out.resize(result);
+    checksum = Checksum::compute(checksumType, data, size);
+    return true;
+}
@@ -0,0 +1,16 @@
+#ifndef LZ4CODEC_H
+#define LZ4CODEC_H
+
+#include "codec.h"
+
+//LZ4 frames, for the snapshots bound by the throughput rather than by the size. Preset dictionaries are not supported
+class Lz4Codec : public Codec
+{
+public:
+    Encoder* createEncoder(ArchiveBase::CompressionLevels level, ArchiveBase::ChecksumTypes checksumType, const Dictionary* dictionary) const override;
+    Decoder* createDecoder(ArchiveBase::ChecksumTypes checksumType, const Dictionary* dictionary) const override;
+    bool compress(const char* data, size_t size, ArchiveBase::CompressionLevels level, ArchiveBase::ChecksumTypes checksumType, const Dictionary* dictionary,
+                  QByteArray& out, uint32_t& checksum) const override;
+};
+
+#endif // LZ4CODEC_H
@@ -0,0 +1,231 @@
+#include "metrics.h"
+#include <QFile>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QMutexLocker>
+#include <chrono>
+#ifdef Q_OS_UNIX
+#include <sys/resource.h>
+#include <time.h>
+#endif
+
+#define RELAXED std::memory_order_relaxed
+
+namespace {
+    //Innermost scope of the thread, the one the nested scope is subtracted from
+    thread_local Metrics::Scope* t_currentScope = nullptr;
+
+    const char* const PHASE_NAMES[Metrics::PH_COUNT] { "scan", "index", "read", "compress", "decompress", "write" };
+    const char* const CLASS_NAMES[Metrics::CL_COUNT] { "whole_file", "blocks", "solid", "stored", "duplicate", "reused" };
+
+    double seconds(int64_t nsecs) {
+        return nsecs / 1e9;
+    }
+}
+
+Metrics::Scope::Scope(Metrics& metrics, Phases phase, uint64_t bytes) :
+    m_metrics(metrics),
+    m_phase(phase),
+    m_parent(t_currentScope),
+    m_wall(wallTime()),
+    m_cpu(threadCpuTime()),
+    m_nestedWall(0),
+    m_nestedCpu(0),
+    m_bytes(bytes),
+    m_span(PHASE_NAMES[phase])
+{
+    t_currentScope = this;
+}
+
+Metrics::Scope::~Scope() {
+    const int64_t wall = wallTime() - m_wall;
+    const int64_t cpu = threadCpuTime() - m_cpu;
+    m_metrics.add(m_phase, wall - m_nestedWall, cpu - m_nestedCpu, m_bytes);
+    m_span.addBytes(m_bytes);
+    if (m_parent) {
+        m_parent->m_nestedWall += wall;
+        m_parent->m_nestedCpu += cpu;
+    }
+    t_currentScope = m_parent;
+}
+
+void Metrics::Scope::addBytes(uint64_t bytes) {
+    m_bytes += bytes;
+}
+
+Metrics::Metrics() :
+    m_started(),
+    m_workers(0)
+{
+    start(QString());
+}
+
+int64_t Metrics::wallTime() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+int64_t Metrics::threadCpuTime() {
+#ifdef Q_OS_UNIX
+    timespec ts;
+    if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) == 0) {
+        return ts.tv_sec * 1000000000ll + ts.tv_nsec;
+    }
+#endif
+    return 0;
+}
+
+Metrics::ProcessStats Metrics::processStats() {
+    ProcessStats stats { 0, 0, -1, -1, -1, -1 };
+#ifdef Q_OS_UNIX
+    rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) == 0) {
+        stats.userTime = usage.ru_utime.tv_sec * 1000000000ll + usage.ru_utime.tv_usec * 1000ll;
+        stats.systemTime = usage.ru_stime.tv_sec * 1000000000ll + usage.ru_stime.tv_usec * 1000ll;
+    }
+#endif
+    //Read and write syscalls of the whole process are counted by the kernel where it exposes them
+    QFile f("/proc/self/io");
+    if (f.open(QIODevice::ReadOnly)) {
+        for (auto line { f.readLine() }; !line.isEmpty(); line = f.readLine()) {
+            const auto value = line.mid(line.indexOf(':') + 1).trimmed().toLongLong();
+            if (line.startsWith("syscr:")) {
+                stats.readCalls = value;
+            } else if (line.startsWith("syscw:")) {
+                stats.writeCalls = value;
+            } else if (line.startsWith("read_bytes:")) {
+                stats.readBytes = value;
+            } else if (line.startsWith("write_bytes:")) {
+                stats.writeBytes = value;
+            }
+        }
+    }
+    return stats;
+}
+
+void Metrics::start(const QString& job) {
+    m_job = job;
+    for (auto& phase: m_phases) {
+        phase.wall.store(0, RELAXED);
+        phase.cpu.store(0, RELAXED);
+        phase.bytes.store(0, RELAXED);
+        phase.calls.store(0, RELAXED);
+    }
+    for (auto& entryClass: m_classes) {
+        entryClass.count.store(0, RELAXED);
+        entryClass.bytes.store(0, RELAXED);
+        entryClass.compressedBytes.store(0, RELAXED);
+    }
+    for (auto& busy: m_busy) {
+        busy.store(0, RELAXED);
+    }
+    m_workers.store(0, RELAXED);
+    m_started = processStats();
+    m_timer.start();
+}
+
+void Metrics::finish(bool success) {
+    const int64_t wall = m_timer.nsecsElapsed();
+    const auto finished { processStats() };
+    //Process counters unavailable on the platform are left out
+    const auto delta = [](int64_t from, int64_t to) {
+        return from < 0 || to < 0 ? QJsonValue() : QJsonValue(static_cast<qint64>(to - from));
+    };
+
+    QJsonObject phases;
+    for (int i = 0; i < PH_COUNT; ++i) {
+        const auto& phase = m_phases[i];
+        const auto calls = phase.calls.load(RELAXED);
+        if (calls == 0) {
+            continue;
+        }
+        const auto phaseWall = phase.wall.load(RELAXED);
+        const auto bytes = phase.bytes.load(RELAXED);
+        phases.insert(PHASE_NAMES[i], QJsonObject {
+            { "wall_s", seconds(phaseWall) },
+            { "cpu_s", seconds(phase.cpu.load(RELAXED)) },
+            { "bytes", static_cast<qint64>(bytes) },
+            { "calls", static_cast<qint64>(calls) },
+            { "mb_per_s", phaseWall > 0 ? bytes * 1e9 / phaseWall / 1048576 : 0 }
+        });
+    }
+
+    QJsonObject classes;
+    for (int i = 0; i < CL_COUNT; ++i) {
+        const auto& entryClass = m_classes[i];
+        const auto count = entryClass.count.load(RELAXED);
+        if (count == 0) {
+            continue;
+        }
+        const auto bytes = entryClass.bytes.load(RELAXED);
+        const auto compressed = entryClass.compressedBytes.load(RELAXED);
+        classes.insert(CLASS_NAMES[i], QJsonObject {
+            { "entries", static_cast<qint64>(count) },
+            { "bytes", static_cast<qint64>(bytes) },
+            { "compressed_bytes", static_cast<qint64>(compressed) },
+            { "ratio", bytes > 0 ? static_cast<double>(compressed) / bytes : 0 }
+        });
+    }
+
+    //Utilisation is the part of the job wall time the workers spent on their jobs rather than waiting
+    const int workers = qMin(m_workers.load(RELAXED), MAX_METRICS_WORKERS);
+    QJsonArray busy;
+    int64_t totalBusy = 0;
+    for (int i = 0; i < workers; ++i) {
+        const auto nsecs = m_busy[i].load(RELAXED);
+        busy.append(seconds(nsecs));
+        totalBusy += nsecs;
+    }
+
+    const QJsonObject report {
+        { "job", m_job },
+        { "success", success },
+        { "wall_s", seconds(wall) },
+        { "cpu_user_s", seconds(finished.userTime - m_started.userTime) },
+        { "cpu_system_s", seconds(finished.systemTime - m_started.systemTime) },
+        { "read_syscalls", delta(m_started.readCalls, finished.readCalls) },
+        { "write_syscalls", delta(m_started.writeCalls, finished.writeCalls) },
+        { "storage_read_bytes", delta(m_started.readBytes, finished.readBytes) },
+        { "storage_write_bytes", delta(m_started.writeBytes, finished.writeBytes) },
+        { "phases", phases },
+        { "entries", classes },
+        { "workers", QJsonObject {
+            { "count", workers },
+            { "busy_s", busy },
+            { "utilisation", workers > 0 && wall > 0 ? static_cast<double>(totalBusy) / wall / workers : 0 }
+        } }
+    };
+
+    {
+        QMutexLocker lock(&m_mutex);
+        m_report = QJsonDocument(report).toJson(QJsonDocument::Compact);
+    }
+    Tracer::dump(m_job);
+}
+
+QByteArray Metrics::report() const {
+    QMutexLocker lock(&m_mutex);
+    return m_report;
+}
+
+void Metrics::add(Phases phase, int64_t wallNsecs, int64_t cpuNsecs, uint64_t bytes) {
+    auto& stats = m_phases[phase];
+    stats.wall.fetch_add(wallNsecs, RELAXED);
+    stats.cpu.fetch_add(cpuNsecs, RELAXED);
+    stats.bytes.fetch_add(bytes, RELAXED);
+    stats.calls.fetch_add(1, RELAXED);
+}
+
+void Metrics::addEntry(EntryClasses entryClass, uint64_t size, uint64_t compressedSize) {
+    auto& stats = m_classes[entryClass];
+    stats.count.fetch_add(1, RELAXED);
+    stats.bytes.fetch_add(size, RELAXED);
+    stats.compressedBytes.fetch_add(compressedSize, RELAXED);
+}
+
+void Metrics::addBusy(int worker, int64_t nsecs) {
+    m_busy[worker % MAX_METRICS_WORKERS].fetch_add(nsecs, RELAXED);
+    //Highest worker seen tells how many of them took part in the job
+    for (int workers = m_workers.load(RELAXED); workers <= worker && !m_workers.compare_exchange_weak(workers, worker + 1, RELAXED); ) {
+    }
+}
@@ -0,0 +1,114 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <QByteArray>
+#include <QElapsedTimer>
+#include <QMutex>
+#include <QString>
+#include <atomic>
+#include "tracer.h"
+
+//Workers whose busy time is reported separately, the workers beyond it share the counters
+#define MAX_METRICS_WORKERS 64
+
+//Time, bytes and calls of every phase of the archive job and the JSON report made of them once the job is over.
+//Counters are relaxed atomics updated per chunk or per entry, so the instrumentation stays on all the time
+class Metrics
+{
+public:
+    enum Phases : uint8_t {
+        PH_SCAN = 0,                    //Walking the filesystem or the archive directories, hashing the duplicates
+        PH_INDEX,                       //Reading, parsing and writing the archive index
+        PH_READ,                        //Reading the files being packed or the archive
+        PH_COMPRESS,
+        PH_DECOMPRESS,                  //Includes the page faults of the mapped archive
+        PH_WRITE,                       //Writing the archive or the restored files
+        PH_COUNT
+    };
+
+    enum EntryClasses : uint8_t {
+        CL_WHOLE_FILE = 0,              //Compressed as the single stream by the writer
+        CL_BLOCKS,                      //Split into the blocks compressed by the workers
+        CL_SOLID,                       //Member of the solid block, the block size is counted by its first member
+        CL_STORED,
+        CL_DUPLICATE,                   //References the payload of another entry
+        CL_REUSED,                      //Payload copied from the archive being updated
+        CL_COUNT
+    };
+
+    //Times the phase on the calling thread while it exists. Nested scopes are subtracted from the enclosing one,
+    //so the time of every phase is its own. The scope is also the span of the trace if the tracing is on
+    class Scope
+    {
+        Metrics& m_metrics;
+        Phases m_phase;
+        Scope* m_parent;
+        int64_t m_wall;
+        int64_t m_cpu;
+        int64_t m_nestedWall;
+        int64_t m_nestedCpu;
+        uint64_t m_bytes;
+        Tracer::Span m_span;
+
+    public:
+        Scope(Metrics& metrics, Phases phase, uint64_t bytes = 0);
+        virtual ~Scope();
+
+        void addBytes(uint64_t bytes);
+    };
+
+private:
+    struct PhaseStats {
+        std::atomic<int64_t> wall;
+        std::atomic<int64_t> cpu;
+        std::atomic<uint64_t> bytes;
+        std::atomic<uint64_t> calls;
+    };
+
+    struct ClassStats {
+        std::atomic<uint64_t> count;
+        std::atomic<uint64_t> bytes;
+        std::atomic<uint64_t> compressedBytes;
+    };
+
+    //Counters of the whole process the job deltas are taken from
+    struct ProcessStats {
+        int64_t userTime;
+        int64_t systemTime;
+        int64_t readCalls;
+        int64_t writeCalls;
+        int64_t readBytes;
+        int64_t writeBytes;
+    };
+
+    QString m_job;
+    QElapsedTimer m_timer;
+    ProcessStats m_started;
+    PhaseStats m_phases[PH_COUNT];
+    ClassStats m_classes[CL_COUNT];
+    std::atomic<int64_t> m_busy[MAX_METRICS_WORKERS];
+    std::atomic_int m_workers;
+    mutable QMutex m_mutex;
+    QByteArray m_report;
+
+    static ProcessStats processStats();
+
+public:
+    Metrics();
+    virtual ~Metrics() = default;
+
+    //Called by the thread running the job, the report of the previous job stays available until the next one is over.
+    //Finishing the job also dumps its trace
+    void start(const QString& job);
+    void finish(bool success);
+    QByteArray report() const;
+
+    void add(Phases phase, int64_t wallNsecs, int64_t cpuNsecs, uint64_t bytes);
+    void addEntry(EntryClasses entryClass, uint64_t size, uint64_t compressedSize);
+    void addBusy(int worker, int64_t nsecs);
+
+    static int64_t threadCpuTime();
+    static int64_t wallTime();
+};
+
+#endif // METRICS_H
@@ -1,177 +1,1248 @@
 #include "packer.h"
+#include <QCryptographicHash>
 #include <QDir>
 #include <QDateTime>
 #include <QDebug>
 #include <QThread>
 #include <QDirIterator>
+#include <QElapsedTimer>
+#include <QQueue>
+#include <QSaveFile>
+#include <QScopeGuard>
+#include <QSet>
+#include <QtConcurrent>
+#include <algorithm>
+#include <cmath>
 #include <cstring>
+#include "filebatch.h"
+#include "pipeline.h"
 #include "zlib.h"
 
+#define MAX_POOLED_FILE_SIZE (4 * BYTES_TO_READ)
+#define MAX_PENDING_BYTES    (64 * BYTES_TO_READ)
+#define MAX_JOBS_AHEAD       4096
+#define WORKER_BATCH_SIZE    16
+#define ENTROPY_SAMPLE_SIZE  65536
+#define MAX_ENTROPY_TO_DEFLATE 7.5
+#define MIN_DICTIONARY_SAMPLES 64
+#define MAX_DICTIONARY_SAMPLES 16384
+#define MAX_DICTIONARY_SAMPLES_SIZE (16 * BYTES_TO_READ)
+#define DEFAULT_TARGET_THROUGHPUT 100
+#define WRITER_SLOT          0
+
+namespace {
+    //Small files and every file split into independent blocks are compressed on the worker pool,
+    //large single block files are streamed by the writer itself
+    bool isPooled(const FileScanner::Entry& info, uint32_t blockSize) {
+        return info.isFile() && info.size() > 0 && (blockSize > 0 || info.size() <= MAX_POOLED_FILE_SIZE);
+    }
+
+    //Formats compressed already, deflate gains nothing on them
+    bool hasIncompressibleSuffix(const FileScanner::Entry& info) {
+        static const QSet<QString> suffixes {
+            "jpg", "jpeg", "png", "gif", "webp", "heic", "avif",
+            "gz", "tgz", "bz2", "xz", "txz", "zst", "lz4", "7z", "zip", "rar", "jar", "apk", "sar",
+            "mp3", "m4a", "aac", "ogg", "opus", "flac", "mp4", "m4v", "mkv", "webm", "avi", "mov",
+            "docx", "xlsx", "pptx", "odt", "ods", "odp", "epub", "woff", "woff2"
+        };
+        return suffixes.contains(info.suffix().toLower());
+    }
+
+    //Checks the head of the file for the magic of the compressed formats, then for the byte entropy close to the random data
+    bool hasIncompressibleData(const QByteArray& head) {
+        struct Magic {
+            int offset;
+            const char* bytes;
+            int size;
+        };
+        static const Magic magics[] {
+            { 0, "\x1f\x8b", 2 }, { 0, "PK\x03\x04", 4 }, { 0, "\x89PNG", 4 }, { 0, "\xff\xd8\xff", 3 }, { 0, "BZh", 3 },
+            { 0, "\xfd" "7zXZ", 5 }, { 0, "\x28\xb5\x2f\xfd", 4 }, { 0, "7z\xbc\xaf\x27\x1c", 6 }, { 0, "Rar!", 4 },
+            { 0, "\x04\x22\x4d\x18", 4 }, { 0, "OggS", 4 }, { 0, "fLaC", 4 }, { 0, "GIF8", 4 }, { 4, "ftyp", 4 }
+        };
+        for (const auto& magic: magics) {
+            if (head.size() >= magic.offset + magic.size && memcmp(head.constData() + magic.offset, magic.bytes, magic.size) == 0) {
+                return true;
+            }
+        }
+
+        const int sampleSize = qMin(head.size(), ENTROPY_SAMPLE_SIZE);
+        if (sampleSize < DEFLATE_WINDOW_SIZE) {
+            return false;
+        }
+        uint32_t counts[256] = { };
+        for (int i = 0; i < sampleSize; ++i) {
+            ++counts[static_cast<uint8_t>(head.at(i))];
+        }
+        double entropy = 0;
+        for (const auto count: counts) {
+            if (count > 0) {
+                const double p = static_cast<double>(count) / sampleSize;
+                entropy -= p * std::log2(p);
+            }
+        }
+        return entropy > MAX_ENTROPY_TO_DEFLATE;
+    }
+
+    bool isIncompressible(const FileScanner::Entry& info, const QString& filePath, const QByteArray& head) {
+        if (hasIncompressibleSuffix(info)) {
+            return true;
+        }
+        if (!head.isNull()) {
+            return hasIncompressibleData(head);
+        }
+        QFile f(filePath);
+        return f.open(QIODevice::ReadOnly) && hasIncompressibleData(f.read(ENTROPY_SAMPLE_SIZE));
+    }
+
+    bool isSolidMember(const FileScanner::Entry& info, bool detectIncompressible) {
+        return info.isFile() && info.size() > 0 && info.size() <= MAX_SOLID_ENTRY_SIZE && !(detectIncompressible && hasIncompressibleSuffix(info));
+    }
+
+    //Files small enough to gain from the preset dictionary, each one is the single block
+    bool isDictionaryEntry(const FileScanner::Entry& info) {
+        return info.isFile() && info.size() > 0 && info.size() <= MAX_DICTIONARY_ENTRY_SIZE;
+    }
+}
+
+namespace {
+    struct DeflatedChunk {
+        QByteArray data;
+        uLong adler;                    //Goes to the zlib stream trailer whatever the checksum of the archive is
+        uint32_t checksum;
+        uLong size;
+        bool ok;                        //Cleared if zlib failed, the data can't be joined to the stream then
+    };
+
+    //Deflates chunk as a raw deflate stream part, primed with the tail of the previous chunk as a dictionary.
+    //All the chunks except the last one are ended with sync flush, so they could be concatenated into the one stream
+    DeflatedChunk deflateChunk(const QByteArray& chunk, const QByteArray& previous, int level, ArchiveBase::ChecksumTypes checksumType, bool last) {
+        const uLong adler = Checksum::compute(ArchiveBase::CS_ADLER32, chunk.constData(), chunk.size());
+        const uint32_t checksum = checksumType == ArchiveBase::CS_ADLER32 ? adler : Checksum::compute(checksumType, chunk.constData(), chunk.size());
+        DeflatedChunk result { QByteArray(), adler, checksum, static_cast<uLong>(chunk.size()), false };
+
+        z_stream zlibstream;
+        zlibstream.zalloc = Z_NULL;
+        zlibstream.zfree = Z_NULL;
+        zlibstream.opaque = Z_NULL;
+        auto err = deflateInit2(&zlibstream, level, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY);
+        if (err != Z_OK) {
+            qDebug() << QString("deflateInit2 failed: %1").arg(err);
+            return result;
+        }
+        if (!previous.isEmpty()) {
+            const auto dictSize = qMin(previous.size(), DEFLATE_WINDOW_SIZE);
+            err = deflateSetDictionary(&zlibstream, reinterpret_cast<const Bytef*>(previous.constData() + previous.size() - dictSize), dictSize);
+            if (err != Z_OK) {
+                qDebug() << QString("deflateSetDictionary failed: %1").arg(err);
+                deflateEnd(&zlibstream);
+                return result;
+            }
+        }
+
+        //Sync flush marker and empty final block are not counted by deflateBound for raw streams
+        result.data.resize(deflateBound(&zlibstream, chunk.size()) + 16);
+        zlibstream.next_in = reinterpret_cast<z_const Bytef*>(const_cast<char*>(chunk.constData()));
+        zlibstream.avail_in = chunk.size();
+        zlibstream.next_out = reinterpret_cast<Bytef*>(result.data.data());
+        zlibstream.avail_out = result.data.size();
+        const int flush = last ? Z_FINISH : Z_SYNC_FLUSH;
+        do {
+            if (zlibstream.avail_out == 0) {
+                const auto used = result.data.size();
+                result.data.resize(used * 2);
+                zlibstream.next_out = reinterpret_cast<Bytef*>(result.data.data() + used);
+                zlibstream.avail_out = used;
+            }
+            err = deflate(&zlibstream, flush);
+        } while (err == Z_OK && zlibstream.avail_out == 0);
+        //Flush that had nothing left to write reports the buffer error, the chunk is complete all the same
+        result.ok = last ? err == Z_STREAM_END : (err == Z_OK || err == Z_BUF_ERROR) && zlibstream.avail_in == 0;
+        if (!result.ok) {
+            qDebug() << QString("deflate failed: %1").arg(err);
+        }
+        result.data.resize(zlibstream.total_out);
+        deflateEnd(&zlibstream);
+        return result;
+    }
+
+    QByteArray zlibHeader(int level) {
+        //Reproduces the header deflateInit would write for the default window size
+        const int levelFlags = level < 2 ? 0 : level < 6 ? 1 : level == 6 ? 2 : 3;
+        int header = ((Z_DEFLATED + ((MAX_WBITS - 8) << 4)) << 8) | (levelFlags << 6);
+        header += 31 - (header % 31);
+        const char bytes[] { static_cast<char>(header >> 8), static_cast<char>(header & 0xff) };
+        return QByteArray(bytes, sizeof (bytes));
+    }
+}
+
+Packer::PackState::PackState(const FileScanner& e, const Codec* c, const Codec::Dictionary* d, CompressionLevels l, ChecksumTypes cs, bool detect, int workers) :
+    entries(e),
+    codec(c),
+    dictionary(d),
+    level(l),
+    checksumType(cs),
+    detectIncompressible(detect),
+    controller(nullptr),
+    queue(workers),
+    cores(workers),
+    nextToWrite(0),
+    pendingBytes(0),
+    planned(false),
+    stop(false)
+{
+
+}
+
 Packer::Packer(std::atomic_bool& cancel, QObject* parent) :
     ArchiveBase(parent),
-    m_cancelOperation(cancel)
+    m_cancelOperation(cancel),
+    m_targetThroughput(DEFAULT_TARGET_THROUGHPUT),
+    m_timeBudget(0)
 {
 
 }
 
-//Result is an overall entries size for root entry
-uint32_t Packer::prepareEntries(const QString& dirPath, const QFileInfoList& entries, QList<Packer::Entry>& result) {
-    uint32_t overall_size = 0;
-    for (const auto& entry: entries) {
-        if (m_cancelOperation) {
-            break;
+void Packer::setTargetThroughput(uint32_t megabytesPerSecond) {
+    m_targetThroughput = megabytesPerSecond > 0 ? megabytesPerSecond : DEFAULT_TARGET_THROUGHPUT;
+}
+
+uint32_t Packer::getTargetThroughput() const {
+    return m_targetThroughput;
+}
+
+void Packer::setTimeBudget(uint32_t seconds) {
+    m_timeBudget = seconds;
+}
+
+uint32_t Packer::getTimeBudget() const {
+    return m_timeBudget;
+}
+
+const Progress& Packer::getProgress() const {
+    return m_progress;
+}
+
+const Metrics& Packer::getMetrics() const {
+    return m_metrics;
+}
+
+void Packer::findDuplicates(const FileScanner& entries, QVector<int>& duplicateOf) {
+    duplicateOf.fill(-1, entries.size());
+
+    //Only the files sharing the size with some other file could be duplicates, so only they are hashed
+    QHash<int64_t, QVector<int>> sizes;
+    for (int i = 0; i < entries.size(); ++i) {
+        const auto& info = entries.at(i);
+        if (info.isFile() && info.size() > 0) {
+            sizes[info.size()].append(i);
+        }
+    }
+    QVector<int> candidates;
+    for (const auto& sameSize: qAsConst(sizes)) {
+        if (sameSize.size() > 1) {
+            candidates.append(sameSize);
         }
-        const QString entryFileName { entry.fileName() };
-        const QString relPath { dirPath + entryFileName };
-        result.append({ relPath, entry.isDir() ? EntryTypes::ET_DIR : EntryTypes::ET_FILE, entry});
-        overall_size += sizeof (ArchEntry) + relPath.size(); //Entry size is a sizeof(ArchEntry) + length of file name
-        emit scanningFilesystem(entryFileName);
-        if (entry.isDir()) {
-            QDir d(entry.canonicalPath() + "/" + entryFileName);
-            overall_size += prepareEntries(relPath + "/", d.entryInfoList(QDir::Dirs | QDir::Files | QDir::NoDotAndDotDot, QDir::DirsFirst), result);
+    }
+    std::sort(candidates.begin(), candidates.end());
+
+    QVector<QByteArray> hashes(candidates.size());
+    std::atomic_int nextCandidate { 0 };
+    auto worker = [&]() {
+        for (int i = nextCandidate++; i < candidates.size() && !m_cancelOperation; i = nextCandidate++) {
+            QFile f(entries.filePath(candidates.at(i)));
+            QCryptographicHash hash(QCryptographicHash::Sha256);
+            if (f.open(QIODevice::ReadOnly) && hash.addData(&f)) {
+                hashes[i] = hash.result();
+            }
+        }
+    };
+    QVector<QFuture<void>> futures;
+    for (int i = 1; i < qMin(getThreadsCount(), candidates.size()); ++i) {
+        futures.append(QtConcurrent::run(&m_workers, worker));
+    }
+    worker();
+    for (auto& future: futures) {
+        future.waitForFinished();
+    }
+
+    //Candidates are in the entries order, so the first of the equal files is the one storing the payload
+    QHash<QByteArray, int> firstEntries;
+    for (int i = 0; i < candidates.size() && !m_cancelOperation; ++i) {
+        if (hashes.at(i).isEmpty()) {
+            continue;
+        }
+        const auto size { entries.at(candidates.at(i)).size() };
+        const QByteArray key { hashes.at(i) + QByteArray::number(static_cast<qlonglong>(size)) };
+        const auto it = firstEntries.constFind(key);
+        if (it == firstEntries.constEnd()) {
+            firstEntries.insert(key, candidates.at(i));
+        } else {
+            duplicateOf[candidates.at(i)] = it.value();
         }
     }
-    return overall_size;
 }
 
-Packer::FileResult Packer::compressFile(/*QByteArray& buf*/QFile& outFile, const QFileInfo& entry, CompressionLevels level) {
-    emit fileProgress(entry.fileName(), 0, 0);
-    if (entry.isDir() || entry.size() == 0) {
-        return {0, 0, 0};
+QByteArray Packer::trainDictionary(const FileScanner& entries, const QVector<int>& duplicateOf, bool solid, bool detectIncompressible) {
+    //Members of the solid blocks don't need the dictionary, they share the window anyway
+    QVector<int> candidates;
+    for (int i = 0; i < entries.size(); ++i) {
+        const auto& info = entries.at(i);
+        if (duplicateOf.value(i, -1) < 0 && isDictionaryEntry(info) && !(solid && isSolidMember(info, detectIncompressible)) &&
+                !(detectIncompressible && hasIncompressibleSuffix(info))) {
+            candidates.append(i);
+        }
+    }
+    if (candidates.size() < MIN_DICTIONARY_SAMPLES) {
+        return QByteArray();
+    }
+
+    //Samples are spread over all the entries, as the similar files are usually next to each other
+    QByteArray samples;
+    QVector<size_t> sampleSizes;
+    const int step = qMax(1, candidates.size() / MAX_DICTIONARY_SAMPLES);
+    for (int i = 0; i < candidates.size() && samples.size() < MAX_DICTIONARY_SAMPLES_SIZE && !m_cancelOperation; i += step) {
+        QFile f(entries.filePath(candidates.at(i)));
+        const auto data { f.open(QIODevice::ReadOnly) ? f.read(MAX_DICTIONARY_ENTRY_SIZE) : QByteArray() };
+        if (!data.isEmpty()) {
+            samples.append(data);
+            sampleSizes.append(data.size());
+        }
+    }
+    if (sampleSizes.size() < MIN_DICTIONARY_SAMPLES || m_cancelOperation) {
+        return QByteArray();
+    }
+    return Codec::trainDictionary(samples, sampleSizes);
+}
+
+void Packer::findUnchanged(const FileScanner& entries, const QVector<ArchiveReader::FileInfo>& previousEntries, ChecksumTypes checksumType, bool compareChecksum, QVector<int>& reusedFrom) {
+    reusedFrom.fill(-1, entries.size());
+
+    QHash<QString, int> previousNames;
+    for (int i = 0; i < previousEntries.size(); ++i) {
+        previousNames.insert(previousEntries.at(i).getFileName(), i);
+    }
+    QVector<int> candidates;
+    for (int i = 0; i < entries.size(); ++i) {
+        const auto& entry = entries.at(i);
+        if (!entry.isFile()) {
+            continue;
+        }
+        const auto it = previousNames.constFind(entries.relativePath(i));
+        if (it == previousNames.constEnd()) {
+            continue;
+        }
+        //Payloads compressed with the dictionary of the previous archive couldn't be reused
+        const auto& archEntry = previousEntries.at(it.value()).getArchEntry();
+        if (archEntry.entry_type == ET_FILE && !previousEntries.at(it.value()).usesDictionary() && archEntry.uncompressed_size == static_cast<uint64_t>(entry.size()) &&
+                archEntry.file_time == static_cast<uint64_t>(entry.modified)) {
+            reusedFrom[i] = it.value();
+            candidates.append(i);
+        }
+    }
+    if (!compareChecksum) {
+        return;
+    }
+
+    //Files matching by size and time are read through to be sure, it is still much cheaper than compressing them
+    std::atomic_int nextCandidate { 0 };
+    auto worker = [&]() {
+        QByteArray fileBuf(BYTES_TO_READ, Qt::Initialization::Uninitialized);
+        for (int i = nextCandidate++; i < candidates.size() && !m_cancelOperation; i = nextCandidate++) {
+            const int entry = candidates.at(i);
+            QFile f(entries.filePath(entry));
+            Checksum checksum(checksumType);
+            bool readable = f.open(QIODevice::ReadOnly);
+            for (int64_t size = readable ? f.read(fileBuf.data(), fileBuf.size()) : 0; size > 0; size = f.read(fileBuf.data(), fileBuf.size())) {
+                checksum.update(fileBuf.constData(), size);
+            }
+            if (!readable || checksum.value() != previousEntries.at(reusedFrom.at(entry)).getArchEntry().checksum) {
+                reusedFrom[entry] = -1;
+            }
+        }
+    };
+    QVector<QFuture<void>> futures;
+    for (int i = 1; i < qMin(getThreadsCount(), candidates.size()); ++i) {
+        futures.append(QtConcurrent::run(&m_workers, worker));
+    }
+    worker();
+    for (auto& future: futures) {
+        future.waitForFinished();
+    }
+}
+
+bool Packer::copyPayload(QFile& from, uint64_t offset, uint64_t size, QIODevice& to) {
+    if (!from.seek(offset)) {
+        return false;
+    }
+    QByteArray buf;
+    for (uint64_t bytesDone = 0; bytesDone < size; bytesDone += buf.size()) {
+        buf = from.read(qMin((uint64_t) BYTES_TO_READ, size - bytesDone));
+        if (buf.isEmpty() || to.write(buf) != buf.size()) {
+            return false;
+        }
     }
+    return true;
+}
 
-    QFile f(entry.canonicalFilePath());
-    QByteArray fileBuf;
-    QByteArray packBuf(BYTES_TO_READ, Qt::Initialization::Uninitialized);
-    f.open(QIODevice::ReadOnly);
-    fileBuf = f.read(BYTES_TO_READ);
-    uLong inBufLen = fileBuf.size();
-    uLong packBufLen = packBuf.size();
-    uint32_t actualFileSize = f.size();
-
-    z_stream zlibstream;
-    zlibstream.zalloc = Z_NULL;
-    zlibstream.zfree = Z_NULL;
-    zlibstream.opaque = Z_NULL;
-
-    zlibstream.next_in = reinterpret_cast<z_const Bytef*>(fileBuf.data());
-    zlibstream.avail_in = inBufLen;
-    zlibstream.next_out = reinterpret_cast<Bytef*>(packBuf.data());
-    zlibstream.avail_out = packBufLen;
-    auto err = deflateInit(&zlibstream, (int) level);
-    if (err != Z_OK) {
-        qDebug() << QString("deflateInit failed: %1").arg(err);
+Packer::FileResult Packer::compressFile(/*QByteArray& buf*/QIODevice& outFile, const QString& filePath, const Codec* codec, CompressionLevels level, ChecksumTypes checksumType, bool& written) {
+    written = true;
+    QFile f(filePath);
+    if (!f.open(QIODevice::ReadOnly)) {
         return {0, 0, 0};
     }
+    QScopedPointer<Codec::Encoder> encoder(codec->createEncoder(level, checksumType, nullptr));
+    //Large file is read ahead and its output is written behind, so the disk and the codec work at the same time
+    const bool pipelined = f.size() >= MIN_PIPELINED_SIZE;
+    ReadAhead reader(f, -1, BYTES_TO_READ, pipelined, m_metrics);
+    WriteBehind writer(outFile, BYTES_TO_READ, pipelined, m_metrics);
+    uint64_t bytesRead = 0;
+    uint64_t actualCompressedSize = 0;
+    const auto sink = [&writer, &actualCompressedSize](const char* data, size_t size) {
+        actualCompressedSize += size;
+        return writer.write(data, size);
+    };
+
+    PipelineChunk chunk { QByteArray(), 0, false };
+    bool result = true;
+    bool last = false;
+    while (result && !last && !m_cancelOperation && reader.next(chunk)) {
+        last = chunk.last;
+        const uint64_t compressedBefore = actualCompressedSize;
+        {
+            Metrics::Scope compress(m_metrics, Metrics::PH_COMPRESS, chunk.size);
+            result = encoder->encode(chunk.data.constData(), chunk.size, last, sink);
+        }
+        bytesRead += chunk.size;
+        m_progress.advance(WRITER_SLOT, chunk.size);
+        m_progress.addBytes(chunk.size, actualCompressedSize - compressedBefore);
+        reader.recycle(chunk);
+    }
+    //Payload the codec failed on is incomplete just as the one the device failed to take
+    written = writer.finish() && result;
 
-    uint64_t bytesRead = inBufLen;
-    uint32_t actualCompressedSize = 0;
-    do {
-        if (m_cancelOperation) {
+    qDebug() << "Compressing" << filePath << (written && last);
+    return {encoder->checksum(), bytesRead, actualCompressedSize};
+}
+
+Packer::FileResult Packer::storeFile(QIODevice& outFile, const QString& filePath, ChecksumTypes checksumType, bool& written) {
+    written = true;
+    QFile f(filePath);
+    if (!f.open(QIODevice::ReadOnly)) {
+        return {0, 0, 0};
+    }
+    const bool pipelined = f.size() >= MIN_PIPELINED_SIZE;
+    ReadAhead reader(f, -1, BYTES_TO_READ, pipelined, m_metrics);
+    WriteBehind writer(outFile, BYTES_TO_READ, pipelined, m_metrics);
+    Checksum checksum(checksumType);
+    uint64_t bytesRead = 0;
+    PipelineChunk chunk { QByteArray(), 0, false };
+    while (!m_cancelOperation && reader.next(chunk) && chunk.size > 0) {
+        checksum.update(chunk.data.constData(), chunk.size);
+        if (!writer.write(chunk.data.constData(), chunk.size)) {
             break;
         }
-        int flush = inBufLen == BYTES_TO_READ && !f.atEnd() ? Z_NO_FLUSH : Z_FINISH;
-        err = deflate(&zlibstream, flush);
-        if (err == Z_OK || err == Z_STREAM_END) {
-            //Input buffer runs out, storing compressed data
-            auto compressedSize = packBufLen - zlibstream.avail_out;
-            outFile.write(packBuf.data(), compressedSize);
-            actualCompressedSize += compressedSize;
+        bytesRead += chunk.size;
+        m_progress.advance(WRITER_SLOT, chunk.size);
+        m_progress.addBytes(chunk.size, chunk.size);
+        reader.recycle(chunk);
+    }
+    written = writer.finish();
+    qDebug() << "Storing" << filePath << written;
+    return {checksum.value(), bytesRead, bytesRead};
+}
+
+Packer::FileResult Packer::compressFileParallel(QIODevice& outFile, const QString& filePath, CompressionLevels level, ChecksumTypes checksumType, QSemaphore& cores, bool& written) {
+    written = true;
+    QFile f(filePath);
+    if (!f.open(QIODevice::ReadOnly)) {
+        return {0, 0, 0};
+    }
+    uint64_t actualFileSize = f.size();
+
+    const auto header { zlibHeader(level) };
+    written = outFile.write(header) == header.size();
+    uint64_t actualCompressedSize = header.size();
+    uLong adler = adler32(0, Z_NULL, 0);
+    uint32_t checksum = Checksum::initial(checksumType);
+
+    //Keep at most two chunks per worker in flight to bound memory usage
+    const int maxInFlight = getThreadsCount() * 2;
+    QQueue<QFuture<DeflatedChunk>> inFlight;
+    auto writeChunk = [&]() {
+        const auto chunk { inFlight.dequeue().result() };
+        //Nothing is written after the chunk that failed, the file is given up on
+        written = chunk.ok && written;
+        if (!written) {
+            return;
+        }
+        {
+            Metrics::Scope write(m_metrics, Metrics::PH_WRITE, chunk.data.size());
+            written = outFile.write(chunk.data) == chunk.data.size() && written;
+        }
+        actualCompressedSize += chunk.data.size();
+        adler = adler32_combine(adler, chunk.adler, chunk.size);
+        checksum = Checksum::combine(checksumType, checksum, chunk.checksum, chunk.size);
+        m_progress.advance(WRITER_SLOT, chunk.size);
+        m_progress.addBytes(chunk.size, chunk.data.size());
+    };
+
+    QByteArray previous;
+    bool last = false;
+    while (!last && !m_cancelOperation && written) {
+        QByteArray chunk;
+        {
+            Metrics::Scope read(m_metrics, Metrics::PH_READ);
+            chunk = f.read(BYTES_TO_READ);
+            read.addBytes(chunk.size());
+        }
+        last = chunk.size() < BYTES_TO_READ || f.atEnd();
+        //Chunks take the cores the entry workers aren't using, so both pools together stay within the threads asked for
+        inFlight.enqueue(QtConcurrent::run(&m_workers, [this, chunk, previous, level, checksumType, last, &cores]() {
+            cores.acquire();
+            Metrics::Scope compress(m_metrics, Metrics::PH_COMPRESS, chunk.size());
+            const auto deflated = deflateChunk(chunk, previous, static_cast<int>(level), checksumType, last);
+            cores.release();
+            return deflated;
+        }));
+        previous = chunk;
+        while (inFlight.size() >= maxInFlight) {
+            writeChunk();
+        }
+    }
+    while (!inFlight.isEmpty()) {
+        writeChunk();
+    }
+
+    //zlib stream trailer is an adler32 of the uncompressed data, stored in big-endian order
+    const char trailer[] { static_cast<char>(adler >> 24), static_cast<char>(adler >> 16), static_cast<char>(adler >> 8), static_cast<char>(adler) };
+    written = outFile.write(trailer, sizeof (trailer)) == sizeof (trailer) && written;
+    actualCompressedSize += sizeof (trailer);
+
+    f.close();
+    qDebug() << "Compressing" << filePath << "in parallel" << (last && written);
+    return {checksum, actualFileSize, actualCompressedSize};
+}
+
+Packer::FileResult Packer::compressBuffer(const QByteArray& data, const Codec* codec, const Codec::Dictionary* dictionary, CompressionLevels level, ChecksumTypes checksumType, QByteArray& out, bool& ok) {
+    uint32_t checksum = 0;
+    ok = codec->compress(data.constData(), data.size(), level, checksumType, dictionary, out, checksum);
+    if (!ok) {
+        out.clear();
+        return {0, 0, 0};
+    }
+    return {checksum, static_cast<uint64_t>(data.size()), static_cast<uint64_t>(out.size())};
+}
+
+bool Packer::isStoredEntry(PackState& state, int entry, const QByteArray& head) {
+    if (state.level == C_NO_COMPRESSION) {
+        return true;
+    }
+    if (!state.detectIncompressible) {
+        return false;
+    }
+    {
+        QMutexLocker lock(&state.mutex);
+        const auto it = state.methods.constFind(entry);
+        if (it != state.methods.constEnd()) {
+            return it.value() == CM_STORE;
+        }
+    }
+    //All the blocks of the entry have to be stored the same way, so the decision is always made by the head of the file
+    const bool store = isIncompressible(state.entries.at(entry), state.entries.filePath(entry), head);
+    QMutexLocker lock(&state.mutex);
+    if (!state.methods.contains(entry)) {
+        state.methods.insert(entry, store ? CM_STORE : CM_DEFLATE);
+    }
+    return state.methods.value(entry) == CM_STORE;
+}
+
+ArchiveBase::CompressionLevels Packer::entryLevel(PackState& state, int entry) {
+    if (!state.controller) {
+        return state.level;
+    }
+    //Level is stored per entry, so all of its blocks are compressed with the one picked for the first of them
+    QMutexLocker lock(&state.mutex);
+    if (!state.levels.contains(entry)) {
+        state.levels.insert(entry, state.controller->level());
+    }
+    return static_cast<CompressionLevels>(state.levels.value(entry));
+}
+
+bool Packer::takeJob(PackState& state, int worker, int& job) {
+    if (state.queue.pop(worker, job)) {
+        return true;
+    }
+    //Writer queues the jobs before it takes the lock to wake the workers, so the job queued meanwhile is found here
+    QMutexLocker lock(&state.mutex);
+    while (!state.stop) {
+        if (state.queue.pop(worker, job)) {
+            return true;
+        }
+        if (state.planned) {
+            return false;
+        }
+        state.jobsAdded.wait(&state.mutex);
+    }
+    return false;
+}
 
-            bool needRead = err == Z_OK;
-            if (needRead && zlibstream.avail_out == 0) {
-                unsigned pending = 0;
-                int bits = 0;
-                err = deflatePending(&zlibstream, &pending, &bits);
-                needRead = !pending && !bits;
+void Packer::compressWorker(int worker, PackState& state) {
+    //Buffers are kept per worker and reused for all the blocks it compresses
+    QByteArray readBuf;
+    QVector<FileBatch::ReadFile> members;
+    QElapsedTimer timer;
+    int jobIndex;
+    const int slot = WRITER_SLOT + 1 + worker;
+    auto guard = qScopeGuard([this, slot]() { m_progress.clearEntry(slot); });
+    while (!m_cancelOperation && takeJob(state, worker, jobIndex)) {
+        BlockJob job;
+        {
+            //Don't run too far ahead of the writer, otherwise compressed payloads pile up in memory.
+            //The block the writer waits for is always allowed to proceed
+            QMutexLocker lock(&state.mutex);
+            job = state.jobs.at(jobIndex);
+            Tracer::Span wait("wait_writer");
+            while (!state.stop && jobIndex != state.nextToWrite && (jobIndex - state.nextToWrite >= MAX_JOBS_AHEAD || state.pendingBytes >= MAX_PENDING_BYTES)) {
+                state.writerProgressed.wait(&state.mutex);
+            }
+            if (state.stop) {
+                return;
             }
+            state.pendingBytes += job.size;
+        }
+        state.cores.acquire();
+        bool compressed = true;
+        //Solid block is shown as its first member
+        m_progress.setEntry(slot, job.entry, job.offset, job.lastEntry > job.entry ? job.size : state.entries.at(job.entry).size());
+        const int64_t busySince = Metrics::wallTime();
 
-            zlibstream.next_out = reinterpret_cast<Bytef*>(packBuf.data());
-            zlibstream.avail_out = packBufLen;
-            if (needRead && zlibstream.avail_in == 0 && !f.atEnd()) {
-                fileBuf = f.read(BYTES_TO_READ);
-                inBufLen = fileBuf.size();
-                zlibstream.next_in = reinterpret_cast<z_const Bytef*>(fileBuf.data());
-                zlibstream.avail_in = inBufLen;
-                bytesRead += inBufLen;
+        CompressedEntry result { QByteArray(), {0, 0, 0}, QVector<FileResult>(), state.level, false, true, false };
+        if (job.lastEntry > job.entry) {
+            //Solid block is made of the member files read one after another, each one no longer than it was while scanning
+            Metrics::Scope read(m_metrics, Metrics::PH_READ);
+            members.resize(0);
+            int64_t total = 0;
+            for (int i = job.entry; i <= job.lastEntry; ++i) {
+                const auto& info = state.entries.at(i);
+                if (isSolidMember(info, state.detectIncompressible) && state.duplicateOf.value(i, -1) < 0 && state.reusedFrom.value(i, -1) < 0) {
+                    members.append({ QFile::encodeName(state.entries.filePath(i)), nullptr, info.size(), 0 });
+                    total += info.size();
+                }
+            }
+            readBuf.resize(total);
+            total = 0;
+            for (auto& member: members) {
+                member.data = readBuf.data() + total;
+                total += member.size;
+            }
+            //Small members are opened, read and closed in batches where io_uring is there, one by one otherwise
+            if (!FileBatch::read(members)) {
+                for (auto& member: members) {
+                    QFile f(QFile::decodeName(member.path));
+                    member.done = f.open(QIODevice::ReadOnly) ? qMax<int64_t>(f.read(member.data, member.size), 0) : 0;
+                }
+            }
+            //Members shorter than they were while scanning are moved up to the previous ones
+            int64_t end = 0;
+            for (const auto& member: qAsConst(members)) {
+                memmove(readBuf.data() + end, member.data, member.done);
+                const uint64_t size = member.done;
+                result.members.append({ Checksum::compute(state.checksumType, readBuf.constData() + end, size), size, 0 });
+                end += member.done;
+            }
+            readBuf.resize(end);
+            read.addBytes(readBuf.size());
+            result.level = state.controller ? state.controller->level() : state.level;
+            timer.start();
+            {
+                Metrics::Scope compress(m_metrics, Metrics::PH_COMPRESS, readBuf.size());
+                result.result = compressBuffer(readBuf, state.codec, nullptr, result.level, state.checksumType, result.payload, compressed);
+            }
+            if (state.controller) {
+                state.controller->report(result.level, result.result.fileSize, result.result.compressedSize, timer.nsecsElapsed());
+            }
+        } else {
+            //Nothing is read from the file that can't be opened, so the block is left empty and isn't written
+            QFile f(state.entries.filePath(job.entry));
+            if (f.open(QIODevice::ReadOnly) && f.seek(job.offset)) {
+                {
+                    Metrics::Scope read(m_metrics, Metrics::PH_READ);
+                    readBuf.resize(job.size);
+                    readBuf.resize(qMax<int64_t>(f.read(readBuf.data(), job.size), 0));
+                    read.addBytes(readBuf.size());
+                }
+                f.close();
+                result.stored = isStoredEntry(state, job.entry, job.offset == 0 ? readBuf : QByteArray());
+                if (result.stored) {
+                    result.payload = readBuf;
+                    result.result = { Checksum::compute(state.checksumType, readBuf.constData(), readBuf.size()), static_cast<uint64_t>(readBuf.size()), static_cast<uint64_t>(readBuf.size()) };
+                } else {
+                    const auto& info = state.entries.at(job.entry);
+                    const auto* dictionary = isDictionaryEntry(info) ? state.dictionary : nullptr;
+                    result.level = entryLevel(state, job.entry);
+                    timer.start();
+                    Metrics::Scope compress(m_metrics, Metrics::PH_COMPRESS, readBuf.size());
+                    result.result = compressBuffer(readBuf, state.codec, dictionary, result.level, state.checksumType, result.payload, compressed);
+                    if (state.controller) {
+                        state.controller->report(result.level, result.result.fileSize, result.result.compressedSize, timer.nsecsElapsed());
+                    }
+                }
             }
-            emit fileProgress(entry.fileName(), bytesRead, actualFileSize);
         }
-    } while (err == Z_OK);
 
-    deflateEnd(&zlibstream);
-    f.close();
-    qDebug() << "Compressing" << entry.fileName() << (err == Z_STREAM_END);
-    return {zlibstream.adler, actualFileSize, actualCompressedSize};
+        m_progress.advance(slot, job.size);
+        m_metrics.addBusy(worker, Metrics::wallTime() - busySince);
+        state.cores.release();
+        result.failed = !compressed;
+
+        QMutexLocker lock(&state.mutex);
+        state.results[jobIndex] = result;
+        state.entryCompressed.wakeAll();
+    }
+}
+
+void Packer::pack(QString archiveName, CompressionLevels level, ArchiveBase::CompressionMethods method, ArchiveBase::ChecksumTypes checksumType, ArchiveBase::PackOptions options, QFileInfoList entries) {
+    packArchive(nullptr, archiveName, level, method, checksumType, options, entries);
 }
 
-void Packer::pack(QString archiveName, CompressionLevels level, QFileInfoList entries) {
-        QVector<Packer::RelativePathEntry> result;
-        uint32_t numEntries = 0;
-        uint32_t entriesSize = 0;
+void Packer::packStream(QIODevice& stream, CompressionLevels level, ArchiveBase::CompressionMethods method, ArchiveBase::ChecksumTypes checksumType, ArchiveBase::PackOptions options, QFileInfoList entries) {
+    //There is no archive to update in the stream
+    options.setFlag(PO_UPDATE, false);
+    options.setFlag(PO_UPDATE_CHECKSUM, false);
+    packArchive(&stream, QString(), level, method, checksumType, options, entries);
+}
 
+void Packer::packArchive(QIODevice* stream, const QString& archiveName, CompressionLevels level, CompressionMethods method, ChecksumTypes checksumType, PackOptions options, const QFileInfoList& entries) {
+        m_metrics.start(stream ? "pack_stream" : "pack");
+        m_progress.startScanning();
         emit packerStateChanged(ArchiverStates::PS_SCANNING_FILESYSTEM);
 
-        for (const auto& e: entries) {
-            result.append({e.canonicalPath(), { }});
-            auto& item = result.last();
-            entriesSize += prepareEntries(QString(), { e }, item.entries);
-            numEntries += item.entries.count();
+        //Duplicates, unchanged files, the dictionary and the time budget need all the entries found first,
+        //otherwise the entries are compressed while the rest of them are still being found.
+        //Scanner is shared with the progress observers, as they resolve the entry names through it
+        const int threads = getThreadsCount();
+        const bool wholeScan = options.testFlag(PO_DEDUPLICATE) || options.testFlag(PO_UPDATE) ||
+                               (level != C_NO_COMPRESSION && (options.testFlag(PO_DICTIONARY) || (options.testFlag(PO_ADAPTIVE_LEVEL) && m_timeBudget > 0)));
+        QSharedPointer<FileScanner> scanner(new FileScanner(m_cancelOperation, m_progress, m_metrics));
+        const FileScanner& packedEntries = *scanner;
+        scanner->start(entries, threads);
+        if (wholeScan) {
+            scanner->wait();
+        }
+
+        //Content is hashed as a part of the scanning, so the duplicates are neither compressed nor stored
+        QVector<int> duplicateOf;
+        QSet<int> duplicated;
+        if (options.testFlag(PO_DEDUPLICATE)) {
+            Metrics::Scope scan(m_metrics, Metrics::PH_SCAN);
+            findDuplicates(packedEntries, duplicateOf);
+            for (const auto original: qAsConst(duplicateOf)) {
+                if (original >= 0) {
+                    duplicated.insert(original);
+                }
+            }
+        }
+
+        //Unchanged files of the archive being updated keep their compressed payloads
+        QFile previous(archiveName);
+        QVector<ArchiveReader::FileInfo> previousEntries;
+        QVector<int> reusedFrom;
+        if (!Checksum::isSupported(checksumType)) {
+            checksumType = CS_ADLER32;
+        }
+        ArchiveReader::ArchiveInfo previousInfo;
+        bool update = false;
+        if (options.testFlag(PO_UPDATE)) {
+            Metrics::Scope index(m_metrics, Metrics::PH_INDEX);
+            update = previous.open(QIODevice::ReadOnly) && ArchiveReader::readIndex(previous, previousEntries, &previousInfo);
+        }
+        //Payloads are reused only if their checksums are of the same algorithm as the new ones
+        if (update && previousInfo.checksumType == checksumType) {
+            Metrics::Scope scan(m_metrics, Metrics::PH_SCAN);
+            findUnchanged(packedEntries, previousEntries, checksumType, options.testFlag(PO_UPDATE_CHECKSUM), reusedFrom);
         }
 
+        //Totals grow as the entries are planned
+        m_progress.start([scanner](int entry) { return scanner->relativePath(entry); }, 0, 0);
         emit packerStateChanged(ArchiverStates::PS_COMPRESSING);
-        emit overallProgress(0, numEntries);
 
-        QFile archive(archiveName);
-        archive.open(QIODevice::WriteOnly);
+        //Updated archive replaces the previous one only when it is complete, as it is the source of the payloads till then
+        QFile newArchive(archiveName);
+        QSaveFile updatedArchive(archiveName);
+        QIODevice& archive = stream ? *stream : update ? static_cast<QIODevice&>(updatedArchive) : newArchive;
+        //Archive that couldn't be created or written completely is abandoned, the previous one is kept then
+        bool failed = !stream && !archive.open(QIODevice::WriteOnly);
+        auto writeArchive = [&archive, &failed](const char* data, int64_t size) {
+            if (!failed && archive.write(data, size) != size) {
+                failed = true;
+            }
+        };
+        //Pipes and other sequential outputs could only be written in one pass
+        const bool trailingIndex = options.testFlag(PO_TRAILING_INDEX) || stream || archive.isSequential();
+
+        const bool detectIncompressible = options.testFlag(PO_STORE_INCOMPRESSIBLE);
+        //Unknown methods fall back to deflate, level 0 stores the files whatever the codec is
+        if (!Codec::get(method)) {
+            method = CM_DEFLATE;
+        }
+        const Codec* codec = Codec::get(method);
+        const bool solid = options.testFlag(PO_SOLID_BLOCKS) && level != C_NO_COMPRESSION;
+        //Dictionary is trained on the sample of the small files before any of them is compressed
+        QByteArray dictionaryContent;
+        QScopedPointer<Codec::Dictionary> dictionary;
+        if (options.testFlag(PO_DICTIONARY) && level != C_NO_COMPRESSION) {
+            Metrics::Scope train(m_metrics, Metrics::PH_COMPRESS);
+            dictionaryContent = trainDictionary(packedEntries, duplicateOf, solid, detectIncompressible);
+            if (!dictionaryContent.isEmpty()) {
+                dictionary.reset(codec->createDictionary(dictionaryContent, level));
+            }
+            if (!dictionary) {
+                dictionaryContent.clear();
+            }
+        }
 
-        //Generate header
+        //Generate header, index location is filled in once all the payloads are stored either into the header or into the footer.
+        //Position is tracked by hand, as sequential devices don't report it. Dictionary goes right after the header
+        //Streamed files are split into blocks, so the reader never holds more than one of them
+        const uint32_t blockSize = options.testFlag(PO_INDEPENDENT_BLOCKS) || stream ? BLOCK_SIZE : 0;
+        ArchiveHeader header { sizeof (ArchiveHeader), FV_CURRENT, blockSize, 0, 0, 0, checksumType,
+                               dictionaryContent.isEmpty() ? 0 : SIGNATURE_SIZE + sizeof (ArchiveHeader), static_cast<uint32_t>(dictionaryContent.size()),
+                               stream ? AF_STREAM_RECORDS : AF_NONE };
         QByteArray buf;
-        appendToBuf(buf, SIGNATURE, SIGNATURE_SIZE);
-        appendToBuf(buf, RootArchEntry { numEntries, entriesSize });
-        uint64_t indexEntryOffset = buf.size();
-
-        //Append entries buffer placeholder
-        buf.append(entriesSize, 0);
-        archive.write(buf);
-
-        uint64_t lastPos = archive.pos();
-        uint64_t currentEntry = 0;
-        for (const auto& rootEntry: qAsConst(result)) {
-            if (m_cancelOperation) {
-                break;
+        appendToBuf(buf, SIGNATURE_V2, SIGNATURE_SIZE);
+        appendToBuf(buf, header);
+        buf.append(dictionaryContent);
+        writeArchive(buf.constData(), buf.size());
+        uint64_t archivePos = buf.size();
+        QByteArray index;
+
+        PackState state(packedEntries, codec, dictionary.data(), level, checksumType, detectIncompressible, threads);
+        //Adaptive level never exceeds the requested one, the time budget is spread over the files actually compressed
+        QScopedPointer<LevelController> controller;
+        if (options.testFlag(PO_ADAPTIVE_LEVEL) && level != C_NO_COMPRESSION) {
+            uint64_t totalBytes = 0;
+            for (int i = 0; i < packedEntries.size(); ++i) {
+                if (duplicateOf.value(i, -1) < 0 && reusedFrom.value(i, -1) < 0 && packedEntries.at(i).isFile()) {
+                    totalBytes += packedEntries.at(i).size();
+                }
+            }
+            controller.reset(new LevelController(level, threads, static_cast<uint64_t>(m_targetThroughput) * BYTES_TO_READ, m_timeBudget, totalBytes));
+            state.controller = controller.data();
+        }
+        state.duplicateOf = duplicateOf;
+        state.reusedFrom = reusedFrom;
+        int dealt = 0;
+        auto addJob = [&state, &dealt](const BlockJob& job) {
+            int index;
+            {
+                QMutexLocker lock(&state.mutex);
+                index = state.jobs.size();
+                state.jobs.append(job);
+                state.results.append(CompressedEntry());
+            }
+            //Consecutive blocks are dealt in batches, so the workers mostly proceed in the order the writer consumes them
+            state.queue.push(dealt++ / WORKER_BATCH_SIZE, index);
+        };
+        //Small files are collected into the solid block until it is full or the file with the payload of its own follows.
+        //Solid block of the single file is stored as the ordinary one
+        int solidFirst = -1;
+        int solidLast = -1;
+        int solidMembers = 0;
+        int64_t solidSize = 0;
+        auto closeSolid = [&]() {
+            if (solidFirst >= 0) {
+                addJob({ solidFirst, 0, solidSize, solidMembers > 1 ? solidLast : solidFirst });
+            }
+            solidFirst = solidLast = -1;
+            solidMembers = 0;
+            solidSize = 0;
+        };
+        //Jobs of the entries found so far are queued right away, the workers wait for more of them until all the entries are planned
+        int planned = 0;
+        bool allPlanned = false;
+        auto planEntries = [&](int end) {
+            const int jobsBefore = state.jobs.size();
+            for (; planned < end; ++planned) {
+                const int i = planned;
+                const auto& info = packedEntries.at(i);
+                m_progress.addTotals(1, info.isFile() ? info.size() : 0);
+                if (duplicateOf.value(i, -1) >= 0 || reusedFrom.value(i, -1) >= 0) {
+                    continue;
+                }
+                if (solid && isSolidMember(info, detectIncompressible)) {
+                    if (solidSize + info.size() > SOLID_BLOCK_SIZE) {
+                        closeSolid();
+                    }
+                    if (solidFirst < 0) {
+                        solidFirst = i;
+                    }
+                    solidLast = i;
+                    ++solidMembers;
+                    solidSize += info.size();
+                    continue;
+                }
+                if (info.isFile() && info.size() > 0) {
+                    closeSolid();
+                }
+                if (!isPooled(info, blockSize)) {
+                    continue;
+                }
+                const int64_t jobSize = blockSize > 0 ? blockSize : info.size();
+                for (int64_t offset = 0; offset < info.size(); offset += jobSize) {
+                    addJob({ i, offset, qMin<int64_t>(jobSize, info.size() - offset), i });
+                }
             }
+            if (state.jobs.size() > jobsBefore) {
+                QMutexLocker lock(&state.mutex);
+                state.jobsAdded.wakeAll();
+            }
+        };
+        //Entry is written once the job of its payload is planned, so the open solid block waits for more members or for the end of the scan
+        auto planUpTo = [&](int entry) {
+            planEntries(packedEntries.size());
+            while (!allPlanned && (planned <= entry || (solidFirst >= 0 && solidFirst <= entry))) {
+                if (scanner->waitFor(planned)) {
+                    planEntries(packedEntries.size());
+                    continue;
+                }
+                closeSolid();
+                allPlanned = true;
+                QMutexLocker lock(&state.mutex);
+                state.planned = true;
+                state.jobsAdded.wakeAll();
+            }
+            return entry < planned;
+        };
+        m_entryWorkers.setMaxThreadCount(threads);
+        for (int worker = 0; worker < threads; ++worker) {
+            m_entryWorkers.start([this, worker, &state]() { compressWorker(worker, state); });
+        }
+
+        //Waits for the job compressed by the workers and lets them run further ahead
+        auto takeCompressed = [this, &state](int job) -> CompressedEntry {
+            QMutexLocker lock(&state.mutex);
+            Tracer::Span wait("wait_workers");
+            while (!state.results.at(job).ready && !m_cancelOperation) {
+                state.entryCompressed.wait(&state.mutex, 100);
+            }
+            const CompressedEntry compressed = state.results.at(job);
+            state.results[job] = CompressedEntry();
+            state.pendingBytes -= state.jobs.at(job).size;
+            state.nextToWrite = job + 1;
+            state.writerProgressed.wakeAll();
+            return compressed;
+        };
+
+        //Index records of the streamed archive are also written in front of the payloads they describe
+        auto entryRecord = [](const QString& entryName, const ArchEntry& archEntry, const QVector<BlockEntry>& blocks, const QByteArray& extra) {
+            QByteArray record;
+            record.append(reinterpret_cast<const char*>(&archEntry), sizeof (ArchEntry));
+            record.append(entryName.toStdString().c_str(), entryName.size());
+            record.append(reinterpret_cast<const char*>(blocks.constData()), blocks.size() * sizeof (BlockEntry));
+            record.append(extra);
+            return record;
+        };
+        auto writeRecord = [this, &writeArchive, &archivePos](StreamRecordTypes type, const QByteArray& data) {
+            QByteArray record;
+            appendToBuf(record, StreamRecord { type, static_cast<uint64_t>(data.size()) });
+            record.append(data);
+            Metrics::Scope write(m_metrics, Metrics::PH_WRITE, record.size());
+            writeArchive(record.constData(), record.size());
+            archivePos += record.size();
+        };
+        auto localEntry = [&packedEntries](int entry, const QString& entryName, uint8_t compression, uint32_t blocksCount, const QByteArray& extra) -> ArchEntry {
+            const auto& info = packedEntries.at(entry);
+            return { compression, static_cast<uint8_t>(info.isDir() ? ET_DIR : ET_FILE), static_cast<uint64_t>(info.modified),
+                     info.permissions(), 0, 0, 0, 0, blocksCount,
+                     static_cast<uint16_t>(entryName.size()), static_cast<uint16_t>(extra.size()) };
+        };
+        //Offset of the block written next, past its stream record if there is one
+        auto writeBlock = [this, &writeArchive, &archivePos, stream](const CompressedEntry& compressed) -> BlockEntry {
+            Metrics::Scope write(m_metrics, Metrics::PH_WRITE, compressed.payload.size());
+            if (stream) {
+                QByteArray record;
+                appendToBuf(record, StreamRecord { SR_BLOCK, sizeof (BlockEntry) + static_cast<uint64_t>(compressed.payload.size()) });
+                appendToBuf(record, BlockEntry { archivePos + sizeof (StreamRecord) + sizeof (BlockEntry), compressed.result.compressedSize, compressed.result.fileSize, compressed.result.checksum });
+                writeArchive(record.constData(), record.size());
+                archivePos += record.size();
+            }
+            const BlockEntry block { archivePos, compressed.result.compressedSize, compressed.result.fileSize, compressed.result.checksum };
+            writeArchive(compressed.payload.constData(), compressed.payload.size());
+            archivePos += compressed.payload.size();
+            return block;
+        };
 
-            for (const auto& packedEntry: rootEntry.entries) {
-                if (m_cancelOperation) {
+        int nextJob = 0;
+        //Solid block written last and the results of its members not stored into the index yet
+        int solidEnd = -1;
+        BlockEntry solidBlock { 0, 0, 0, 0 };
+        CompressionLevels solidLevel = level;
+        QVector<FileResult> solidResults;
+        int nextMember = 0;
+        uint64_t memberOffset = 0;
+        QHash<int, StoredPayload> payloads;
+        //Blocks copied from the previous archive by their old offsets, the shared ones are copied once
+        QHash<uint64_t, uint64_t> copiedBlocks;
+        for (int i = 0; planUpTo(i) && !m_cancelOperation && !failed; ++i) {
+            const auto& info = packedEntries.at(i);
+            const QString entryName { packedEntries.relativePath(i) };
+            QVector<BlockEntry> blocks;
+            QByteArray extra;
+            //Solid block members and duplicates don't own the payload they reference
+            FileResult shared { 0, 0, 0 };
+            bool sharesPayload = false;
+            bool stored = false;
+            CompressionLevels packedLevel = level;
+            Metrics::EntryClasses entryClass = Metrics::CL_WHOLE_FILE;
+            const ArchEntry* reused = nullptr;
+            //Streamed entry with the payload of its own gets its record before the payload, the others along with the index
+            bool recordWritten = false;
+            if (nextJob < state.jobs.size() && state.jobs.at(nextJob).entry == i && state.jobs.at(nextJob).lastEntry > i) {
+                const auto compressed = takeCompressed(nextJob);
+                if (!compressed.ready) {
+                    break;
+                }
+                if (compressed.failed) {
+                    qDebug() << "Compressing solid block failed" << entryName;
+                    failed = true;
+                    break;
+                }
+                solidEnd = state.jobs.at(nextJob++).lastEntry;
+                solidResults = compressed.members;
+                solidLevel = compressed.level;
+                nextMember = 0;
+                memberOffset = 0;
+                if (stream) {
+                    //First member opens the solid block, so its record references the block following it
+                    QByteArray memberExtra;
+                    appendToBuf(memberExtra, ExtraHeader { EX_SOLID_MEMBER, sizeof (SolidMember) });
+                    appendToBuf(memberExtra, SolidMember { 0 });
+                    auto archEntry = localEntry(i, entryName, packCompression(solidLevel, method), 1, memberExtra);
+                    archEntry.checksum = solidResults.first().checksum;
+                    archEntry.uncompressed_size = solidResults.first().fileSize;
+                    const uint64_t recordSize = sizeof (ArchEntry) + entryName.size() + sizeof (BlockEntry) + memberExtra.size();
+                    const BlockEntry block { archivePos + 2 * sizeof (StreamRecord) + recordSize + sizeof (BlockEntry),
+                                             compressed.result.compressedSize, compressed.result.fileSize, compressed.result.checksum };
+                    archEntry.payload_offset = block.offset;
+                    writeRecord(SR_ENTRY, entryRecord(entryName, archEntry, { block }, memberExtra));
+                    recordWritten = true;
+                }
+                solidBlock = writeBlock(compressed);
+                m_progress.addBytes(compressed.result.fileSize, compressed.payload.size());
+            }
+            m_progress.setEntry(WRITER_SLOT, i, 0, info.isFile() ? info.size() : 0);
+            if (duplicateOf.value(i, -1) >= 0) {
+                entryClass = Metrics::CL_DUPLICATE;
+                const auto it = payloads.constFind(duplicateOf.value(i, -1));
+                if (it != payloads.constEnd()) {
+                    blocks = it->blocks;
+                    extra = it->extra;
+                    stored = it->stored;
+                    packedLevel = it->level;
+                    shared = { it->checksum, it->size, 0 };
+                    sharesPayload = true;
+                }
+            } else if (reusedFrom.value(i, -1) >= 0) {
+                entryClass = Metrics::CL_REUSED;
+                const auto& previousEntry = previousEntries.at(reusedFrom.value(i, -1));
+                reused = &previousEntry.getArchEntry();
+                for (auto block: previousEntry.getBlocks()) {
+                    auto it = copiedBlocks.constFind(block.offset);
+                    if (it == copiedBlocks.constEnd()) {
+                        //Copy is counted as the write, as the payload is read sequentially right before
+                        Metrics::Scope copy(m_metrics, Metrics::PH_WRITE, block.compressed_size);
+                        if (!copyPayload(previous, block.offset, block.compressed_size, archive)) {
+                            qDebug() << "Copying payload failed" << entryName;
+                            failed = true;
+                            break;
+                        }
+                        it = copiedBlocks.insert(block.offset, archivePos);
+                        archivePos += block.compressed_size;
+                        m_progress.addBytes(0, block.compressed_size);
+                    }
+                    block.offset = it.value();
+                    blocks.append(block);
+                }
+                if (previousEntry.getSolidOffset() >= 0) {
+                    appendToBuf(extra, ExtraHeader { EX_SOLID_MEMBER, sizeof (SolidMember) });
+                    appendToBuf(extra, SolidMember { static_cast<uint64_t>(previousEntry.getSolidOffset()) });
+                }
+                stored = getCompressionMethod(reused->compression) == CM_STORE;
+                if (failed) {
+                    break;
+                }
+            } else if (i <= solidEnd && isSolidMember(info, detectIncompressible) && nextMember < solidResults.size()) {
+                entryClass = Metrics::CL_SOLID;
+                shared = solidResults.at(nextMember++);
+                sharesPayload = true;
+                packedLevel = solidLevel;
+                blocks.append(solidBlock);
+                appendToBuf(extra, ExtraHeader { EX_SOLID_MEMBER, sizeof (SolidMember) });
+                appendToBuf(extra, SolidMember { memberOffset });
+                memberOffset += shared.fileSize;
+            } else if (isPooled(info, blockSize)) {
+                entryClass = Metrics::CL_BLOCKS;
+                bool ended = false;
+                for (; nextJob < state.jobs.size() && state.jobs.at(nextJob).entry == i; ++nextJob) {
+                    const auto compressed = takeCompressed(nextJob);
+                    if (!compressed.ready) {
+                        break;
+                    }
+                    if (compressed.failed) {
+                        qDebug() << "Compressing block failed" << entryName;
+                        failed = true;
+                        break;
+                    }
+                    //Block of the file that couldn't be read ends the entry the way the file truncated there would
+                    ended = ended || compressed.payload.isEmpty();
+                    if (ended) {
+                        continue;
+                    }
+                    if (stream && blocks.isEmpty()) {
+                        //Blocks of the entry follow its record, which tells how to restore them
+                        QByteArray localExtra;
+                        if (!compressed.stored && dictionary && isDictionaryEntry(info)) {
+                            appendToBuf(localExtra, ExtraHeader { EX_DICTIONARY, 0 });
+                        }
+                        writeRecord(SR_ENTRY, entryRecord(entryName, localEntry(i, entryName, packCompression(compressed.level, compressed.stored ? CM_STORE : method), 0, localExtra),
+                                                          QVector<BlockEntry>(), localExtra));
+                        recordWritten = true;
+                    }
+                    blocks.append(writeBlock(compressed));
+                    stored = compressed.stored;
+                    packedLevel = compressed.level;
+                    m_progress.advance(WRITER_SLOT, compressed.result.fileSize);
+                    m_progress.addBytes(compressed.result.fileSize, compressed.payload.size());
+                }
+                if (!stored && !blocks.isEmpty() && dictionary && isDictionaryEntry(info)) {
+                    appendToBuf(extra, ExtraHeader { EX_DICTIONARY, 0 });
+                }
+            } else if (info.isFile() && info.size() > 0) {
+                //Parallel deflate pays off only when the file spans several chunks
+                const bool parallel = options.testFlag(PO_PARALLEL_DEFLATE) && method == CM_DEFLATE && threads > 1 && info.size() > 2 * BYTES_TO_READ;
+                stored = level == C_NO_COMPRESSION || (detectIncompressible && isIncompressible(info, packedEntries.filePath(i), QByteArray()));
+                packedLevel = controller ? controller->level() : level;
+                QElapsedTimer timer;
+                timer.start();
+                const QString filePath { packedEntries.filePath(i) };
+                bool written = true;
+                const auto compressResult = stored ? storeFile(archive, filePath, checksumType, written) :
+                                            parallel ? compressFileParallel(archive, filePath, packedLevel, checksumType, state.cores, written) : compressFile(archive, filePath, codec, packedLevel, checksumType, written);
+                if (!written) {
+                    qDebug() << "Writing payload failed" << entryName;
+                    failed = true;
                     break;
                 }
+                //Parallel deflate runs on the whole pool, so only the files compressed by the single thread tell the speed of the level
+                if (controller && !stored && !parallel) {
+                    controller->report(packedLevel, compressResult.fileSize, compressResult.compressedSize, timer.nsecsElapsed());
+                }
+                //File that couldn't be opened has nothing written for it and is restored empty
+                if (compressResult.compressedSize > 0) {
+                    blocks.append({ archivePos, compressResult.compressedSize, compressResult.fileSize, compressResult.checksum });
+                    archivePos += compressResult.compressedSize;
+                }
+            }
+            if (m_cancelOperation || failed) {
+                break;
+            }
+
+            ArchEntry archEntry {
+                packCompression(packedLevel, stored ? CM_STORE : method),
+                static_cast<uint8_t>(info.isDir() ? ET_DIR : ET_FILE),
+                static_cast<uint64_t>(info.modified),
+                info.permissions(),
+                0,
+                0,
+                0,
+                blocks.isEmpty() ? archivePos : blocks.first().offset,
+                static_cast<uint32_t>(blocks.size()),
+                static_cast<uint16_t>(entryName.size()),
+                static_cast<uint16_t>(extra.size())
+            };
+            for (int b = 0; b < blocks.size(); ++b) {
+                //Entry checksum covers the whole file, so it is combined from the block ones
+                const auto& block = blocks.at(b);
+                archEntry.checksum = b == 0 ? block.checksum : Checksum::combine(checksumType, archEntry.checksum, block.checksum, block.uncompressed_size);
+                archEntry.compressed_size += block.compressed_size;
+                archEntry.uncompressed_size += block.uncompressed_size;
+            }
+            if (sharesPayload) {
+                archEntry.checksum = shared.checksum;
+                archEntry.compressed_size = 0;
+                archEntry.uncompressed_size = shared.fileSize;
+            }
+            if (reused) {
+                //Level and sizes are the ones the payload was produced with
+                archEntry.compression = reused->compression;
+                archEntry.checksum = reused->checksum;
+                archEntry.compressed_size = reused->compressed_size;
+                archEntry.uncompressed_size = reused->uncompressed_size;
+            }
+            if (info.isFile()) {
+                //Solid block is counted by its first member, the duplicates have no payload of their own
+                const bool ownPayload = entryClass == Metrics::CL_WHOLE_FILE || entryClass == Metrics::CL_BLOCKS;
+                m_metrics.addEntry(stored && ownPayload ? Metrics::CL_STORED : entryClass, archEntry.uncompressed_size,
+                                   entryClass == Metrics::CL_SOLID ? (nextMember == 1 ? solidBlock.compressed_size : 0) : archEntry.compressed_size);
+            }
+            if (duplicated.contains(i)) {
+                payloads.insert(i, { stored, packedLevel, archEntry.checksum, archEntry.uncompressed_size, blocks, extra });
+            }
+            const auto record { entryRecord(entryName, archEntry, blocks, extra) };
+            if (stream && !recordWritten) {
+                writeRecord(SR_ENTRY, record);
+            }
+            index.append(record);
+            ++header.total_entries;
+            m_progress.entryDone();
+        }
+        m_progress.finish();
+        scanner->stop();
+        scanner->wait();
+
+        {
+            QMutexLocker lock(&state.mutex);
+            state.stop = true;
+            state.jobsAdded.wakeAll();
+            state.writerProgressed.wakeAll();
+        }
+        m_entryWorkers.waitForDone();
 
-                uint64_t archEntryOffset = lastPos;
-                buf.clear();
-                auto compressResult = compressFile(archive, packedEntry.info, level);
-                lastPos = archive.pos();
-                archive.seek(indexEntryOffset);
-                appendToBuf(buf, ArchEntry {
-                                static_cast<uint8_t>(level),
-                                static_cast<uint8_t>(packedEntry.entryType),
-                                static_cast<uint64_t>(packedEntry.info.birthTime().currentSecsSinceEpoch()),
-                                static_cast<uint16_t>(packedEntry.info.permissions()),
-                                compressResult.checksum,
-                                static_cast<uint32_t>(compressResult.compressedSize),
-                                compressResult.fileSize,
-                                archEntryOffset,
-                                static_cast<uint16_t>(packedEntry.entryName.size())
-                             } );
-                appendToBuf(buf, *packedEntry.entryName.toStdString().c_str(), packedEntry.entryName.size());
-                archive.write(buf);
-                indexEntryOffset = archive.pos();
-                archive.seek(lastPos);
-                ++currentEntry;
-                emit overallProgress(currentEntry, numEntries);
-            }
-        }
-
-        archive.close();
-        emit packerStateChanged(ArchiverStates::PS_IDLE);
+        if (stream) {
+            writeRecord(SR_END, QByteArray());
+        }
+        {
+            Metrics::Scope indexWrite(m_metrics, Metrics::PH_INDEX, index.size());
+            writeArchive(index.constData(), index.size());
+            if (trailingIndex) {
+                ArchiveFooter footer { archivePos, static_cast<uint64_t>(index.size()), header.total_entries, { } };
+                memcpy(footer.signature, SIGNATURE_V2, SIGNATURE_SIZE);
+                writeArchive(reinterpret_cast<const char *>(&footer), sizeof (ArchiveFooter));
+            } else {
+                header.index_offset = archivePos;
+                header.index_size = index.size();
+                Tracer::Span patch("index_patch");
+                failed = failed || !archive.seek(SIGNATURE_SIZE);
+                writeArchive(reinterpret_cast<const char *>(&header), sizeof (ArchiveHeader));
+            }
+        }
+        previous.close();
+        {
+            //Buffered data is flushed by closing the archive
+            Metrics::Scope write(m_metrics, Metrics::PH_WRITE);
+            if (update) {
+                if (m_cancelOperation || failed) {
+                    updatedArchive.cancelWriting();
+                    updatedArchive.commit();
+                } else if (!updatedArchive.commit()) {
+                    failed = true;
+                }
+            } else if (!stream) {
+                failed = !newArchive.flush() || failed;
+                archive.close();
+            }
+        }
+        m_metrics.finish(!m_cancelOperation && !failed);
+        emit packerStateChanged(failed ? ArchiverStates::PS_COMPRESSION_ERROR : ArchiverStates::PS_IDLE);
 }
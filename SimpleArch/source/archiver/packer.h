@@ -2,8 +2,18 @@
 #define PACKER_H
 
 #include <QFileInfoList>
+#include <QHash>
 #include <QList>
-#include "archivebase.h"
+#include <QMutex>
+#include <QSemaphore>
+#include <QWaitCondition>
+#include "archivereader.h"
+#include "codec.h"
+#include "filescanner.h"
+#include "levelcontroller.h"
+#include "metrics.h"
+#include "progress.h"
+#include "workstealingqueue.h"
 
 class Packer : public ArchiveBase
 {
@@ -11,44 +21,121 @@ class Packer : public ArchiveBase
 
     std::atomic_bool& m_cancelOperation;
 
-    struct Entry {
-        QString entryName;
-        EntryTypes entryType;
-        QFileInfo info;
+    struct FileResult {
+        uint32_t checksum;
+        uint64_t fileSize;
+        uint64_t compressedSize;
     };
 
-    struct RelativePathEntry {
-        QString filesystemPath;
-        QList<Entry> entries;
+    //Part of the file compressed by the worker pool as an independent block,
+    //or the solid block made of the small files from entry to lastEntry
+    struct BlockJob {
+        int entry;
+        int64_t offset;
+        int64_t size;
+        int lastEntry;
     };
 
-    struct FileResult {
+    struct CompressedEntry {
+        QByteArray payload;
+        FileResult result;
+        QVector<FileResult> members;
+        CompressionLevels level;
+        bool stored;
+        bool ready;
+        bool failed;                    //Codec failed, the pack job can't go on
+    };
+
+    //State shared between the writer and the compressing workers of the pack job
+    struct PackState {
+        PackState(const FileScanner& e, const Codec* c, const Codec::Dictionary* d, CompressionLevels l, ChecksumTypes cs, bool detect, int workers);
+
+        const FileScanner& entries;
+        const Codec* codec;
+        const Codec::Dictionary* dictionary;
+        CompressionLevels level;
+        ChecksumTypes checksumType;
+        bool detectIncompressible;
+        QHash<int, int8_t> methods;     //Method chosen for the entry, missing until the first of its blocks is processed
+        LevelController* controller;    //Picks the level of every entry if it is adaptive, nullptr otherwise
+        QVector<int> duplicateOf;       //Entries referencing the payload of the other one are left out of the solid blocks,
+        QVector<int> reusedFrom;        //so are the entries keeping the payload of the archive being updated
+        QHash<int, int8_t> levels;      //Level chosen for the entry by the controller, missing until the first of its blocks is processed
+        WorkStealingQueue queue;
+        QSemaphore cores;               //Taken by the worker compressing a block and by the chunk of the parallel deflate
+        //Jobs are planned by the writer while the entries are being found, they are appended and read by the workers under the lock
+        QVector<BlockJob> jobs;
+        QVector<CompressedEntry> results;
+        QMutex mutex;
+        QWaitCondition jobsAdded;
+        QWaitCondition entryCompressed;
+        QWaitCondition writerProgressed;
+        int nextToWrite;
+        int64_t pendingBytes;
+        bool planned;                   //All the jobs are queued, so the worker finding the queue empty is done
+        bool stop;
+    };
+
+    //Payload of the entry as it is referenced by the index, reused by the duplicates of the entry
+    struct StoredPayload {
+        bool stored;
+        CompressionLevels level;
         uint32_t checksum;
-        uint32_t fileSize;
-        uint32_t compressedSize;
+        uint64_t size;
+        QVector<BlockEntry> blocks;
+        QByteArray extra;
     };
 
-    uint32_t prepareEntries(const QString& dirPath, const QFileInfoList& entries, QList<Packer::Entry>& result);
+    QThreadPool m_entryWorkers;
+    std::atomic<uint32_t> m_targetThroughput;
+    std::atomic<uint32_t> m_timeBudget;
+    Progress m_progress;
+    Metrics m_metrics;
+
+    void findDuplicates(const FileScanner& entries, QVector<int>& duplicateOf);
+    QByteArray trainDictionary(const FileScanner& entries, const QVector<int>& skipped, bool solid, bool detectIncompressible);
+    void findUnchanged(const FileScanner& entries, const QVector<ArchiveReader::FileInfo>& previousEntries, ChecksumTypes checksumType, bool compareChecksum, QVector<int>& reusedFrom);
+    static bool copyPayload(QFile& from, uint64_t offset, uint64_t size, QIODevice& to);
 
     template<typename T>
     void appendToBuf(QByteArray& buf, const T& t, uint32_t size = sizeof (T)) {
         buf.append(reinterpret_cast<const char *>(&t), size);
     }
 
-    FileResult compressFile(/*QByteArray& buf*/QFile& outFile, const QFileInfo& entry, CompressionLevels level);
+    void packArchive(QIODevice* stream, const QString& archiveName, CompressionLevels level, CompressionMethods method, ChecksumTypes checksumType, PackOptions options, const QFileInfoList& entries);
+    //Written is cleared if the output device or the codec failed, the file that couldn't be read is packed empty as before
+    FileResult compressFile(/*QByteArray& buf*/QIODevice& outFile, const QString& filePath, const Codec* codec, CompressionLevels level, ChecksumTypes checksumType, bool& written);
+    FileResult compressFileParallel(QIODevice& outFile, const QString& filePath, CompressionLevels level, ChecksumTypes checksumType, QSemaphore& cores, bool& written);
+    FileResult storeFile(QIODevice& outFile, const QString& filePath, ChecksumTypes checksumType, bool& written);
+    static FileResult compressBuffer(const QByteArray& data, const Codec* codec, const Codec::Dictionary* dictionary, CompressionLevels level, ChecksumTypes checksumType, QByteArray& out, bool& ok);
+    static bool isStoredEntry(PackState& state, int entry, const QByteArray& head);
+    static CompressionLevels entryLevel(PackState& state, int entry);
+    static bool takeJob(PackState& state, int worker, int& job);
+    void compressWorker(int worker, PackState& state);
 
 public:
     explicit Packer(std::atomic_bool& cancel, QObject* parent = nullptr);
     virtual ~Packer() = default;
 
+    //Targets of the adaptive level, the time budget of the whole job overrides the throughput if it is set
+    void setTargetThroughput(uint32_t megabytesPerSecond);
+    uint32_t getTargetThroughput() const;
+    void setTimeBudget(uint32_t seconds);
+    uint32_t getTimeBudget() const;
+    //Sampled by the observers of the job, slot 0 is the writer and the workers follow it
+    const Progress& getProgress() const;
+    //Report of the last pack job is complete once the job is back to PS_IDLE or PS_COMPRESSION_ERROR
+    const Metrics& getMetrics() const;
+
+    //Writes the archive to the device sequentially, every file is split into blocks preceded by the stream records,
+    //so the archive could be extracted from the pipe in a single pass. The device is expected to be open already
+    void packStream(QIODevice& stream, CompressionLevels level, ArchiveBase::CompressionMethods method, ArchiveBase::ChecksumTypes checksumType, ArchiveBase::PackOptions options, QFileInfoList entries);
+
 public slots:
-    void pack(QString archiveName, CompressionLevels level, QFileInfoList entries);
+    void pack(QString archiveName, CompressionLevels level, ArchiveBase::CompressionMethods method, ArchiveBase::ChecksumTypes checksumType, ArchiveBase::PackOptions options, QFileInfoList entries);
 
 signals:
     void packerStateChanged(ArchiveBase::ArchiverStates state);
-    void overallProgress(quint32 current, quint32 whole);
-    void fileProgress(QString fileName, quint32 current, quint32 whole);
-    void scanningFilesystem(QString fileName);
 };
 
 #endif // PACKER_H
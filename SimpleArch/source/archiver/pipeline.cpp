@@ -0,0 +1,257 @@
+#include "pipeline.h"
+#include <QMutexLocker>
+#include <cstring>
+
+PipelineStage::PipelineStage() :
+    m_taken(false),
+    m_stop(false)
+{
+    m_thread = std::thread([this]() { run(); });
+}
+
+PipelineStage::~PipelineStage() {
+    {
+        QMutexLocker lock(&m_mutex);
+        m_stop = true;
+        m_changed.wakeAll();
+    }
+    m_thread.join();
+}
+
+PipelineStage* PipelineStage::take(StageRoles role) {
+    //Stages live as long as the thread, the pool threads reuse them for all the streams they code
+    static thread_local PipelineStage stages[SR_COUNT];
+    auto& stage = stages[role];
+    if (stage.m_taken) {
+        return nullptr;
+    }
+    stage.m_taken = true;
+    return &stage;
+}
+
+void PipelineStage::run() {
+    QMutexLocker lock(&m_mutex);
+    while (true) {
+        while (!m_task && !m_stop) {
+            m_changed.wait(&m_mutex);
+        }
+        if (!m_task) {
+            return;
+        }
+        const auto task = m_task;
+        lock.unlock();
+        task();
+        lock.relock();
+        m_task = nullptr;
+        m_changed.wakeAll();
+    }
+}
+
+void PipelineStage::start(std::function<void()> task) {
+    QMutexLocker lock(&m_mutex);
+    m_task = std::move(task);
+    m_changed.wakeAll();
+}
+
+void PipelineStage::release() {
+    QMutexLocker lock(&m_mutex);
+    while (m_task) {
+        m_changed.wait(&m_mutex);
+    }
+    m_taken = false;
+}
+
+ReadAhead::ReadAhead(QIODevice& in, int64_t length, int chunkSize, bool pipelined, Metrics& metrics) :
+    m_in(in),
+    m_metrics(metrics),
+    m_length(length),
+    m_chunkSize(chunkSize),
+    m_done(0),
+    m_lastTaken(false),
+    m_stop(false),
+    m_stage(pipelined ? PipelineStage::take(PipelineStage::SR_READ) : nullptr)
+{
+    if (m_stage) {
+        for (int i = 0; i < PIPELINE_DEPTH; ++i) {
+            m_free.enqueue(QByteArray(m_chunkSize, Qt::Initialization::Uninitialized));
+        }
+        m_stage->start([this]() { run(); });
+    }
+}
+
+ReadAhead::~ReadAhead() {
+    {
+        QMutexLocker lock(&m_mutex);
+        m_stop = true;
+        m_freed.wakeAll();
+    }
+    if (m_stage) {
+        m_stage->release();
+    }
+}
+
+void ReadAhead::read(PipelineChunk& chunk) {
+    const int64_t length = m_length < 0 ? m_chunkSize : qMin<int64_t>(m_chunkSize, m_length - m_done);
+    //Not pipelined reader of the short stream allocates no more than the stream needs
+    if (chunk.data.size() < length) {
+        chunk.data = QByteArray(length, Qt::Initialization::Uninitialized);
+    }
+    {
+        Metrics::Scope read(m_metrics, Metrics::PH_READ);
+        chunk.size = length > 0 ? qMax<int64_t>(m_in.read(chunk.data.data(), length), 0) : 0;
+        read.addBytes(chunk.size);
+    }
+    m_done += chunk.size;
+    chunk.last = chunk.size < length || (m_length < 0 ? m_in.atEnd() : m_done >= m_length);
+}
+
+void ReadAhead::run() {
+    //Reader stops at the last chunk, the short read included
+    PipelineChunk chunk { QByteArray(), 0, false };
+    while (!chunk.last) {
+        {
+            QMutexLocker lock(&m_mutex);
+            while (m_free.isEmpty() && !m_stop) {
+                m_freed.wait(&m_mutex);
+            }
+            if (m_stop) {
+                return;
+            }
+            chunk.data = m_free.dequeue();
+        }
+        read(chunk);
+        QMutexLocker lock(&m_mutex);
+        m_ready.enqueue(chunk);
+        //Queue holds the only reference, so the buffer is never detached when it is filled again
+        chunk.data = QByteArray();
+        m_filled.wakeOne();
+    }
+}
+
+bool ReadAhead::next(PipelineChunk& chunk) {
+    if (m_lastTaken) {
+        return false;
+    }
+    if (m_stage) {
+        QMutexLocker lock(&m_mutex);
+        while (m_ready.isEmpty()) {
+            m_filled.wait(&m_mutex);
+        }
+        chunk = m_ready.dequeue();
+    } else {
+        read(chunk);
+    }
+    m_lastTaken = chunk.last;
+    return true;
+}
+
+void ReadAhead::recycle(PipelineChunk& chunk) {
+    //Not pipelined reader refills the buffer the caller keeps
+    if (m_stage) {
+        QMutexLocker lock(&m_mutex);
+        m_free.enqueue(chunk.data);
+        chunk.data = QByteArray();
+        m_freed.wakeOne();
+    }
+}
+
+WriteBehind::WriteBehind(QIODevice& out, int chunkSize, bool pipelined, Metrics& metrics) :
+    m_out(out),
+    m_metrics(metrics),
+    m_chunkSize(chunkSize),
+    m_current { QByteArray(), 0, false },
+    m_failed(false),
+    m_closing(false),
+    m_stage(pipelined ? PipelineStage::take(PipelineStage::SR_WRITE) : nullptr)
+{
+    if (m_stage) {
+        m_current.data = QByteArray(m_chunkSize, Qt::Initialization::Uninitialized);
+        for (int i = 1; i < PIPELINE_DEPTH; ++i) {
+            m_free.enqueue(QByteArray(m_chunkSize, Qt::Initialization::Uninitialized));
+        }
+        m_stage->start([this]() { run(); });
+    }
+}
+
+WriteBehind::~WriteBehind() {
+    finish();
+}
+
+void WriteBehind::run() {
+    QMutexLocker lock(&m_mutex);
+    while (true) {
+        while (m_pending.isEmpty() && !m_closing) {
+            m_submitted.wait(&m_mutex);
+        }
+        if (m_pending.isEmpty()) {
+            break;
+        }
+        auto chunk = m_pending.dequeue();
+        lock.unlock();
+        //Chunks after the failed write are dropped, the buffers still go back to the producer
+        if (!m_failed) {
+            Metrics::Scope write(m_metrics, Metrics::PH_WRITE, chunk.size);
+            if (m_out.write(chunk.data.constData(), chunk.size) != chunk.size) {
+                m_failed = true;
+            }
+        }
+        lock.relock();
+        m_free.enqueue(chunk.data);
+        chunk.data = QByteArray();
+        m_freed.wakeOne();
+    }
+}
+
+bool WriteBehind::submit() {
+    QMutexLocker lock(&m_mutex);
+    m_pending.enqueue(m_current);
+    m_current = { QByteArray(), 0, false };
+    m_submitted.wakeOne();
+    while (m_free.isEmpty()) {
+        m_freed.wait(&m_mutex);
+    }
+    m_current.data = m_free.dequeue();
+    return !m_failed;
+}
+
+bool WriteBehind::write(const char* data, size_t size) {
+    if (m_failed) {
+        return false;
+    }
+    if (!m_stage) {
+        Metrics::Scope write(m_metrics, Metrics::PH_WRITE, size);
+        if (m_out.write(data, size) != static_cast<int64_t>(size)) {
+            m_failed = true;
+        }
+        return !m_failed;
+    }
+    //Output of the codec comes in pieces of any size, it is gathered into the whole chunks
+    while (size > 0) {
+        const size_t n = qMin<size_t>(size, m_chunkSize - m_current.size);
+        memcpy(m_current.data.data() + m_current.size, data, n);
+        m_current.size += n;
+        data += n;
+        size -= n;
+        if (m_current.size == m_chunkSize && !submit()) {
+            return false;
+        }
+    }
+    return !m_failed;
+}
+
+bool WriteBehind::finish() {
+    if (m_stage) {
+        {
+            QMutexLocker lock(&m_mutex);
+            if (m_current.size > 0) {
+                m_pending.enqueue(m_current);
+            }
+            m_current = { QByteArray(), 0, false };
+            m_closing = true;
+            m_submitted.wakeAll();
+        }
+        m_stage->release();
+        m_stage = nullptr;
+    }
+    return !m_failed;
+}
@@ -0,0 +1,117 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include <QByteArray>
+#include <QIODevice>
+#include <QMutex>
+#include <QQueue>
+#include <QWaitCondition>
+#include <atomic>
+#include <functional>
+#include <thread>
+#include "metrics.h"
+
+//Buffers in flight per stage, the reader is at most this many chunks ahead of the codec and the writer as many behind
+#define PIPELINE_DEPTH      4
+//Streams shorter than this are read and written on the calling thread, handing them over to the stages costs more than it saves
+#define MIN_PIPELINED_SIZE  (4 * 1024 * 1024)
+
+//Chunk passed between the stages, the buffer is allocated once and goes back to the stage that fills it
+struct PipelineChunk {
+    QByteArray data;
+    int64_t size;
+    bool last;
+};
+
+//Long-lived thread running the stage of one pipeline at a time. Every thread coding the streams keeps one stage
+//for the reads and one for the writes, so the stages aren't started and stopped for every stream
+class PipelineStage
+{
+    QMutex m_mutex;
+    QWaitCondition m_changed;
+    std::function<void()> m_task;
+    bool m_taken;                   //Owned by the pipeline of the calling thread
+    bool m_stop;
+    std::thread m_thread;
+
+    void run();
+
+public:
+    enum StageRoles {
+        SR_READ = 0,
+        SR_WRITE,
+        SR_COUNT
+    };
+
+    PipelineStage();
+    virtual ~PipelineStage();
+
+    //Stage of the calling thread, nullptr if it is already taken by the other pipeline of the thread
+    static PipelineStage* take(StageRoles role);
+    void start(std::function<void()> task);
+    //Waits for the task to return and frees the stage for the next pipeline of the thread
+    void release();
+};
+
+//Reads the device on the stage thread into the recycled buffers while the caller codes the previous chunks.
+//Device belongs to the reader from its construction till its destruction. Not pipelined reader reads on the call
+class ReadAhead
+{
+    QIODevice& m_in;
+    Metrics& m_metrics;
+    const int64_t m_length;         //Bytes to read, -1 reads till the end of the device
+    const int m_chunkSize;
+    int64_t m_done;
+    bool m_lastTaken;
+    QMutex m_mutex;
+    QWaitCondition m_filled;
+    QWaitCondition m_freed;
+    QQueue<PipelineChunk> m_ready;
+    QQueue<QByteArray> m_free;
+    bool m_stop;
+    PipelineStage* m_stage;
+
+    void run();
+    void read(PipelineChunk& chunk);
+
+public:
+    ReadAhead(QIODevice& in, int64_t length, int chunkSize, bool pipelined, Metrics& metrics);
+    virtual ~ReadAhead();
+
+    //Blocks until the next chunk is read, returns false once the last one was taken
+    bool next(PipelineChunk& chunk);
+    //Gives the buffer of the chunk back to the reader
+    void recycle(PipelineChunk& chunk);
+};
+
+//Collects the output into the recycled buffers written by the stage thread, so the codec doesn't wait for
+//the device. Device belongs to the writer till finish(). Not pipelined writer writes on the call
+class WriteBehind
+{
+    QIODevice& m_out;
+    Metrics& m_metrics;
+    const int m_chunkSize;
+    PipelineChunk m_current;
+    std::atomic_bool m_failed;
+    QMutex m_mutex;
+    QWaitCondition m_submitted;
+    QWaitCondition m_freed;
+    QQueue<PipelineChunk> m_pending;
+    QQueue<QByteArray> m_free;
+    bool m_closing;
+    PipelineStage* m_stage;
+
+    void run();
+    bool submit();
+
+public:
+    WriteBehind(QIODevice& out, int chunkSize, bool pipelined, Metrics& metrics);
+    virtual ~WriteBehind();
+
+    //Returns false once any of the writes failed
+    bool write(const char* data, size_t size);
+    //Writes the rest and waits for the writer, returns whether all the data is written
+    bool finish();
+};
+
+#endif // PIPELINE_H
@@ -0,0 +1,145 @@
+#include "progress.h"
+#include <QMutexLocker>
+
+//Counters are only summed up and sampled, so they need no ordering with the other memory
+#define RELAXED std::memory_order_relaxed
+
+Progress::Progress() :
+    m_names(),
+    m_bytesIn(0),
+    m_bytesOut(0),
+    m_bytesTotal(0),
+    m_entriesDone(0),
+    m_entriesTotal(0),
+    m_entriesScanned(0)
+{
+    for (auto& s: m_slots) {
+        s.entry = -1;
+        s.done = 0;
+        s.size = 0;
+    }
+}
+
+void Progress::clear() {
+    m_bytesIn.store(0, RELAXED);
+    m_bytesOut.store(0, RELAXED);
+    m_bytesTotal.store(0, RELAXED);
+    m_entriesDone.store(0, RELAXED);
+    m_entriesTotal.store(0, RELAXED);
+    m_entriesScanned.store(0, RELAXED);
+    for (auto& s: m_slots) {
+        s.entry.store(-1, RELAXED);
+    }
+}
+
+Progress::Slot& Progress::slot(int index) {
+    return m_slots[index % MAX_PROGRESS_SLOTS];
+}
+
+void Progress::startScanning() {
+    clear();
+    QMutexLocker lock(&m_mutex);
+    m_names = NameResolver();
+    m_scanning.clear();
+}
+
+void Progress::setScanning(const QString& dirName) {
+    QMutexLocker lock(&m_mutex);
+    m_scanning = dirName;
+}
+
+void Progress::entryScanned(uint32_t count) {
+    m_entriesScanned.fetch_add(count, RELAXED);
+}
+
+void Progress::start(const QStringList& names, uint32_t entriesTotal, uint64_t bytesTotal) {
+    clear();
+    m_entriesTotal.store(entriesTotal, RELAXED);
+    m_bytesTotal.store(bytesTotal, RELAXED);
+    setNames(names);
+}
+
+void Progress::start(const NameResolver& names, uint32_t entriesTotal, uint64_t bytesTotal) {
+    clear();
+    m_entriesTotal.store(entriesTotal, RELAXED);
+    m_bytesTotal.store(bytesTotal, RELAXED);
+    setNames(names);
+}
+
+void Progress::finish() {
+    for (auto& s: m_slots) {
+        s.entry.store(-1, RELAXED);
+    }
+}
+
+void Progress::setNames(const QStringList& names) {
+    setNames([names](int entry) { return entry < names.size() ? names.at(entry) : QString(); });
+}
+
+void Progress::setNames(const NameResolver& names) {
+    QMutexLocker lock(&m_mutex);
+    m_names = names;
+}
+
+void Progress::addTotals(uint32_t entries, uint64_t bytes) {
+    m_entriesTotal.fetch_add(entries, RELAXED);
+    m_bytesTotal.fetch_add(bytes, RELAXED);
+}
+
+void Progress::setEntry(int index, int entry, uint64_t done, uint64_t size) {
+    if (index < 0) {
+        return;
+    }
+    auto& s = slot(index);
+    s.done.store(done, RELAXED);
+    s.size.store(size, RELAXED);
+    s.entry.store(entry, RELAXED);
+}
+
+void Progress::clearEntry(int index) {
+    if (index >= 0) {
+        slot(index).entry.store(-1, RELAXED);
+    }
+}
+
+void Progress::advance(int index, uint64_t bytes) {
+    if (index >= 0) {
+        slot(index).done.fetch_add(bytes, RELAXED);
+    }
+}
+
+void Progress::addBytes(uint64_t in, uint64_t out) {
+    m_bytesIn.fetch_add(in, RELAXED);
+    m_bytesOut.fetch_add(out, RELAXED);
+}
+
+void Progress::entryDone(uint32_t count) {
+    m_entriesDone.fetch_add(count, RELAXED);
+}
+
+Progress::Snapshot Progress::snapshot() const {
+    NameResolver names;
+    Snapshot result { m_bytesIn.load(RELAXED), m_bytesOut.load(RELAXED), m_bytesTotal.load(RELAXED),
+                      m_entriesDone.load(RELAXED), m_entriesTotal.load(RELAXED), m_entriesScanned.load(RELAXED),
+                      QString(), QString(), 0, 0, QStringList() };
+    {
+        QMutexLocker lock(&m_mutex);
+        names = m_names;
+        result.scanning = m_scanning;
+    }
+    //Fields of the slot are read one by one, so the done part is clamped in case it was read past the entry switch
+    for (const auto& s: m_slots) {
+        const int entry = s.entry.load(RELAXED);
+        const QString name { entry >= 0 && names ? names(entry) : QString() };
+        if (name.isNull()) {
+            continue;
+        }
+        if (result.currentFiles.isEmpty()) {
+            result.fileName = name;
+            result.fileSize = s.size.load(RELAXED);
+            result.fileDone = qMin(s.done.load(RELAXED), result.fileSize);
+        }
+        result.currentFiles.append(name);
+    }
+    return result;
+}
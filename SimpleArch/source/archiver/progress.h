@@ -0,0 +1,84 @@
+#ifndef PROGRESS_H
+#define PROGRESS_H
+
+#include <QMutex>
+#include <QStringList>
+#include <atomic>
+#include <functional>
+
+//Threads reporting the entries they work on, the threads beyond it share the slots
+#define MAX_PROGRESS_SLOTS 64
+
+//Progress of the pack/depack job shared between the threads doing it and the ones showing it. The job only updates
+//the atomic counters, the observers sample them at the pace of their own, so no event is queued per chunk
+class Progress
+{
+public:
+    //Name of the entry by its index, null for the unknown ones. Called by the observers, so it has to be thread safe
+    typedef std::function<QString(int)> NameResolver;
+
+    struct Snapshot {
+        uint64_t bytesIn;               //Read from the files being packed or from the archive
+        uint64_t bytesOut;              //Written to the archive or to the restored files
+        uint64_t bytesTotal;            //Expected bytesIn, 0 if unknown
+        uint32_t entriesDone;
+        uint32_t entriesTotal;          //0 if unknown
+        uint32_t entriesScanned;
+        QString scanning;               //Directory being scanned
+        QString fileName;               //Entry of the first busy slot
+        uint64_t fileDone;
+        uint64_t fileSize;
+        QStringList currentFiles;       //Entries of all the busy slots
+    };
+
+private:
+    struct Slot {
+        std::atomic_int entry;          //Index of the entry name, -1 if the slot is idle
+        std::atomic<uint64_t> done;
+        std::atomic<uint64_t> size;
+        char padding[40];               //Slots of the different workers don't share the cache line
+    };
+
+    //Names change once per job and the scanned directory once per directory, only they are behind the lock
+    mutable QMutex m_mutex;
+    NameResolver m_names;
+    QString m_scanning;
+    std::atomic<uint64_t> m_bytesIn;
+    std::atomic<uint64_t> m_bytesOut;
+    std::atomic<uint64_t> m_bytesTotal;
+    std::atomic<uint32_t> m_entriesDone;
+    std::atomic<uint32_t> m_entriesTotal;
+    std::atomic<uint32_t> m_entriesScanned;
+    Slot m_slots[MAX_PROGRESS_SLOTS];
+
+    void clear();
+    Slot& slot(int index);
+
+public:
+    Progress();
+    virtual ~Progress() = default;
+
+    //Called by the thread running the job, the scanning precedes the job if the entries have to be found first
+    void startScanning();
+    void setScanning(const QString& dirName);
+    void entryScanned(uint32_t count = 1);
+    void start(const QStringList& names, uint32_t entriesTotal, uint64_t bytesTotal);
+    void start(const NameResolver& names, uint32_t entriesTotal, uint64_t bytesTotal);
+    void finish();
+    //Entries reported by the slots are indexes of these names, the streamed jobs replace them entry by entry
+    void setNames(const QStringList& names);
+    void setNames(const NameResolver& names);
+    //Totals of the job packing the entries while they are still being found grow along with the scanning
+    void addTotals(uint32_t entries, uint64_t bytes);
+
+    //Called by the workers, slot is the index of the worker
+    void setEntry(int slot, int entry, uint64_t done, uint64_t size);
+    void clearEntry(int slot);
+    void advance(int slot, uint64_t bytes);
+    void addBytes(uint64_t in, uint64_t out);
+    void entryDone(uint32_t count = 1);
+
+    Snapshot snapshot() const;
+};
+
+#endif // PROGRESS_H
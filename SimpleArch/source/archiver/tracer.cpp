@@ -0,0 +1,148 @@
+#include "tracer.h"
+#include <QCoreApplication>
+#include <QFile>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QPair>
+#include <QThread>
+#include <QVector>
+#include <chrono>
+
+#define RELAXED std::memory_order_relaxed
+
+namespace {
+    //Fields are atomic as the dump may read the event the thread is overwriting, such event is dropped
+    struct Event {
+        std::atomic<const char*> name;
+        std::atomic<int64_t> start;
+        std::atomic<int64_t> duration;
+        std::atomic<uint64_t> bytes;
+    };
+
+    //Written by its thread only, head counts all the events ever recorded
+    struct Buffer {
+        int tid;
+        QString threadName;
+        std::atomic<uint64_t> head;
+        Event events[TRACE_BUFFER_EVENTS];
+    };
+
+    //Buffers outlive their threads, so the spans of the finished workers are still dumped. The pooled threads
+    //are reused, so there are as many buffers as threads ever traced
+    QMutex g_mutex;
+    QVector<Buffer*> g_buffers;
+    QString g_output;
+    int64_t g_lastDump = 0;
+    thread_local Buffer* t_buffer = nullptr;
+
+    Buffer* threadBuffer() {
+        if (!t_buffer) {
+            auto buffer = new Buffer();
+            const auto thread = QThread::currentThread();
+            buffer->threadName = thread && !thread->objectName().isEmpty() ? thread->objectName() : QString("thread");
+            buffer->head.store(0, RELAXED);
+            QMutexLocker lock(&g_mutex);
+            buffer->tid = g_buffers.size() + 1;
+            buffer->threadName += QString(" %1").arg(buffer->tid);
+            g_buffers.append(buffer);
+            t_buffer = buffer;
+        }
+        return t_buffer;
+    }
+}
+
+std::atomic_bool Tracer::s_enabled(false);
+
+int64_t Tracer::now() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void Tracer::record(const char* name, int64_t start, int64_t duration, uint64_t bytes) {
+    auto buffer = threadBuffer();
+    const auto head = buffer->head.load(RELAXED);
+    auto& event = buffer->events[head % TRACE_BUFFER_EVENTS];
+    event.name.store(name, RELAXED);
+    event.start.store(start, RELAXED);
+    event.duration.store(duration, RELAXED);
+    event.bytes.store(bytes, RELAXED);
+    buffer->head.store(head + 1, std::memory_order_release);
+}
+
+void Tracer::setOutput(const QString& fileName) {
+    {
+        QMutexLocker lock(&g_mutex);
+        g_output = fileName;
+        g_lastDump = now();
+    }
+    s_enabled.store(!fileName.isEmpty(), RELAXED);
+}
+
+bool Tracer::dump(const QString& job) {
+    if (!enabled()) {
+        return false;
+    }
+    QMutexLocker lock(&g_mutex);
+    const int64_t since = g_lastDump;
+    g_lastDump = now();
+    const auto pid = QCoreApplication::applicationPid();
+
+    QJsonArray events;
+    for (const auto buffer: g_buffers) {
+        const auto head = buffer->head.load(std::memory_order_acquire);
+        const uint64_t first = head > TRACE_BUFFER_EVENTS ? head - TRACE_BUFFER_EVENTS : 0;
+        QVector<QPair<uint64_t, QJsonObject>> spans;
+        for (auto i = first; i < head; ++i) {
+            const auto& event = buffer->events[i % TRACE_BUFFER_EVENTS];
+            const auto start = event.start.load(RELAXED);
+            if (start < since) {
+                continue;
+            }
+            QJsonObject span {
+                { "name", event.name.load(RELAXED) },
+                { "cat", "archiver" },
+                { "ph", "X" },
+                { "ts", start / 1e3 },
+                { "dur", event.duration.load(RELAXED) / 1e3 },
+                { "pid", pid },
+                { "tid", buffer->tid }
+            };
+            const auto bytes = event.bytes.load(RELAXED);
+            if (bytes > 0) {
+                span.insert("args", QJsonObject { { "bytes", static_cast<qint64>(bytes) } });
+            }
+            spans.append(qMakePair(i, span));
+        }
+        //Events the thread wrapped around to while they were read are dropped
+        const auto wrapped = buffer->head.load(std::memory_order_acquire);
+        const uint64_t valid = wrapped > TRACE_BUFFER_EVENTS ? wrapped - TRACE_BUFFER_EVENTS : 0;
+        while (!spans.isEmpty() && spans.first().first < valid) {
+            spans.removeFirst();
+        }
+        if (spans.isEmpty()) {
+            continue;
+        }
+        events.append(QJsonObject {
+            { "name", "thread_name" },
+            { "ph", "M" },
+            { "pid", pid },
+            { "tid", buffer->tid },
+            { "args", QJsonObject { { "name", buffer->threadName } } }
+        });
+        for (const auto& span: spans) {
+            events.append(span.second);
+        }
+    }
+    events.prepend(QJsonObject {
+        { "name", "process_name" },
+        { "ph", "M" },
+        { "pid", pid },
+        { "args", QJsonObject { { "name", job } } }
+    });
+
+    QFile f(g_output);
+    return f.open(QIODevice::WriteOnly | QIODevice::Truncate) &&
+           f.write(QJsonDocument(QJsonObject { { "traceEvents", events }, { "displayTimeUnit", "ms" } }).toJson(QJsonDocument::Compact)) >= 0;
+}
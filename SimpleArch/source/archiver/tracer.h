@@ -0,0 +1,56 @@
+#ifndef TRACER_H
+#define TRACER_H
+
+#include <QString>
+#include <atomic>
+
+//Events kept per thread, the older ones are overwritten
+#define TRACE_BUFFER_EVENTS 16384
+
+//Timeline of the spans done by every thread, dumped as the Chrome trace JSON (chrome://tracing, ui.perfetto.dev)
+//once the job is over. Spans are recorded into the ring buffer of the thread without locking, with the tracing off
+//the span costs one relaxed load
+class Tracer
+{
+public:
+    //Records the complete event from its construction till its destruction. Name has to outlive the tracer
+    class Span
+    {
+        const char* m_name;
+        int64_t m_start;
+        uint64_t m_bytes;
+
+    public:
+        explicit Span(const char* name) :
+            m_name(name),
+            m_start(enabled() ? now() : -1),
+            m_bytes(0)
+        { }
+        virtual ~Span() {
+            if (m_start >= 0) {
+                record(m_name, m_start, now() - m_start, m_bytes);
+            }
+        }
+
+        void addBytes(uint64_t bytes) {
+            m_bytes += bytes;
+        }
+    };
+
+private:
+    static std::atomic_bool s_enabled;
+
+    static int64_t now();
+    static void record(const char* name, int64_t start, int64_t duration, uint64_t bytes);
+
+public:
+    static bool enabled() {
+        return s_enabled.load(std::memory_order_relaxed);
+    }
+    //Empty file name turns the tracing off
+    static void setOutput(const QString& fileName);
+    //Writes the events recorded since the previous dump, called by the thread running the job once it is over
+    static bool dump(const QString& job);
+};
+
+#endif // TRACER_H
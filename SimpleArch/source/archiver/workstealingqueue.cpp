@@ -0,0 +1,33 @@
+#include "workstealingqueue.h"
+#include <QMutexLocker>
+
+WorkStealingQueue::WorkStealingQueue(int workers)
+{
+    for (int i = 0; i < qMax(workers, 1); ++i) {
+        m_queues.append(QSharedPointer<WorkerQueue>::create());
+    }
+}
+
+int WorkStealingQueue::workersCount() const {
+    return m_queues.size();
+}
+
+void WorkStealingQueue::push(int worker, int job) {
+    auto& q = *m_queues[worker % m_queues.size()];
+    QMutexLocker lock(&q.mutex);
+    q.jobs.enqueue(job);
+}
+
+bool WorkStealingQueue::pop(int worker, int& job) {
+    //Jobs are taken from the head of the queue both by the owner and by the thieves,
+    //as the lowest job indexes are the ones the ordered writer is waiting for
+    for (int i = 0; i < m_queues.size(); ++i) {
+        auto& q = *m_queues[(worker + i) % m_queues.size()];
+        QMutexLocker lock(&q.mutex);
+        if (!q.jobs.isEmpty()) {
+            job = q.jobs.dequeue();
+            return true;
+        }
+    }
+    return false;
+}
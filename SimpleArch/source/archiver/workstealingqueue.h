@@ -0,0 +1,30 @@
+#ifndef WORKSTEALINGQUEUE_H
+#define WORKSTEALINGQUEUE_H
+
+#include <QMutex>
+#include <QQueue>
+#include <QSharedPointer>
+#include <QVector>
+
+//Set of per-worker job queues. Worker takes jobs from its own queue first and steals from the others once it runs out of work
+class WorkStealingQueue
+{
+    struct WorkerQueue {
+        QMutex mutex;
+        QQueue<int> jobs;
+    };
+
+    QVector<QSharedPointer<WorkerQueue>> m_queues;
+
+public:
+    explicit WorkStealingQueue(int workers);
+    virtual ~WorkStealingQueue() = default;
+
+    int workersCount() const;
+
+    void push(int worker, int job);
+    //Returns false when there is no work left in any of the queues
+    bool pop(int worker, int& job);
+};
+
+#endif // WORKSTEALINGQUEUE_H
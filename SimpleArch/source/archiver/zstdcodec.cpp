@@ -0,0 +1,183 @@
+#include "zstdcodec.h"
+#include <QDebug>
+#include "zstd.h"
+
+namespace {
+    //Digested dictionaries are referenced by the contexts, so the content is hashed once for all of them
+    class ZstdDictionary : public Codec::Dictionary
+    {
+        ZSTD_CDict* m_cdict;
+        ZSTD_DDict* m_ddict;
+
+    public:
+        ZstdDictionary(const QByteArray& content, ArchiveBase::CompressionLevels level) :
+            m_cdict(level == ArchiveBase::C_NO_COMPRESSION ? nullptr : ZSTD_createCDict(content.constData(), content.size(), ZstdCodec::getZstdLevel(level))),
+            m_ddict(ZSTD_createDDict(content.constData(), content.size()))
+        {
+
+        }
+
+        ~ZstdDictionary() override {
+            ZSTD_freeCDict(m_cdict);
+            ZSTD_freeDDict(m_ddict);
+        }
+
+        const ZSTD_CDict* cdict() const {
+            return m_cdict;
+        }
+
+        const ZSTD_DDict* ddict() const {
+            return m_ddict;
+        }
+    };
+
+    ZSTD_CCtx* createCompressionContext(ArchiveBase::CompressionLevels level, bool longRange, const Codec::Dictionary* dictionary) {
+        auto* ctx = ZSTD_createCCtx();
+        if (ctx) {
+            ZSTD_CCtx_setParameter(ctx, ZSTD_c_compressionLevel, ZstdCodec::getZstdLevel(level));
+            if (longRange) {
+                ZSTD_CCtx_setParameter(ctx, ZSTD_c_enableLongDistanceMatching, 1);
+                ZSTD_CCtx_setParameter(ctx, ZSTD_c_windowLog, ZSTD_LONG_WINDOW_LOG);
+            }
+            const auto* cdict = dictionary ? static_cast<const ZstdDictionary*>(dictionary)->cdict() : nullptr;
+            if (dictionary && (!cdict || ZSTD_isError(ZSTD_CCtx_refCDict(ctx, cdict)))) {
+                ZSTD_freeCCtx(ctx);
+                return nullptr;
+            }
+        }
+        return ctx;
+    }
+
+    class ZstdEncoder : public Codec::Encoder
+    {
+        ZSTD_CCtx* m_ctx;
+        QByteArray m_buf;
+
+    public:
+        ZstdEncoder(ArchiveBase::CompressionLevels level, bool longRange, ArchiveBase::ChecksumTypes checksumType, const Codec::Dictionary* dictionary) :
+            Encoder(checksumType),
+            m_ctx(createCompressionContext(level, longRange, dictionary)),
+            m_buf(ZSTD_CStreamOutSize(), Qt::Initialization::Uninitialized)
+        {
+
+        }
+
+        ~ZstdEncoder() override {
+            ZSTD_freeCCtx(m_ctx);
+        }
+
+        bool encode(const char* data, size_t size, bool last, const Codec::Sink& sink) override {
+            if (!m_ctx) {
+                return false;
+            }
+            m_checksum.update(data, size);
+            ZSTD_inBuffer in { data, size, 0 };
+            size_t remaining;
+            do {
+                ZSTD_outBuffer out { m_buf.data(), static_cast<size_t>(m_buf.size()), 0 };
+                remaining = ZSTD_compressStream2(m_ctx, &out, &in, last ? ZSTD_e_end : ZSTD_e_continue);
+                if (ZSTD_isError(remaining)) {
+                    qDebug() << "ZSTD_compressStream2 failed:" << ZSTD_getErrorName(remaining);
+                    return false;
+                }
+                if (!sink(m_buf.constData(), out.pos)) {
+                    return false;
+                }
+            } while (last ? remaining != 0 : in.pos < in.size);
+            return true;
+        }
+    };
+
+    class ZstdDecoder : public Codec::Decoder
+    {
+        ZSTD_DCtx* m_ctx;
+        QByteArray m_buf;
+
+    public:
+        ZstdDecoder(ArchiveBase::ChecksumTypes checksumType, const Codec::Dictionary* dictionary) :
+            Decoder(checksumType),
+            m_ctx(ZSTD_createDCtx()),
+            m_buf(ZSTD_DStreamOutSize(), Qt::Initialization::Uninitialized)
+        {
+            //Frames of the long range mode need the larger window than the decoder allows by default
+            if (m_ctx) {
+                ZSTD_DCtx_setParameter(m_ctx, ZSTD_d_windowLogMax, ZSTD_LONG_WINDOW_LOG);
+                const auto* ddict = dictionary ? static_cast<const ZstdDictionary*>(dictionary)->ddict() : nullptr;
+                if (dictionary && (!ddict || ZSTD_isError(ZSTD_DCtx_refDDict(m_ctx, ddict)))) {
+                    ZSTD_freeDCtx(m_ctx);
+                    m_ctx = nullptr;
+                }
+            }
+        }
+
+        ~ZstdDecoder() override {
+            ZSTD_freeDCtx(m_ctx);
+        }
+
+        bool decode(const char* data, size_t size, const Codec::Sink& sink, bool& finished) override {
+            if (!m_ctx) {
+                return false;
+            }
+            ZSTD_inBuffer in { data, size, 0 };
+            ZSTD_outBuffer out { m_buf.data(), static_cast<size_t>(m_buf.size()), 0 };
+            do {
+                out.pos = 0;
+                const auto result = ZSTD_decompressStream(m_ctx, &out, &in);
+                if (ZSTD_isError(result)) {
+                    qDebug() << "ZSTD_decompressStream failed:" << ZSTD_getErrorName(result);
+                    return false;
+                }
+                m_checksum.update(m_buf.constData(), out.pos);
+                if (!sink(m_buf.constData(), out.pos)) {
+                    return false;
+                }
+                if (result == 0) {
+                    finished = true;
+                    return true;
+                }
+            } while (in.pos < in.size || out.pos == out.size);
+            return true;
+        }
+    };
+}
+
+ZstdCodec::ZstdCodec(bool longRange) :
+    m_longRange(longRange)
+{
+
+}
+
+int ZstdCodec::getZstdLevel(ArchiveBase::CompressionLevels level) {
+    static const int levels[] { 1, 1, 2, 3, 5, 7, 9, 12, 16, 19 };
+    return levels[qMin<int>(level, ArchiveBase::C_BEST_COMPRESSION)];
+}
+
+Codec::Encoder* ZstdCodec::createEncoder(ArchiveBase::CompressionLevels level, ArchiveBase::ChecksumTypes checksumType, const Dictionary* dictionary) const {
+    return new ZstdEncoder(level, m_longRange, checksumType, dictionary);
+}
+
+Codec::Decoder* ZstdCodec::createDecoder(ArchiveBase::ChecksumTypes checksumType, const Dictionary* dictionary) const {
+    return new ZstdDecoder(checksumType, dictionary);
+}
+
+Codec::Dictionary* ZstdCodec::createDictionary(const QByteArray& content, ArchiveBase::CompressionLevels level) const {
+    return new ZstdDictionary(content, level);
+}
+
+bool ZstdCodec::compress(const char* data, size_t size, ArchiveBase::CompressionLevels level, ArchiveBase::ChecksumTypes checksumType, const Dictionary* dictionary,
+                         QByteArray& out, uint32_t& checksum) const {
+    auto* ctx = createCompressionContext(level, m_longRange, dictionary);
+    if (!ctx) {
+        return false;
+    }
+    out.resize(ZSTD_compressBound(size));
+    const auto result = ZSTD_compress2(ctx, out.data(), out.size(), data, size);
+    ZSTD_freeCCtx(ctx);
+    if (ZSTD_isError(result)) {
+        qDebug() << "ZSTD_compress2 failed:" << ZSTD_getErrorName(result);
+        return false;
+    }
+    out.resize(result);
+    checksum = Checksum::compute(checksumType, data, size);
+    return true;
+}
@@ -0,0 +1,26 @@
+#ifndef ZSTDCODEC_H
+#define ZSTDCODEC_H
+
+#include "codec.h"
+
+#define ZSTD_LONG_WINDOW_LOG 27
+
+//zstd frames, the long range mode matches against the window of 2^ZSTD_LONG_WINDOW_LOG bytes
+class ZstdCodec : public Codec
+{
+    bool m_longRange;
+
+public:
+    explicit ZstdCodec(bool longRange);
+
+    Encoder* createEncoder(ArchiveBase::CompressionLevels level, ArchiveBase::ChecksumTypes checksumType, const Dictionary* dictionary) const override;
+    Decoder* createDecoder(ArchiveBase::ChecksumTypes checksumType, const Dictionary* dictionary) const override;
+    bool compress(const char* data, size_t size, ArchiveBase::CompressionLevels level, ArchiveBase::ChecksumTypes checksumType, const Dictionary* dictionary,
+                  QByteArray& out, uint32_t& checksum) const override;
+    Dictionary* createDictionary(const QByteArray& content, ArchiveBase::CompressionLevels level) const override;
+
+    //zstd levels corresponding to the archive ones
+    static int getZstdLevel(ArchiveBase::CompressionLevels level);
+};
+
+#endif // ZSTDCODEC_H
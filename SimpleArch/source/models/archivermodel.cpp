@@ -1,17 +1,23 @@
 #include "archivermodel.h"
 #include "source/archiver/packer.h"
 #include "source/models/filesystemdirmodel.h"
+#include <QDebug>
 #include <QSemaphore>
 #include <QUrl>
 
+#define PROGRESS_INTERVAL 100
+
 ArchiverModel::ArchiverModel(QObject* parent) :
     QObject(parent),
     m_cancelOperation(false),
     m_packerThreadObj(new Packer(m_cancelOperation)),
     m_depackerThreadObj(new Depacker(m_cancelOperation)),
-    m_archiverState(ArchiveBase::ArchiverStates::PS_IDLE)
+    m_archiverState(ArchiveBase::ArchiverStates::PS_IDLE),
+    m_threadsCount(QThread::idealThreadCount()),
+    m_sampledProgress(&m_packerThreadObj->getProgress())
 {
     qRegisterMetaType<QList<ArchiveReader::FileInfo>>("QList<ArchiveReader::FileInfo>");
+    qRegisterMetaType<QSharedPointer<ArchiveReader>>("QSharedPointer<ArchiveReader>");
 
     m_packerThread.setObjectName("Packer thread");
     m_packerThreadObj->moveToThread(&m_packerThread);
@@ -21,14 +27,15 @@ ArchiverModel::ArchiverModel(QObject* parent) :
     connect(this, &ArchiverModel::compressEntries, m_packerThreadObj.data(), &Packer::pack);
     connect(this, &ArchiverModel::decompressEntries, m_depackerThreadObj.data(), &Depacker::depack);
     connect(this, &ArchiverModel::decompressFile, m_depackerThreadObj.data(), &Depacker::depackFile);
-    connect(m_packerThreadObj.data(), &Packer::packerStateChanged, this, &ArchiverModel::setArchiverState);
-    connect(m_packerThreadObj.data(), &Packer::scanningFilesystem, this, &ArchiverModel::scanningFilesystem);
-    connect(m_packerThreadObj.data(), &Packer::fileProgress, this, &ArchiverModel::fileProgress);
-    connect(m_packerThreadObj.data(), &Packer::overallProgress, this, &ArchiverModel::overallProgress);
-    connect(m_depackerThreadObj.data(), &Depacker::depackerStateChanged, this, &ArchiverModel::setArchiverState);
-    connect(m_depackerThreadObj.data(), &Depacker::scanningFilesystem, this, &ArchiverModel::scanningFilesystem);
-    connect(m_depackerThreadObj.data(), &Depacker::fileProgress, this, &ArchiverModel::fileProgress);
-    connect(m_depackerThreadObj.data(), &Depacker::overallProgress, this, &ArchiverModel::overallProgress);
+    //State of the job tells which of the progress objects is sampled
+    connect(m_packerThreadObj.data(), &Packer::packerStateChanged, this, [this](ArchiveBase::ArchiverStates state) {
+        jobStateChanged(state, m_packerThreadObj->getProgress(), m_packerThreadObj->getMetrics());
+    });
+    connect(m_depackerThreadObj.data(), &Depacker::depackerStateChanged, this, [this](ArchiveBase::ArchiverStates state) {
+        jobStateChanged(state, m_depackerThreadObj->getProgress(), m_depackerThreadObj->getMetrics());
+    });
+    m_progressTimer.setInterval(PROGRESS_INTERVAL);
+    connect(&m_progressTimer, &QTimer::timeout, this, &ArchiverModel::sampleProgress);
 
     QSemaphore initSem { 0 };
     connect(&m_packerThread, &QThread::started, m_packerThreadObj.data(), [&initSem]() { initSem.release(); });
@@ -37,6 +44,8 @@ ArchiverModel::ArchiverModel(QObject* parent) :
     m_depackerThread.start();
 
     initSem.acquire(2);
+
+    setThreadsCount(m_threadsCount);
 }
 
 void ArchiverModel::cancelOperation() {
@@ -82,14 +91,15 @@ void ArchiverModel::decompressSelected(int row, QString archUrl, bool wholeArchi
             }
         }
         if (!selectedEntries.isEmpty() && !name.isEmpty()) {
-            emit decompressEntries(archName, name, selectedEntries);
+            emit decompressEntries(archName, name, inst.getArchiveReader(), selectedEntries);
         }
     }
 }
 
-void ArchiverModel::compressSelected(int row, QString archUrl, int level) {
+void ArchiverModel::compressSelected(int row, QString archUrl, int level, int method, int checksum, int options) {
     QString archName { QUrl(archUrl).toLocalFile() };
-    if (archName.isEmpty() || level < 0 || level > 9) {
+    if (archName.isEmpty() || level < 0 || level > 9 || !Codec::get(static_cast<ArchiveBase::CompressionMethods>(method)) ||
+            !Checksum::isSupported(static_cast<ArchiveBase::ChecksumTypes>(checksum))) {
         return;
     }
 
@@ -110,21 +120,130 @@ void ArchiverModel::compressSelected(int row, QString archUrl, int level) {
     }
     if (!selectedEntries.isEmpty()) {
         ArchiveBase::CompressionLevels clevel = static_cast<ArchiveBase::CompressionLevels>(level);
-        emit compressEntries(archName, clevel, selectedEntries);
+        emit compressEntries(archName, clevel, static_cast<ArchiveBase::CompressionMethods>(method),
+                             static_cast<ArchiveBase::ChecksumTypes>(checksum), ArchiveBase::PackOptions(options), selectedEntries);
     }
 }
 
 void ArchiverModel::setArchiverState(ArchiveBase::ArchiverStates state) {
     if (state != m_archiverState) {
+        //Last sample of the job is taken before the dialogs showing it are closed
+        sampleProgress();
         m_archiverState = state;
         emit archiverStateChanged();
     }
+    const bool running = state == ArchiveBase::ArchiverStates::PS_SCANNING_FILESYSTEM || state == ArchiveBase::ArchiverStates::PS_COMPRESSING ||
+                         state == ArchiveBase::ArchiverStates::PS_DECOMPRESSING;
+    if (running && !m_progressTimer.isActive()) {
+        m_progressTimer.start();
+    } else if (!running) {
+        m_progressTimer.stop();
+    }
+}
+
+void ArchiverModel::jobStateChanged(ArchiveBase::ArchiverStates state, const Progress& progress, const Metrics& metrics) {
+    m_sampledProgress = &progress;
+    //Report is complete by the time the job signals its final state
+    if (state == ArchiveBase::ArchiverStates::PS_IDLE || state == ArchiveBase::ArchiverStates::PS_DECOMPRESSION_ERROR ||
+        state == ArchiveBase::ArchiverStates::PS_COMPRESSION_ERROR) {
+        const auto report { QString::fromUtf8(metrics.report()) };
+        if (!report.isEmpty() && report != m_lastReport) {
+            m_lastReport = report;
+            qDebug() << "Job report" << m_lastReport;
+            emit lastReportChanged();
+        }
+    }
+    setArchiverState(state);
+}
+
+void ArchiverModel::sampleProgress() {
+    const auto snapshot { m_sampledProgress->snapshot() };
+    switch (m_archiverState) {
+    case ArchiveBase::ArchiverStates::PS_SCANNING_FILESYSTEM:
+        emit scanningFilesystem(snapshot.scanning);
+        break;
+    case ArchiveBase::ArchiverStates::PS_COMPRESSING:
+    case ArchiveBase::ArchiverStates::PS_DECOMPRESSING:
+        emit overallProgress(snapshot.entriesDone, snapshot.entriesTotal);
+        emit fileProgress(snapshot.fileName, snapshot.fileDone, snapshot.fileSize);
+        break;
+    default:
+        break;
+    }
+}
+
+int ArchiverModel::getThreadsCount() const {
+    return m_threadsCount;
+}
+
+void ArchiverModel::setThreadsCount(int count) {
+    if (count < 1) {
+        return;
+    }
+    //Pools are resized under their own locks, so it is safe to call it from the GUI thread
+    m_packerThreadObj->setThreadsCount(count);
+    m_depackerThreadObj->setThreadsCount(count);
+    if (count != m_threadsCount) {
+        m_threadsCount = count;
+        emit threadsCountChanged();
+    }
+}
+
+int ArchiverModel::getIdealThreadsCount() const {
+    return QThread::idealThreadCount();
+}
+
+int ArchiverModel::getTargetThroughput() const {
+    return m_packerThreadObj->getTargetThroughput();
+}
+
+void ArchiverModel::setTargetThroughput(int megabytesPerSecond) {
+    if (megabytesPerSecond < 1 || megabytesPerSecond == getTargetThroughput()) {
+        return;
+    }
+    //Targets are atomics read once the pack job starts
+    m_packerThreadObj->setTargetThroughput(megabytesPerSecond);
+    emit targetThroughputChanged();
+}
+
+QString ArchiverModel::getLastReport() const {
+    return m_lastReport;
+}
+
+int ArchiverModel::getTimeBudget() const {
+    return m_packerThreadObj->getTimeBudget();
+}
+
+void ArchiverModel::setTimeBudget(int seconds) {
+    if (seconds < 0 || seconds == getTimeBudget()) {
+        return;
+    }
+    m_packerThreadObj->setTimeBudget(seconds);
+    emit timeBudgetChanged();
 }
 
 QVariantList ArchiverModel::getCompressionLevels() const {
     return QVariantList({0, 1, 2, 3, 4, 5, 6, 7, 8, 9});
 }
 
+QVariantList ArchiverModel::getCompressionMethods() const {
+    const auto method = [](const QString& text, ArchiveBase::CompressionMethods value) {
+        return QVariantMap({ { "text", text }, { "value", static_cast<int>(value) } });
+    };
+    return QVariantList({ method("Deflate", ArchiveBase::CM_DEFLATE),
+                          method("Zstd", ArchiveBase::CM_ZSTD),
+                          method("Zstd long range", ArchiveBase::CM_ZSTD_LONG),
+                          method("LZ4", ArchiveBase::CM_LZ4) });
+}
+
+QVariantList ArchiverModel::getChecksumTypes() const {
+    const auto checksum = [](const QString& text, ArchiveBase::ChecksumTypes value) {
+        return QVariantMap({ { "text", text }, { "value", static_cast<int>(value) } });
+    };
+    return QVariantList({ checksum("Adler-32", ArchiveBase::CS_ADLER32),
+                          checksum("CRC32C", ArchiveBase::CS_CRC32C) });
+}
+
 ArchiveBase::ArchiverStates ArchiverModel::getArchiverState() const {
     return m_archiverState;
 }
@@ -6,6 +6,7 @@
 #include <QFileInfoList>
 #include <QScopedPointer>
 #include <QThread>
+#include <QTimer>
 #include "source/archiver/packer.h"
 #include "source/archiver/depacker.h"
 #include "source/archiver/archivereader.h"
@@ -16,6 +17,14 @@ class ArchiverModel : public QObject
 
     Q_PROPERTY(ArchiveBase::ArchiverStates archiverState READ getArchiverState NOTIFY archiverStateChanged)
     Q_PROPERTY(QVariantList compressionLevels READ getCompressionLevels CONSTANT)
+    Q_PROPERTY(QVariantList compressionMethods READ getCompressionMethods CONSTANT)
+    Q_PROPERTY(QVariantList checksumTypes READ getChecksumTypes CONSTANT)
+    Q_PROPERTY(int threadsCount READ getThreadsCount WRITE setThreadsCount NOTIFY threadsCountChanged)
+    Q_PROPERTY(int idealThreadsCount READ getIdealThreadsCount CONSTANT)
+    Q_PROPERTY(int targetThroughput READ getTargetThroughput WRITE setTargetThroughput NOTIFY targetThroughputChanged)
+    Q_PROPERTY(int timeBudget READ getTimeBudget WRITE setTimeBudget NOTIFY timeBudgetChanged)
+    //JSON report of the last finished job, parsed on the QML side with JSON.parse
+    Q_PROPERTY(QString lastReport READ getLastReport NOTIFY lastReportChanged)
 
     QThread m_packerThread;
     QThread m_depackerThread;
@@ -23,26 +32,48 @@ class ArchiverModel : public QObject
     QScopedPointer<Packer> m_packerThreadObj;
     QScopedPointer<Depacker> m_depackerThreadObj;
     ArchiveBase::ArchiverStates m_archiverState;
+    int m_threadsCount;
+    //Progress of the running job is sampled by the timer, only the state changes are signalled by the job
+    QTimer m_progressTimer;
+    const Progress* m_sampledProgress;
+    QString m_lastReport;
+
+    void sampleProgress();
+    void jobStateChanged(ArchiveBase::ArchiverStates state, const Progress& progress, const Metrics& metrics);
 
 public:
     explicit ArchiverModel(QObject* parent = nullptr);
     virtual ~ArchiverModel();
 
     QVariantList getCompressionLevels() const;
+    QVariantList getCompressionMethods() const;
+    QVariantList getChecksumTypes() const;
     ArchiveBase::ArchiverStates getArchiverState() const;
     void setArchiverState(ArchiveBase::ArchiverStates state);
+    int getThreadsCount() const;
+    void setThreadsCount(int count);
+    int getIdealThreadsCount() const;
+    int getTargetThroughput() const;
+    void setTargetThroughput(int megabytesPerSecond);
+    int getTimeBudget() const;
+    void setTimeBudget(int seconds);
+    QString getLastReport() const;
 
     static ArchiverModel* instance();
 
     Q_INVOKABLE void decompressSelected(int row, QString archUrl, bool wholeArchive);
-    Q_INVOKABLE void compressSelected(int row, QString archUrl, int level);
+    Q_INVOKABLE void compressSelected(int row, QString archUrl, int level, int method = ArchiveBase::CM_DEFLATE, int checksum = ArchiveBase::CS_ADLER32, int options = ArchiveBase::PO_NONE);
     Q_INVOKABLE void cancelOperation();
 
 signals:
     void decompressFile(QString depackDir, QString archiveName);
-    void decompressEntries(QString depackDir, QString file, QList<ArchiveReader::FileInfo> entries);
-    void compressEntries(QString archName, ArchiveBase::CompressionLevels level, QFileInfoList entries);
+    void decompressEntries(QString depackDir, QString file, QSharedPointer<ArchiveReader> archiveReader, QList<ArchiveReader::FileInfo> entries);
+    void compressEntries(QString archName, ArchiveBase::CompressionLevels level, ArchiveBase::CompressionMethods method, ArchiveBase::ChecksumTypes checksum, ArchiveBase::PackOptions options, QFileInfoList entries);
     void archiverStateChanged();
+    void threadsCountChanged();
+    void targetThroughputChanged();
+    void timeBudgetChanged();
+    void lastReportChanged();
     void overallProgress(quint32 current, quint32 whole);
     void fileProgress(QString fileName, quint32 current, quint32 whole);
     void scanningFilesystem(QString fileName);
@@ -1,5 +1,6 @@
 #include "filesystemdirmodel.h"
 #include "source/enummetainfo/enummetainfo.h"
+#include "source/archiver/tracer.h"
 #include <QDir>
 #include <QDirIterator>
 #include <QSemaphore>
@@ -131,6 +132,7 @@ ReadDirThread::ReadDirThread(QObject* parent) :
 }
 
 void ReadDirThread::readFilesystemDir(const QString& dirName) {
+    Tracer::Span span("read_dir");
     m_reading = true;
 
     //emit start-of-work signal
@@ -179,6 +181,7 @@ QString ReadDirThread::getArchivePath(const QString& name) {
 }
 
 void ReadDirThread::readArchiveFilesystem(const QString& archive) {
+    Tracer::Span span("read_archive_dir");
     m_reading = true;
 
     //emit start-of-work signal
@@ -0,0 +1,12 @@
+#Round trips of the archiver core, run by make check
+QT = core concurrent testlib
+
+CONFIG += c++11 console testcase
+CONFIG -= app_bundle
+
+TARGET = tst_roundtrip
+
+SOURCES += \
+        tst_roundtrip.cpp
+
+include(../archiver.pri)
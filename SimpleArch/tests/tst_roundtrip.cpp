@@ -0,0 +1,215 @@
+#include <QtTest>
+#include <QBuffer>
+#include <QDirIterator>
+#include <QRandomGenerator>
+#include <QTemporaryDir>
+#include "source/archiver/checksum.h"
+#include "source/archiver/depacker.h"
+#include "source/archiver/packer.h"
+
+//Fixed seed, so every run packs exactly the same tree
+#define TREE_SEED 0x54737472u
+
+namespace {
+    QByteArray textData(QRandomGenerator& rng, int size) {
+        static const char* const words[] {
+            "archive", "block", "checksum", "deflate", "entry", "index", "inflate", "payload", "solid", "stream",
+            "the", "of", "and", "to", "in", "is", "0", "1", "42", "\n"
+        };
+        QByteArray data;
+        data.reserve(size + 16);
+        while (data.size() < size) {
+            data.append(words[rng.bounded(static_cast<int>(sizeof (words) / sizeof (words[0])))]).append(' ');
+        }
+        data.resize(size);
+        return data;
+    }
+
+    bool writeFile(const QString& path, const QByteArray& data) {
+        QFile f(path);
+        return f.open(QIODevice::WriteOnly) && f.write(data) == data.size();
+    }
+
+    QByteArray readFile(const QString& path) {
+        QFile f(path);
+        return f.open(QIODevice::ReadOnly) ? f.readAll() : QByteArray();
+    }
+}
+
+//Packs the generated tree, tests the archive and extracts it, the extracted tree has to be the same as the packed one
+class RoundTripTest : public QObject
+{
+    Q_OBJECT
+
+    std::atomic_bool m_cancel { false };
+    QTemporaryDir m_dir;
+
+    QString sourcePath() const {
+        return m_dir.path() + "/tree";
+    }
+
+    //Small text files with the copies among them, an empty file and directory, a file of several blocks and the random one
+    bool generateTree() {
+        QRandomGenerator rng(TREE_SEED);
+        const QString root { sourcePath() };
+        if (!QDir().mkpath(root + "/text/nested") || !QDir().mkpath(root + "/other") || !QDir().mkpath(root + "/empty")) {
+            return false;
+        }
+        QVector<QByteArray> small;
+        for (int i = 0; i < 40; ++i) {
+            small.append(textData(rng, 16 + rng.bounded(4096)));
+            if (!writeFile(QString("%1/text/%2/f%3.txt").arg(root, i % 2 ? "nested" : ".").arg(i), small.last())) {
+                return false;
+            }
+        }
+        QByteArray random((64 * 1024) & ~3, Qt::Initialization::Uninitialized);
+        rng.fillRange(reinterpret_cast<quint32*>(random.data()), random.size() / 4);
+        return writeFile(root + "/text/copy.txt", small.at(3)) &&
+               writeFile(root + "/other/copy.txt", small.at(7)) &&
+               writeFile(root + "/other/empty.txt", QByteArray()) &&
+               writeFile(root + "/large.log", textData(rng, 9 * BYTES_TO_READ + 123)) &&
+               writeFile(root + "/random.bin", random);
+    }
+
+    //Every entry of the source is in the target with the same content and the target has nothing else
+    static bool compareTrees(const QString& source, const QString& target) {
+        int count = 0;
+        for (QDirIterator it(source, QDir::AllEntries | QDir::NoDotAndDotDot | QDir::Hidden, QDirIterator::Subdirectories); it.hasNext(); ++count) {
+            const QFileInfo info(it.next());
+            const QFileInfo restored(target + info.absoluteFilePath().mid(source.size()));
+            if (!restored.exists() || restored.isDir() != info.isDir()) {
+                qWarning() << "Missing" << restored.filePath();
+                return false;
+            }
+            if (info.isFile() && readFile(info.absoluteFilePath()) != readFile(restored.absoluteFilePath())) {
+                qWarning() << "Different" << restored.filePath();
+                return false;
+            }
+        }
+        for (QDirIterator it(target, QDir::AllEntries | QDir::NoDotAndDotDot | QDir::Hidden, QDirIterator::Subdirectories); it.hasNext(); it.next()) {
+            --count;
+        }
+        return count == 0;
+    }
+
+    bool pack(const QString& archive, ArchiveBase::CompressionMethods method, ArchiveBase::ChecksumTypes checksumType, ArchiveBase::PackOptions options) {
+        Packer packer(m_cancel);
+        packer.setThreadsCount(4);
+        bool failed = false;
+        connect(&packer, &Packer::packerStateChanged, [&failed](ArchiveBase::ArchiverStates state) {
+            failed = failed || state == ArchiveBase::ArchiverStates::PS_COMPRESSION_ERROR;
+        });
+        packer.pack(archive, ArchiveBase::C_LEVEL_6, method, checksumType, options, { QFileInfo(sourcePath()) });
+        return !failed && QFileInfo::exists(archive);
+    }
+
+    bool extract(const QString& archive, const QString& outDir) {
+        Depacker depacker(m_cancel);
+        depacker.setThreadsCount(4);
+        bool failed = false;
+        connect(&depacker, &Depacker::depackerStateChanged, [&failed](ArchiveBase::ArchiverStates state) {
+            failed = failed || state == ArchiveBase::ArchiverStates::PS_DECOMPRESSION_ERROR;
+        });
+        QDir(outDir).removeRecursively();
+        if (!QDir().mkpath(outDir)) {
+            return false;
+        }
+        depacker.depackFile(outDir, archive);
+        return !failed;
+    }
+
+    void addOptionsColumns() {
+        QTest::addColumn<int>("method");
+        QTest::addColumn<int>("checksum");
+        QTest::addColumn<int>("options");
+    }
+
+private slots:
+    void initTestCase() {
+        QVERIFY(m_dir.isValid());
+        QVERIFY(generateTree());
+    }
+
+    void packTestExtract_data() {
+        addOptionsColumns();
+        QTest::newRow("deflate") << int(ArchiveBase::CM_DEFLATE) << int(ArchiveBase::CS_ADLER32) << int(ArchiveBase::PO_NONE);
+        QTest::newRow("crc32c") << int(ArchiveBase::CM_DEFLATE) << int(ArchiveBase::CS_CRC32C) << int(ArchiveBase::PO_NONE);
+        QTest::newRow("blocks crc32c") << int(ArchiveBase::CM_ZSTD) << int(ArchiveBase::CS_CRC32C) << int(ArchiveBase::PO_INDEPENDENT_BLOCKS | ArchiveBase::PO_STORE_INCOMPRESSIBLE);
+        QTest::newRow("parallel deflate") << int(ArchiveBase::CM_DEFLATE) << int(ArchiveBase::CS_ADLER32) << int(ArchiveBase::PO_PARALLEL_DEFLATE | ArchiveBase::PO_TRAILING_INDEX);
+        //Copies are in between the members of the solid blocks
+        QTest::newRow("solid dedup") << int(ArchiveBase::CM_DEFLATE) << int(ArchiveBase::CS_ADLER32) << int(ArchiveBase::PO_SOLID_BLOCKS | ArchiveBase::PO_DEDUPLICATE);
+        QTest::newRow("solid dedup crc32c") << int(ArchiveBase::CM_ZSTD) << int(ArchiveBase::CS_CRC32C) << int(ArchiveBase::PO_SOLID_BLOCKS | ArchiveBase::PO_DEDUPLICATE | ArchiveBase::PO_DICTIONARY);
+    }
+
+    void packTestExtract() {
+        QFETCH(int, method);
+        QFETCH(int, checksum);
+        QFETCH(int, options);
+        if (!Checksum::isSupported(static_cast<ArchiveBase::ChecksumTypes>(checksum))) {
+            QSKIP("Checksum is not supported by this build");
+        }
+        const QString archive { m_dir.path() + "/packed.sar" };
+        QFile::remove(archive);
+        QVERIFY(pack(archive, static_cast<ArchiveBase::CompressionMethods>(method), static_cast<ArchiveBase::ChecksumTypes>(checksum), ArchiveBase::PackOptions(QFlag(options))));
+        QVERIFY(Depacker(m_cancel).testArchive(archive));
+        const QString outDir { m_dir.path() + "/out" };
+        QVERIFY(extract(archive, outDir));
+        QVERIFY(compareTrees(sourcePath(), outDir + "/tree"));
+    }
+
+    void streamed_data() {
+        addOptionsColumns();
+        QTest::newRow("deflate") << int(ArchiveBase::CM_DEFLATE) << int(ArchiveBase::CS_ADLER32) << int(ArchiveBase::PO_NONE);
+        QTest::newRow("crc32c") << int(ArchiveBase::CM_DEFLATE) << int(ArchiveBase::CS_CRC32C) << int(ArchiveBase::PO_INDEPENDENT_BLOCKS);
+        QTest::newRow("solid dedup") << int(ArchiveBase::CM_DEFLATE) << int(ArchiveBase::CS_ADLER32) << int(ArchiveBase::PO_SOLID_BLOCKS | ArchiveBase::PO_DEDUPLICATE);
+    }
+
+    void streamed() {
+        QFETCH(int, method);
+        QFETCH(int, checksum);
+        QFETCH(int, options);
+        if (!Checksum::isSupported(static_cast<ArchiveBase::ChecksumTypes>(checksum))) {
+            QSKIP("Checksum is not supported by this build");
+        }
+        QBuffer stream;
+        QVERIFY(stream.open(QIODevice::ReadWrite));
+        Packer packer(m_cancel);
+        bool failed = false;
+        connect(&packer, &Packer::packerStateChanged, [&failed](ArchiveBase::ArchiverStates state) {
+            failed = failed || state == ArchiveBase::ArchiverStates::PS_COMPRESSION_ERROR;
+        });
+        packer.packStream(stream, ArchiveBase::C_LEVEL_6, static_cast<ArchiveBase::CompressionMethods>(method), static_cast<ArchiveBase::ChecksumTypes>(checksum),
+                          ArchiveBase::PackOptions(QFlag(options)), { QFileInfo(sourcePath()) });
+        QVERIFY(!failed);
+
+        QVERIFY(stream.seek(0));
+        const QString outDir { m_dir.path() + "/out" };
+        QDir(outDir).removeRecursively();
+        QVERIFY(QDir().mkpath(outDir));
+        QVERIFY(Depacker(m_cancel).depackStream(stream, outDir));
+        QVERIFY(compareTrees(sourcePath(), outDir + "/tree"));
+    }
+
+    //Payloads of the unchanged files are copied from the previous archive, the changed and new ones are among them in the solid blocks
+    void update() {
+        const QString archive { m_dir.path() + "/updated.sar" };
+        const ArchiveBase::PackOptions options { ArchiveBase::PO_SOLID_BLOCKS | ArchiveBase::PO_DEDUPLICATE | ArchiveBase::PO_UPDATE };
+        QFile::remove(archive);
+        QVERIFY(pack(archive, ArchiveBase::CM_DEFLATE, ArchiveBase::CS_ADLER32, options));
+
+        QRandomGenerator rng(TREE_SEED + 1);
+        QVERIFY(writeFile(sourcePath() + "/text/f10.txt", textData(rng, 5000)));
+        QVERIFY(writeFile(sourcePath() + "/text/nested/f11.txt", textData(rng, 100)));
+        QVERIFY(writeFile(sourcePath() + "/text/added.txt", textData(rng, 2000)));
+        QVERIFY(pack(archive, ArchiveBase::CM_DEFLATE, ArchiveBase::CS_ADLER32, options));
+
+        QVERIFY(Depacker(m_cancel).testArchive(archive));
+        const QString outDir { m_dir.path() + "/out" };
+        QVERIFY(extract(archive, outDir));
+        QVERIFY(compareTrees(sourcePath(), outDir + "/tree"));
+    }
+};
+
+QTEST_GUILESS_MAIN(RoundTripTest)
+
+#include "tst_roundtrip.moc"